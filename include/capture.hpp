@@ -0,0 +1,158 @@
+
+#ifndef __INCLUDE_CAPTURE_HPP__
+#define __INCLUDE_CAPTURE_HPP__
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Raw multi-camera frame file. It starts with raw_header_t and raw_camera_t
+// of every camera, followed by sets of frames of all cameras taken at the
+// same time. A set starts with int64 timestamps of the cameras in
+// microseconds followed by the frames in camera order. Timestamps and frames
+// are aligned to kRawAlignment bytes, rows of a frame are not padded
+const char kRawMagic[8] = {'R', 'I', 'G', 'R', 'A', 'W', '\0', '\0'};
+const uint32_t kRawVersion = 1;
+const size_t kRawAlignment = 64;
+
+// How pixels of a frame are laid out. NV12 frames are CV_8UC1 matrices with
+// the chroma plane below the luma one, see splitNV12
+enum class FrameFormat : uint32_t {
+  Packed = 0,
+  NV12 = 1
+};
+
+struct raw_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t cameras;
+  // Distance between the starts of two sets
+  uint64_t set_size;
+};
+
+struct raw_camera_t {
+  int32_t width;
+  int32_t height;
+  // OpenCV type of the matrix, e.g. CV_8UC3
+  int32_t type;
+  // FrameFormat
+  uint32_t format;
+  // Offset of the frame from the start of its set
+  uint64_t offset;
+};
+
+// Read-only view of a raw file mapped into memory. Frames are returned as
+// cv::Mat headers pointing into the mapping, nothing is decoded or copied.
+// Writes to them stay private to the process
+class RawFrameFile {
+ public:
+  explicit RawFrameFile(const std::string &path);
+  ~RawFrameFile();
+
+  RawFrameFile(const RawFrameFile&) = delete;
+  RawFrameFile &operator=(const RawFrameFile&) = delete;
+
+  bool isOpened() const { return data != nullptr; }
+
+  size_t cameras() const { return layout.size(); }
+  // Number of complete sets of frames
+  size_t frames() const { return count; }
+
+  // Size and type of the matrix of the frame
+  cv::Size frameSize(size_t camera) const;
+  int frameType(size_t camera) const;
+  FrameFormat frameFormat(size_t camera) const;
+
+  // The view is valid while the file is open
+  cv::Mat frame(size_t index, size_t camera) const;
+  int64_t timestamp(size_t index, size_t camera) const;
+
+ private:
+  uint8_t *data = nullptr;
+  size_t length = 0;
+  size_t first = 0;
+  size_t setSize = 0;
+  size_t count = 0;
+  std::vector<raw_camera_t> layout;
+};
+
+class RawFrameWriter {
+ public:
+  // Frames are packed unless formats say otherwise
+  RawFrameWriter(const std::string &path, const std::vector<cv::Size> &sizes,
+      const std::vector<int> &types,
+      const std::vector<FrameFormat> &formats = {});
+
+  bool isOpened() const { return out.is_open() && out.good(); }
+
+  // Append a set of frames of all cameras, false if the frames do not match
+  // the layout or writing failed
+  bool write(const std::vector<cv::Mat> &frames,
+      const std::vector<int64_t> &timestamps);
+
+ private:
+  std::ofstream out;
+  uint64_t setSize = 0;
+  std::vector<raw_camera_t> layout;
+};
+
+// Frames of a single camera read either from a video through VideoCapture or
+// from a raw file. Path "file.raw#k" selects k-th camera of the raw file,
+// "file.raw" the first one
+class FrameSource {
+ public:
+  FrameSource() = default;
+  explicit FrameSource(const std::string &path) { open(path); }
+
+  bool open(const std::string &path);
+  bool isOpened() const;
+
+  // Next frame, empty at the end. Frames of raw files are views of the file
+  // valid while the source is open
+  bool read(cv::Mat &frame);
+  FrameSource &operator>>(cv::Mat &frame);
+  // Skip a frame
+  bool grab();
+
+  // Go to index-th frame. Videos which can not seek precisely are rewound
+  // and skipped through
+  bool seek(int index);
+
+  // Number of frames, 0 if unknown
+  int count();
+
+  // Ask the backend of a video for NV12 frames instead of frames decoded to
+  // BGR. Must be called before the first read, true if frames are NV12 now.
+  // Backends which do not report NV12 pixels, e.g. FFmpeg decoding files,
+  // keep converting to BGR. Raw files keep their format
+  bool requestNV12();
+
+  // Layout of the frames, videos are decoded to packed BGR unless
+  // requestNV12 succeeded
+  FrameFormat format() const;
+
+  // Timestamp of the last read frame in microseconds
+  int64_t timestamp() const { return stamp; }
+
+ private:
+  std::string path;
+  cv::VideoCapture capture;
+  std::shared_ptr<RawFrameFile> raw;
+  size_t camera = 0;
+  size_t position = 0;
+  int64_t stamp = 0;
+  // Whether the capture delivers frames as the backend decoded them
+  bool nv12 = false;
+};
+
+// Replace paths of raw files which do not select a camera by paths of all
+// cameras of the file
+std::vector<std::string> expandFramePaths(
+    const std::vector<std::string> &paths);
+
+#endif // __INCLUDE_CAPTURE_HPP__
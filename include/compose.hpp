@@ -0,0 +1,275 @@
+
+#ifndef __INCLUDE_COMPOSE_HPP__
+#define __INCLUDE_COMPOSE_HPP__
+
+#include "compose_types.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <vector>
+#include <cstdint>
+
+// Label of canvas pixels not covered by any camera in the owner map
+const uint8_t kNoOwner = 255;
+
+// Horizontal run [x, x + n) of pixels in a row of roi
+struct map_span_t {
+  int x;
+  int n;
+};
+
+struct warp_maps_t {
+  // Part of the canvas covered by the camera
+  cv::Rect roi;
+  // CV_32FC2 matrix with coordinates of source pixels. Dense map has roi size
+  // and negative coordinates mark pixels which have no source. Sparse map
+  // holds coordinates for every grid-th pixel in both directions, the rest
+  // are interpolated by the kernel
+  cv::Mat map;
+  int grid = 1;
+  // The largest distance between interpolated and exact source coordinates
+  // over all pixels of the sparse map, in source pixels
+  double maxError = 0;
+  // Blocks of roi in the order they should be composed. Empty means
+  // row-by-row traversal
+  std::vector<cv::Rect> tiles;
+  // Number of pixels each of tiles composes: owned ones which have source
+  std::vector<int> tilePixels;
+  // Part of the source image each of tiles is sampled from, see
+  // planTileSources
+  std::vector<cv::Rect> tileSources;
+  // Pixels of roi owned by the camera: y-th row consists of spans with
+  // indices [spanRows[y], spanRows[y + 1]). Empty spanRows means that every
+  // pixel of roi is composed
+  std::vector<map_span_t> spans;
+  std::vector<int> spanRows;
+};
+
+// Build maps which combine undistortion (if cameraMatrix is not empty) and
+// perspective transformation H of an image of size imageSize. grid > 1 builds
+// sparse map with nodes every grid pixels
+void buildWarpMaps(const cv::Mat &H, const cv::Mat &cameraMatrix,
+    const cv::Mat &distCoeffs, const cv::Size &imageSize,
+    const cv::Size &canvasSize, warp_maps_t &maps, int grid = 1);
+
+// Cylindrical or spherical canvas. Columns are longitudes and rows are
+// heights on the unit cylinder or latitudes, both scale pixels per radian
+// starting from origin. Viewing directions are given in the coordinate
+// system of the first camera: x to the right, y down, z forward
+struct projection_t {
+  Projection type = Projection::Plane;
+  // Homography from viewing directions to the common plane of H: H of the
+  // first camera times its camera matrix
+  cv::Mat P;
+  double scale = 1;
+  cv::Point2d origin;
+};
+
+// Fit the canvas to the cameras with homographies H and undistorted images
+// of imageSizes. The scale keeps resolution of the first camera at its
+// center. Its cameraMatrix may be empty, then the focal length is assumed
+// to be equal to the larger side of the image. Optical axes of the cameras
+// must be less than 90 degrees away from the one of the first camera. On a
+// cylinder, footprints are cut at 75 degrees above and below its axis.
+// False if the homographies give no finite canvas of a sane size
+bool fitProjection(Projection type, const std::vector<cv::Mat> &H,
+    const cv::Mat &cameraMatrix, const std::vector<cv::Size> &imageSizes,
+    projection_t &projection, cv::Size &canvasSize);
+
+// Viewing direction of the canvas point and back
+cv::Vec3d canvasDirection(const projection_t &projection, double u,
+    double v);
+cv::Point2d directionToCanvas(const projection_t &projection,
+    const cv::Vec3d &direction);
+
+// Bounding box of the undistorted image of the camera with homography H on
+// the curved canvas, not clipped by the canvas
+void projectedBounds(const cv::Mat &H, const projection_t &projection,
+    const cv::Size &imageSize, cv::Point2d &low, cv::Point2d &high);
+
+// 3x3 matrix taking viewing directions to homogeneous undistorted pixels of
+// the camera with homography H. Its sign is chosen so that the camera looks
+// forward
+cv::Mat_<double> directionsToImage(const cv::Mat &H,
+    const projection_t &projection, const cv::Size &imageSize);
+
+// The same as above for a curved canvas: canvas pixels are turned into
+// viewing directions which H and the projection take to the source image
+void buildWarpMaps(const cv::Mat &H, const projection_t &projection,
+    const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+    const cv::Size &imageSize, const cv::Size &canvasSize, warp_maps_t &maps,
+    int grid = 1);
+
+// Scale which brings the canvas within the budget in megapixels, 1 if it
+// fits already or the budget is not positive
+double budgetScale(const cv::Size &canvasSize, double megapixels);
+
+// Size of the canvas scaled with transformCanvas, every pixel of it has
+// a counterpart on the original canvas
+cv::Size scaleCanvasSize(const cv::Size &canvasSize, double scale);
+
+// The largest rectangle of the canvas whose pixels all have an owner, empty
+// if no pixel has one
+cv::Rect largestCoveredRect(const cv::Mat &owners);
+
+// Move the canvas point p to (p - offset) * scale by updating homographies
+// of a plane canvas or the curved projection
+void transformCanvas(const cv::Point2d &offset, double scale,
+    std::vector<cv::Mat> &H, projection_t &projection);
+
+// Size of the map matrix for the given footprint and grid step
+cv::Size warpMapSize(const cv::Rect &roi, int grid);
+
+// Fill row with n pairs of source coordinates for pixels starting from
+// (x, y) of roi interpolated from the sparse map
+void interpolateMapRow(const warp_maps_t &maps, int y, int x, int n,
+    float *row);
+
+// The same for the whole row of roi
+void interpolateMapRow(const warp_maps_t &maps, int y, float *row);
+
+// Split roi into blocks whose working set fits into cacheSize bytes (L2 size
+// by default) and order them along Z-curve in the source image, so
+// consecutive blocks read neighbouring source pixels. Blocks without owned
+// pixels are dropped, so the owner map should be applied first. Pixels each
+// block composes are counted into tilePixels
+void planTiles(warp_maps_t &maps, const cv::Size &imageSize,
+    size_t cacheSize = 0);
+
+// Source image state for incremental composition of video
+struct frame_changes_t {
+  // Side of the square blocks of the source image compared between frames
+  int block = 32;
+  // Source as it was when each block was composed last time
+  cv::Mat reference;
+  // CV_8UC1 map of blocks changed in the last frame and its CV_32SC1
+  // integral image
+  cv::Mat changed;
+  cv::Mat integral;
+};
+
+// Find the part of the source image each tile of maps depends on
+void planTileSources(warp_maps_t &maps, const cv::Size &imageSize);
+
+// Mark blocks of the frame whose mean absolute difference from the
+// reference exceeds threshold and update the reference with them. The whole
+// first frame is changed. Returns the number of changed blocks
+int detectChanges(const cv::Mat &frame, frame_changes_t &changes,
+    double threshold);
+
+// Indices of tiles of maps which sample changed blocks
+void selectDirtyTiles(const warp_maps_t &maps, const frame_changes_t &changes,
+    std::vector<int> &dirty);
+
+// CV_8UC1 canvas-sized map with index of the camera each pixel is sampled
+// from: the one whose source pixel is the closest to its image center.
+// Overlapping cameras are not composed on top of each other with this map
+cv::Mat buildOwnerMap(const std::vector<warp_maps_t> &maps,
+    const std::vector<cv::Size> &imageSizes, const cv::Size &canvasSize);
+
+// Run-length encoding of the owner map for the stitch config: N x 2 CV_32SC1
+// matrix of (camera, length) pairs in raster order, camera is -1 for pixels
+// without owner
+cv::Mat encodeOwnerMap(const cv::Mat &owners);
+cv::Mat decodeOwnerMap(const cv::Mat &runs, const cv::Size &canvasSize);
+
+// Restrict maps of camera-th camera to the pixels it owns
+void applyOwnerMap(warp_maps_t &maps, const cv::Mat &owners, int camera);
+
+// Restrict maps to the given rows of the canvas, so a band of the canvas can
+// be composed independently of the others. Owner map is applied first
+void restrictToRows(warp_maps_t &maps, const cv::Range &rows);
+
+struct remap_source_t;
+
+// Row kernel instantiated for one pixel type. It is selected once, e.g. when
+// the rig is loaded, so composing a frame does not dispatch on the type
+struct remap_kernel_t {
+  // OpenCV type of the source and the canvas
+  int type = -1;
+  // The kernel actually used: SIMD kernels exist for 8UC1 (except SSE4.2),
+  // 8UC2 and 8UC3 pixels only, other types fall back to the scalar one
+  RemapKernel kernel = RemapKernel::Scalar;
+  void (*row)(const remap_source_t &src, const float *map, const float *gain,
+      uint8_t *dst, int n) = nullptr;
+};
+
+// Types remapTransparent is instantiated for: 8UC1, 8UC2, 8UC3, 8UC4 and
+// 16UC1
+bool isRemapTypeSupported(int type);
+
+// Auto kernel is the best one supported by the CPU
+remap_kernel_t selectRemapKernel(int type,
+    RemapKernel kernel = RemapKernel::Auto);
+
+// Bilinear remap of src into canvas of the same type according to maps. Each
+// channel is multiplied by the corresponding gain right after
+// interpolation, pixels which have no source are left untouched. Single
+// channel images get lumaGain of the gains, the alpha channel of 8UC4 is
+// not scaled
+void remapTransparent(const cv::Mat &src, const warp_maps_t &maps,
+    const cv::Vec3f &gain, cv::Mat &canvas, const remap_kernel_t &kernel);
+
+// The same selecting the kernel for the type of src on every call
+void remapTransparent(const cv::Mat &src, const warp_maps_t &maps,
+    const cv::Vec3f &gain, cv::Mat &canvas,
+    RemapKernel kernel = RemapKernel::Auto);
+
+// The same for the given tiles of maps only
+void remapTransparentTiles(const cv::Mat &src, const warp_maps_t &maps,
+    const std::vector<int> &tiles, const cv::Vec3f &gain, cv::Mat &canvas,
+    const remap_kernel_t &kernel);
+void remapTransparentTiles(const cv::Mat &src, const warp_maps_t &maps,
+    const std::vector<int> &tiles, const cv::Vec3f &gain, cv::Mat &canvas,
+    RemapKernel kernel = RemapKernel::Auto);
+
+// NV12 frame is a CV_8UC1 matrix of height * 3 / 2 rows: the luma plane
+// followed by the plane of interleaved U and V samples at half resolution.
+// Its width and height must be even
+
+// Views of the planes of the frame, chroma is CV_8UC2
+void splitNV12(const cv::Mat &nv12, cv::Mat &luma, cv::Mat &chroma);
+
+cv::Size nv12ImageSize(const cv::Mat &nv12);
+
+// Black NV12 canvas of the given size rounded up to even numbers
+cv::Mat createNV12Canvas(const cv::Size &size);
+
+void convertBGRToNV12(const cv::Mat &bgr, cv::Mat &nv12);
+void convertNV12ToBGR(const cv::Mat &nv12, cv::Mat &bgr);
+
+// Brightness gain corresponding to the per-channel BGR gains
+float lumaGain(const cv::Vec3f &gain);
+
+// Maps of the chroma plane derived from the maps of the luma plane of an
+// image of the given size. Chroma maps are dense, owner map and tiles are
+// applied to them as to any other maps
+void buildChromaMaps(const warp_maps_t &luma, const cv::Size &imageSize,
+    warp_maps_t &chroma);
+
+// Owner map of the chroma plane of the canvas
+cv::Mat halveOwnerMap(const cv::Mat &owners);
+
+// Remap both planes of NV12 src into NV12 canvas. gain applies to luma only
+void remapTransparentNV12(const cv::Mat &src, const warp_maps_t &luma,
+    const warp_maps_t &chroma, float gain, cv::Mat &canvas,
+    RemapKernel kernel = RemapKernel::Auto);
+
+// The same with kernels selected for 8UC1 luma and 8UC2 chroma planes
+void remapTransparentNV12(const cv::Mat &src, const warp_maps_t &luma,
+    const warp_maps_t &chroma, float gain, cv::Mat &canvas,
+    const remap_kernel_t &lumaKernel, const remap_kernel_t &chromaKernel);
+
+// Whether the kernel was compiled in and can run on this CPU
+bool isRemapKernelSupported(RemapKernel kernel);
+
+RemapKernel bestRemapKernel();
+
+const char *remapKernelName(RemapKernel kernel);
+
+// Estimate per-channel gains which equalize brightness of the images in the
+// areas where they overlap after warping with H
+std::vector<cv::Vec3f> estimateGains(const std::vector<cv::Mat> &images,
+    const std::vector<cv::Mat> &H, const cv::Size &canvasSize);
+
+#endif // __INCLUDE_COMPOSE_HPP__
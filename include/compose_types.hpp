@@ -0,0 +1,24 @@
+#ifndef __INCLUDE_COMPOSE_TYPES_HPP__
+#define __INCLUDE_COMPOSE_TYPES_HPP__
+
+// Settings of composition which are also command line options. They live
+// apart from opts.hpp, so the Compose library does not depend on the
+// options of the tools
+
+// Surface the canvas is mapped onto: the common plane of the homographies,
+// or a cylinder or a sphere around the first camera
+enum class Projection {
+  Plane,
+  Cylindrical,
+  Spherical
+};
+
+enum class RemapKernel {
+  Auto,
+  Scalar,
+  SSE42,
+  AVX2,
+  AVX512
+};
+
+#endif // __INCLUDE_COMPOSE_TYPES_HPP__
@@ -0,0 +1,142 @@
+
+#ifndef __INCLUDE_METRICS_HPP__
+#define __INCLUDE_METRICS_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Metrics are updated with relaxed atomic operations only: the frame loop
+// never takes a lock, and rendering them never stops it
+
+class Counter {
+ public:
+  void add(uint64_t value = 1) {
+    count.fetch_add(value, std::memory_order_relaxed);
+  }
+  uint64_t value() const { return count.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> count{0};
+};
+
+class Gauge {
+ public:
+  void set(double value);
+  double value() const;
+
+ private:
+  // bits of the double
+  std::atomic<uint64_t> bits{0};
+};
+
+// Histogram of durations in seconds. Buckets are upper bounds, the last
+// bucket counts everything above them
+class Histogram {
+ public:
+  explicit Histogram(const std::vector<double> &bounds);
+
+  void observe(double seconds);
+
+  const std::vector<double> &bounds() const { return upper; }
+  // Observations in each bucket, not cumulative
+  std::vector<uint64_t> counts() const;
+  double sum() const;
+  uint64_t count() const;
+
+ private:
+  std::vector<double> upper;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+  std::atomic<uint64_t> nanoseconds{0};
+};
+
+// Bounds from half a millisecond to a second
+std::vector<double> latencyBounds();
+
+// Label of a metric, e.g. camera="0"
+std::string metricLabel(const std::string &name, const std::string &value);
+
+// Metrics of a process rendered in Prometheus text format. Metrics are
+// registered before the frame loop starts and live as long as the registry
+class MetricsRegistry {
+ public:
+  MetricsRegistry();
+  ~MetricsRegistry();
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry &operator=(const MetricsRegistry&) = delete;
+
+  // Metrics of the same name differ in labels and share help
+  Counter &counter(const std::string &name, const std::string &help,
+      const std::string &labels = "");
+  Gauge &gauge(const std::string &name, const std::string &help,
+      const std::string &labels = "");
+  Histogram &histogram(const std::string &name, const std::string &help,
+      const std::string &labels = "",
+      const std::vector<double> &bounds = latencyBounds());
+
+  std::string render() const;
+
+ private:
+  struct family_t;
+  family_t &family(const std::string &name, const std::string &help,
+      const char *type);
+
+  mutable std::mutex lock;
+  std::vector<std::unique_ptr<family_t>> families;
+};
+
+// Serves the metrics over HTTP to every request on the port
+class MetricsServer {
+ public:
+  // Port 0 picks a free port
+  MetricsServer(const MetricsRegistry &registry, int port);
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer &operator=(const MetricsServer&) = delete;
+
+  bool isOpened() const { return listener >= 0; }
+  int port() const { return boundPort; }
+
+ private:
+  void serve();
+
+  const MetricsRegistry &registry;
+  int listener = -1;
+  int boundPort = 0;
+  std::atomic<bool> stopping{false};
+  std::thread server;
+};
+
+// Rewrites the file with the metrics every interval, e.g. for the textfile
+// collector of node exporter. Readers never see a partial file
+class MetricsFileWriter {
+ public:
+  MetricsFileWriter(const MetricsRegistry &registry, const std::string &path,
+      double intervalSeconds);
+  // The file is written once more on destruction
+  ~MetricsFileWriter();
+
+  MetricsFileWriter(const MetricsFileWriter&) = delete;
+  MetricsFileWriter &operator=(const MetricsFileWriter&) = delete;
+
+  bool write() const;
+
+ private:
+  void run();
+
+  const MetricsRegistry &registry;
+  std::string path;
+  double interval;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread writer;
+};
+
+#endif // __INCLUDE_METRICS_HPP__
@@ -2,6 +2,8 @@
 #ifndef __INCLUDE_OPTS_HPP__
 #define __INCLUDE_OPTS_HPP__
 
+#include "compose_types.hpp"
+
 #include <string>
 #include <vector>
 
@@ -10,6 +12,14 @@ enum class StitchingMode {
   ChainOfTargets
 };
 
+// How the video pipeline spends its cores: on the tiles of one frame at a
+// time for the lowest latency, or on several frames in flight at once for
+// the highest frame rate. Frames are output in order either way
+enum class Schedule {
+  Latency,
+  Throughput
+};
+
 struct command_line_opts {
   unsigned verbosity = 0;
   bool interactive = false;
@@ -24,8 +34,111 @@ struct command_line_opts {
 
   int angle = 1;
 
+  // Reject blurry, dark and board-less frames before searching for the board
+  bool prefilter = true;
+
+  // Score every scan_step-th frame of the recorded videos and pick frames for
+  // alignment without the operator, 0 asks the operator
+  int scan_step = 0;
+
+  // 1, 2, 4, 8 or 0 for automatic choice based on the canvas scale
+  int decode_reduction = 1;
+
+  bool gain_compensation = true;
+
+  // Sample every canvas pixel from a single camera chosen by the owner map
+  bool owner_map = true;
+
+  RemapKernel remap_kernel = RemapKernel::Auto;
+
+  // Distance between nodes of warp maps, 1 means dense maps
+  int map_grid = 1;
+
+  // Compose cache-sized blocks of the canvas instead of whole rows
+  bool blocked_traversal = true;
+
+  // Recompose only blocks of the canvas whose source changed by more than
+  // change_threshold levels on average since it was composed
+  bool incremental = false;
+  double change_threshold = 4;
+
+  // Compose NV12 frames plane by plane into NV12 canvas. Videos are asked
+  // for NV12 frames, packed frames are converted on input, which makes the
+  // mode useful for NV12 sources only. The canvas is converted for display
+  // only
+  bool planar = false;
+
+  // Seconds between searches for drift of the cameras in video mode,
+  // 0 disables them
+  double drift_interval = 0;
+
+  // Write frames the stitcher sees to a raw file, or stitch frames of a raw
+  // file headlessly instead of the videos of the config. Replay keeps the
+  // recorded pacing unless original_pace is false
+  std::string record_path;
+  std::string replay_path;
+  bool original_pace = true;
+
+  // CPUs the stages of the video pipeline run on, e.g. "0-7" or "node1",
+  // empty leaves the placement to the system. Buffers a stage consumes are
+  // first touched by it
+  std::string read_cpus;
+  std::string compose_cpus;
+  std::string encode_cpus;
+
+  Schedule schedule = Schedule::Latency;
+  // Frames composed at once in throughput schedule, 0 means one per CPU of
+  // the compose stage
+  int frames_in_flight = 0;
+
+  // Serve the stitched video as MJPEG over HTTP on the port, 0 disables it
+  int http_port = 0;
+  int jpeg_quality = 80;
+
+  // Export runtime metrics in Prometheus text format on the localhost port,
+  // and/or rewrite them to the file every metrics_interval seconds
+  int metrics_port = 0;
+  std::string metrics_path;
+  double metrics_interval = 5;
+
+  // Write wall time of the stages of calibrate or stitch of still images to
+  // the file, for comparison with a baseline
+  std::string timings_path;
+
+  // Compose bands of the canvas in shard_workers processes sharing frames
+  // and the canvas through shared memory, 0 composes in this process. A
+  // worker process composes shard_index-th band of shard_segment
+  int shard_workers = 0;
+  std::string shard_segment;
+  int shard_index = -1;
+
   StitchingMode mode = StitchingMode::ChainOfTargets;
 
+  // Projection calibrate fits the canvas to, stitch takes it from the config
+  Projection projection = Projection::Plane;
+
+  // Largest canvas calibrate produces in megapixels, 0 for no limit. With
+  // crop the canvas is cut to the largest rectangle covered by the cameras
+  double max_megapixels = 0;
+  bool crop = false;
+
+  // Synthetic rig synthesize renders into the directory of file_paths,
+  // see synthetic_rig_params_t. The ground truth goes to stitch_config.
+  // With truth_config synthesize scores stitch_config against it instead
+  int synthetic_cameras = 4;
+  int frame_width = 1280;
+  int frame_height = 720;
+  double fov = 70;
+  // k1, k2, p1, p2, k3
+  std::vector<double> distortion;
+  double camera_height = 1500;
+  double pitch = 45;
+  double arc = 60;
+  double pose_jitter = 0;
+  unsigned seed = 0;
+  int supersampling = 2;
+  std::string truth_config;
+
   std::string calibrate_config;
   std::string stitch_config = "stitch.conf.xml";
 };
@@ -0,0 +1,57 @@
+
+#ifndef __INCLUDE_PREFILTER_HPP__
+#define __INCLUDE_PREFILTER_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <atomic>
+#include <ostream>
+
+// Stages of the cascade, from the cheapest to the most expensive one
+enum class FilterStage {
+  Contrast,
+  Sharpness,
+  Checkerboard
+};
+
+const int kFilterStages = 3;
+
+const char *filterStageName(FilterStage stage);
+
+// Cheap checks which reject frames findChessboardCorners can not succeed on.
+// They run on a downsampled grayscale copy of the frame
+struct frame_filter_t {
+  frame_filter_t() { reset(); }
+
+  frame_filter_t(const frame_filter_t&) = delete;
+  frame_filter_t &operator=(const frame_filter_t&) = delete;
+
+  void reset();
+
+  // Frames wider than this are downsampled
+  int width = 640;
+  // Minimal standard deviation of brightness
+  double contrast = 12;
+  // Minimal variance of the Laplacian, blurry frames have little of it
+  double sharpness = 10;
+  // Minimal response of an X-junction of black and white squares and the
+  // fraction of inner corners of the board that must have such a response
+  double saddle_response = 24;
+  double saddle_fraction = 0.5;
+
+  // Counters are atomic since frames may be checked in parallel
+  std::atomic<long long> checked;
+  std::atomic<long long> rejected[kFilterStages];
+  // Frames that passed the cascade and how many of them had a board
+  std::atomic<long long> searched;
+  std::atomic<long long> detected;
+};
+
+// Run the cascade on the image, count the result and return false if the
+// image was rejected
+bool passesFrameFilter(const cv::Mat &image, const cv::Size &chessboardSize,
+    frame_filter_t &filter);
+
+void printFrameFilterStats(std::ostream &os, const frame_filter_t &filter);
+
+#endif // __INCLUDE_PREFILTER_HPP__
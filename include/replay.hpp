@@ -0,0 +1,72 @@
+
+#ifndef __INCLUDE_REPLAY_HPP__
+#define __INCLUDE_REPLAY_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Latencies of a stage of the frame loop in milliseconds
+class LatencyStats {
+ public:
+  void add(double ms) { samples.push_back(ms); }
+
+  size_t count() const { return samples.size(); }
+  double mean() const;
+  // p-th percentile, p is in [0, 100]
+  double percentile(double p) const;
+
+  // One line with the name, mean, median, 99th percentile and maximum
+  void print(std::ostream &os, const std::string &name) const;
+
+ private:
+  std::vector<double> samples;
+};
+
+// Wall time of named stages of a run of a tool in milliseconds, in the
+// order the stages were first timed. Stored as "stage milliseconds" lines, so
+// runs can be compared with a baseline
+class StageTimings {
+ public:
+  // Time of a stage timed several times adds up
+  void add(const std::string &stage, double ms);
+  // Time of the stage, negative if it was not timed
+  double get(const std::string &stage) const;
+  const std::vector<std::pair<std::string, double>> &stages() const {
+    return timed;
+  }
+
+  bool write(const std::string &path) const;
+  bool read(const std::string &path);
+
+ private:
+  std::vector<std::pair<std::string, double>> timed;
+};
+
+// Checksum of pixels of the image, rows padding does not change it
+uint64_t imageChecksum(const cv::Mat &image);
+
+// Fold the checksum of the next frame into the checksum of a sequence
+uint64_t combineChecksums(uint64_t sequence, uint64_t checksum);
+
+// Sleeps until frames are due according to their timestamps (microseconds)
+// relative to the first frame. Disabled pacer never sleeps
+class ReplayPacer {
+ public:
+  explicit ReplayPacer(bool enabled) : enabled(enabled) {}
+
+  void wait(int64_t timestamp);
+
+ private:
+  const bool enabled;
+  bool started = false;
+  int64_t first = 0;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif // __INCLUDE_REPLAY_HPP__
@@ -0,0 +1,116 @@
+
+#ifndef __INCLUDE_RIG_HPP__
+#define __INCLUDE_RIG_HPP__
+
+#include "compose.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Contents of the stitch config written by calibrate
+struct stitch_config_t {
+  bool video = false;
+  std::vector<std::string> file_paths;
+  cv::Size result_size;
+  // Plane unless calibrate fitted a curved canvas
+  projection_t projection;
+  std::vector<cv::Mat> H;
+  std::vector<cv::Mat> cameraMatrix;
+  std::vector<cv::Mat> distCoeffs;
+  // Optional fields: gains are (1, 1, 1), sizes are empty and owner map and
+  // board corners are empty if config does not have them
+  std::vector<cv::Vec3f> gains;
+  std::vector<cv::Size> image_sizes;
+  cv::Mat owners;
+  // Outer corners of the chessboard H was computed from, in coordinates of
+  // the undistorted image
+  std::vector<std::vector<cv::Point2f>> board_corners;
+};
+
+// Returns 0 on success, 2 if the file can not be opened, 3 if there are no
+// file paths and 4 if it is malformed
+int readStitchConfig(const std::string &path, stitch_config_t &config);
+
+bool writeStitchConfig(const std::string &path,
+    const stitch_config_t &config);
+
+// Everything needed to compose frames of the video rig. Rig is immutable once
+// built, so the frame loop can use it while the next one is being built
+struct rig_t {
+  stitch_config_t config;
+  std::vector<cv::Size> frame_sizes;
+  std::vector<warp_maps_t> maps;
+  // Maps of the chroma planes in planar mode
+  std::vector<warp_maps_t> chroma;
+  std::vector<cv::Vec3f> gains;
+  // Rows of the canvas the maps compose
+  cv::Range rows = cv::Range::all();
+};
+
+// Build maps for frames of the given sizes according to config and command
+// line options (map grid, owner map, gains, traversal, planar mode). Maps
+// of a band of the canvas compose only its rows
+std::shared_ptr<const rig_t> buildRig(const stitch_config_t &config,
+    const std::vector<cv::Size> &frameSizes,
+    const cv::Range &rows = cv::Range::all());
+
+// Find the chessboard in a (distorted) frame of camera-th camera and, if it
+// has moved by more than tolerance pixels from board_corners, correct H of
+// the camera in config by the homography between the two positions and
+// remember the new one. Returns false if nothing has changed
+bool estimateDrift(const cv::Mat &frame, size_t camera,
+    stitch_config_t &config, double tolerance = 1.0);
+
+// Builds new rigs in the background when the config file changes or, if
+// driftInterval is positive, when cameras drift from the calibrated
+// position, and swaps them in atomically. Old rigs are released when the
+// last frame using them is done. Configs with another number of cameras or
+// another canvas (size or projection) are not applied
+class RigUpdater {
+ public:
+  RigUpdater(const std::shared_ptr<const rig_t> &rig,
+      const std::string &configPath, double driftInterval);
+  ~RigUpdater();
+
+  RigUpdater(const RigUpdater&) = delete;
+  RigUpdater &operator=(const RigUpdater&) = delete;
+
+  // The latest rig. atomic_load of shared_ptr takes a lock in libstdc++,
+  // held only while the pointer is copied
+  std::shared_ptr<const rig_t> current() const;
+
+  // Hand the latest frames over to drift estimation if it is due and the
+  // updater is idle. Never blocks
+  void offerFrames(const std::vector<cv::Mat> &frames);
+
+ private:
+  void run();
+  void checkConfig();
+  void checkDrift(const std::vector<cv::Mat> &frames);
+  // Build and swap in the rig of config, false if building it failed and
+  // the current rig is kept
+  bool publish(const stitch_config_t &config);
+
+  std::shared_ptr<const rig_t> rig;
+  const std::string configPath;
+  const std::chrono::duration<double> driftInterval;
+
+  long long configStamp = 0;
+
+  std::chrono::steady_clock::time_point nextDriftCheck;
+  std::vector<cv::Mat> pendingFrames;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping = false;
+  std::thread worker;
+};
+
+#endif // __INCLUDE_RIG_HPP__
@@ -0,0 +1,41 @@
+
+#ifndef __INCLUDE_SCAN_HPP__
+#define __INCLUDE_SCAN_HPP__
+
+#include "prefilter.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <string>
+#include <vector>
+
+// Score given to frames where the chessboard was not found
+const float kNoBoard = -1.0f;
+
+// Angle of the chessboard to the horizon in the (distorted) frame or kNoBoard
+// if it was not found. With bothHalves the frame has to contain a board in
+// each half and the left one is scored, otherwise the whole frame is searched.
+// Areas rejected by the filter, if any, are not searched
+float scoreCalibrationFrame(const cv::Mat &frame, const cv::Mat &cameraMatrix,
+    const cv::Mat &distCoeffs, const cv::Size &chessboardSize,
+    bool bothHalves, frame_filter_t *filter = nullptr);
+
+// Score every step-th frame of each video. Videos are split into chunks which
+// are decoded and searched for chessboards in parallel. scores[i][k] is the
+// score of frame k * step of the i-th video
+std::vector<std::vector<float>> scanCalibrationVideos(
+    const std::vector<std::string> &paths,
+    const std::vector<cv::Mat> &cameraMatrix,
+    const std::vector<cv::Mat> &distCoeffs, const cv::Size &chessboardSize,
+    bool bothHalves, int step, frame_filter_t *filter = nullptr);
+
+// Index into scores of the synchronized set of frames where every camera
+// sees its boards and the worst angle is the smallest, -1 if there is none
+int chooseCalibrationFrame(const std::vector<std::vector<float>> &scores,
+    float &angle);
+
+// Read a copy of index-th frame of the video, false if there is no such
+// frame
+bool readVideoFrame(const std::string &path, int index, cv::Mat &frame);
+
+#endif // __INCLUDE_SCAN_HPP__
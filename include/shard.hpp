@@ -0,0 +1,138 @@
+
+#ifndef __INCLUDE_SHARD_HPP__
+#define __INCLUDE_SHARD_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <semaphore.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// POSIX shared memory segment through which a coordinator process hands
+// frames of all cameras to worker processes, each of them composing a band
+// of rows of the shared canvas. The segment starts with shard_header_t
+// followed by the frames and the canvas, every matrix is aligned to
+// kShardAlignment bytes and its rows are not padded
+const char kShardMagic[8] = {'R', 'I', 'G', 'S', 'H', 'A', 'R', 'D'};
+const size_t kShardAlignment = 64;
+const size_t kMaxShardCameras = 32;
+const size_t kMaxShardWorkers = 64;
+
+struct shard_matrix_t {
+  int32_t width;
+  int32_t height;
+  // OpenCV type of the matrix, e.g. CV_8UC3
+  int32_t type;
+  uint32_t reserved;
+  // Offset of the matrix from the start of the segment
+  uint64_t offset;
+};
+
+// Frame barrier. Semaphores are process-shared, waiting on them sleeps on
+// a futex: the coordinator posts start of every worker once the frames are
+// in place, a worker posts done when its band is composed
+struct shard_header_t {
+  char magic[8];
+  uint32_t cameras;
+  uint32_t workers;
+  uint64_t size;
+  shard_matrix_t frames[kMaxShardCameras];
+  shard_matrix_t canvas;
+  // Number of the frame in the segment and of the last frame each of the
+  // workers composed, numbers start from 1
+  std::atomic<uint64_t> frame;
+  std::atomic<uint64_t> composed[kMaxShardWorkers];
+  std::atomic<uint32_t> stopping;
+  sem_t start[kMaxShardWorkers];
+  sem_t done;
+};
+
+class ShardSegment {
+ public:
+  // Create the segment, it is removed when its creator is destroyed
+  ShardSegment(const std::string &name, const std::vector<cv::Size> &sizes,
+      const std::vector<int> &types, const cv::Size &canvasSize,
+      int canvasType, int workers);
+  // Attach to the segment created by another process
+  explicit ShardSegment(const std::string &name);
+  ~ShardSegment();
+
+  ShardSegment(const ShardSegment&) = delete;
+  ShardSegment &operator=(const ShardSegment&) = delete;
+
+  bool isOpened() const { return header != nullptr; }
+  const std::string &name() const { return segmentName; }
+
+  size_t cameras() const { return header->cameras; }
+  int workers() const { return (int)header->workers; }
+
+  // Views of the shared matrices, valid while the segment is open
+  cv::Mat frame(size_t camera) const;
+  cv::Mat canvas() const;
+  // Rows of the canvas the worker composes, bands split the canvas evenly
+  cv::Range band(int worker) const;
+
+  uint64_t frameNumber() const { return header->frame.load(); }
+  bool composed(int worker) const;
+
+  // Coordinator side. Frames in the segment become the next frame and every
+  // worker is woken to compose it
+  void startFrame();
+  // Wake the worker for the current frame unless it is woken already, e.g.
+  // when it replaces a crashed one
+  void wake(int worker);
+  // Wait until some worker finishes or the timeout expires, false on timeout
+  bool waitDone(int milliseconds);
+  // Ask the workers to exit instead of waiting for the next frame
+  void stop();
+
+  // Worker side. Wait for the next frame, false when workers should exit
+  bool nextFrame(int worker);
+  // The band of the current frame is composed
+  void frameDone(int worker);
+
+ private:
+  std::string segmentName;
+  shard_header_t *header = nullptr;
+  size_t length = 0;
+  bool owner = false;
+};
+
+// Worker processes of a segment. Every worker runs this executable again
+// with the given arguments followed by --shard-worker=<segment>:<index>
+class ShardWorkers {
+ public:
+  ShardWorkers(ShardSegment &segment, const std::vector<std::string> &args,
+      int maxRestarts = 3);
+  ~ShardWorkers();
+
+  ShardWorkers(const ShardWorkers&) = delete;
+  ShardWorkers &operator=(const ShardWorkers&) = delete;
+
+  // All workers were started
+  bool isRunning() const;
+
+  // Compose the frames in the segment and wait for all bands. A worker which
+  // died is restarted and composes its band again, false when the workers
+  // died more than maxRestarts times in total
+  bool compose();
+
+  int restarts() const { return restartCount; }
+
+ private:
+  bool spawn(int worker);
+  // Restart dead workers, false when the restart limit is reached
+  bool restartDead();
+
+  ShardSegment &segment;
+  std::vector<std::string> args;
+  std::vector<pid_t> pids;
+  int maxRestarts;
+  int restartCount = 0;
+};
+
+#endif // __INCLUDE_SHARD_HPP__
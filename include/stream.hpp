@@ -0,0 +1,89 @@
+
+#ifndef __INCLUDE_STREAM_HPP__
+#define __INCLUDE_STREAM_HPP__
+
+#include "topology.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Encode the image as a baseline JPEG. Horizontal strips of the image are
+// encoded in parallel and spliced into one image with restart markers
+// between them, so it decodes as if it was encoded at once. Strips are
+// encoded on the pool if there is one, on OpenCV's pool otherwise. 0 strips
+// means one per thread
+bool encodeJpegStrips(const cv::Mat &image, int quality,
+    std::vector<uchar> &jpeg, int strips = 0, WorkerPool *pool = nullptr);
+
+// Join baseline JPEGs of consecutive strips of an image into a single JPEG
+// with the restart interval of a strip. Strips must be encoded with the same
+// tables and without restart markers, all but the last one must be equally
+// high and a multiple of MCU high. False if they are not
+bool spliceJpegStrips(const std::vector<std::vector<uchar>> &strips,
+    std::vector<uchar> &jpeg);
+
+// Motion JPEG stream served over HTTP as multipart/x-mixed-replace to every
+// client connecting to the port. Published frames are encoded by a
+// background thread, every client is sent the same encoded frame. A frame
+// published before the previous one is encoded replaces it, and a client
+// still sending the previous frame skips the next one: slow encoding or
+// slow clients drop frames instead of stalling the caller. Encoding runs on
+// threads of its own restricted to the CPUs, the ones of OpenCV's pool are
+// left to the caller
+class MjpegServer {
+ public:
+  // Port 0 picks a free port. An empty set of CPUs leaves the encoder on
+  // any CPU with a thread per CPU
+  explicit MjpegServer(int port, int quality = 80,
+      const std::vector<int> &cpus = std::vector<int>());
+  ~MjpegServer();
+
+  MjpegServer(const MjpegServer&) = delete;
+  MjpegServer &operator=(const MjpegServer&) = delete;
+
+  bool isOpened() const { return listener >= 0; }
+  int port() const { return boundPort; }
+
+  // The frame is copied, the caller may reuse it right away. Frames
+  // published while no client is connected are ignored
+  void publish(const cv::Mat &frame);
+
+  size_t clients() const;
+  uint64_t encoded() const { return encodedCount.load(); }
+  // Frames replaced before they were encoded or sent to a client
+  uint64_t dropped() const { return droppedCount.load(); }
+
+ private:
+  struct client_t;
+
+  void acceptClients();
+  void encodeFrames();
+  static void serveClient(std::shared_ptr<client_t> client);
+
+  int listener = -1;
+  int boundPort = 0;
+  int quality;
+  std::vector<int> cpus;
+  std::unique_ptr<WorkerPool> strips;
+
+  mutable std::mutex lock;
+  std::condition_variable published;
+  cv::Mat next;
+  bool pending = false;
+  bool stopping = false;
+  std::vector<std::shared_ptr<client_t>> connected;
+
+  std::atomic<uint64_t> encodedCount;
+  std::atomic<uint64_t> droppedCount;
+  std::thread acceptor;
+  std::thread encoder;
+};
+
+#endif // __INCLUDE_STREAM_HPP__
@@ -0,0 +1,83 @@
+
+#ifndef __INCLUDE_SYNTHETIC_HPP__
+#define __INCLUDE_SYNTHETIC_HPP__
+
+#include "opts.hpp"
+#include "rig.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <string>
+#include <vector>
+
+// Synthetic rigs look at a floor plane z = 0 with chessboards on it. World
+// coordinates are in millimeters, y points away from the rig, z up
+
+struct synthetic_camera_t {
+  cv::Size size;
+  cv::Mat cameraMatrix;
+  // k1, k2, p1, p2, k3
+  cv::Mat distCoeffs;
+  cv::Vec3d position;
+  // Degrees: yaw turns the camera left around z, pitch tilts it down to the
+  // floor, roll turns it around its optical axis
+  double yaw = 0;
+  double pitch = 0;
+  double roll = 0;
+};
+
+struct synthetic_board_t {
+  // Inner corners, as --board
+  cv::Size size;
+  cv::Point2d center;
+  double square = 0;
+};
+
+struct synthetic_rig_t {
+  std::vector<synthetic_camera_t> cameras;
+  std::vector<synthetic_board_t> boards;
+};
+
+struct synthetic_rig_params_t {
+  int cameras = 4;
+  cv::Size frameSize = cv::Size(1280, 720);
+  // Horizontal field of view in degrees
+  double fov = 70;
+  std::vector<double> distortion;
+  double height = 1500;
+  double pitch = 45;
+  cv::Size board = cv::Size(5, 3);
+  // Cameras of a chain stand in a row, the i-th one sees boards i and i + 1
+  // in the left and the right half of its view. Cameras around a common
+  // target stand on an arc of arc degrees and all see the same board
+  StitchingMode mode = StitchingMode::ChainOfTargets;
+  double arc = 60;
+  // Angles of poses are off by up to jitter degrees
+  double jitter = 0;
+  unsigned seed = 0;
+};
+
+synthetic_rig_t makeSyntheticRig(const synthetic_rig_params_t &params);
+
+// Homography from undistorted pixels of the camera to the floor
+cv::Mat floorHomography(const synthetic_camera_t &camera);
+
+// Distorted view of the camera. Every pixel averages supersampling^2 rays
+cv::Mat renderView(const synthetic_rig_t &rig, size_t camera,
+    int supersampling = 2);
+
+// Ground truth of the rig as calibrate would write it for images at the
+// paths: H maps undistorted images to a top-down canvas of the floor which
+// has the resolution of the first camera, within maxMegapixels if positive
+stitch_config_t syntheticConfig(const synthetic_rig_t &rig,
+    const std::vector<std::string> &paths, double maxMegapixels = 0);
+
+// Largest distance in pixels of the estimated canvas between points of
+// each camera placed by the estimated H and by the ground truth. Canvases
+// are related through the first camera, so its error is 0. Points outside
+// the ground truth canvas are not counted. Empty if the configs differ in
+// cameras
+std::vector<double> alignmentErrors(const stitch_config_t &estimated,
+    const stitch_config_t &truth);
+
+#endif // __INCLUDE_SYNTHETIC_HPP__
@@ -0,0 +1,122 @@
+
+#ifndef __INCLUDE_TOPOLOGY_HPP__
+#define __INCLUDE_TOPOLOGY_HPP__
+
+#include "opencv2/core/core.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct numa_node_t {
+  int id;
+  std::vector<int> cpus;
+};
+
+// NUMA nodes of the machine. Without NUMA information in sysfs the machine
+// is a single node with all CPUs
+std::vector<numa_node_t> numaNodes();
+
+// CPUs of a set given as a list like "0-3,8,10-11" where "node1" stands for
+// all CPUs of the node. Sorted and unique, empty on a syntax error or an
+// unknown node
+std::vector<int> parseCpuSet(const std::string &spec);
+std::string formatCpuSet(const std::vector<int> &cpus);
+
+// "cpus 0-7 on node 0", "any cpu" for an empty set
+std::string describeCpuSet(const std::vector<int> &cpus);
+
+// CPUs the calling thread may run on
+std::vector<int> currentThreadCpus();
+
+// Restrict the calling thread to the CPUs, nothing happens for an empty set.
+// Threads the thread starts afterwards inherit the restriction
+bool pinCurrentThread(const std::vector<int> &cpus);
+
+// Restrict the calling thread and the threads of OpenCV's pool, so stages
+// running through parallel_for_ stay on the CPUs. A pool thread is pinned
+// only when it runs one of the iterations handed out, so the result is the
+// number of distinct threads pinned, calling thread included. Less than
+// getNumThreads() means the rest may run anywhere. 0 for an empty set
+int pinParallelThreads(const std::vector<int> &cpus);
+
+// Matrix zeroed by OpenCV's pool. First touch spreads its pages over the
+// nodes of the CPUs the pool runs on, which keeps the buffer off other
+// stages' nodes. Rows are not matched with the threads that later process
+// them, parallel_for_ gives no such affinity
+cv::Mat allocateFirstTouch(const cv::Size &size, int type);
+
+// Long-lived threads restricted to the CPUs, for stages which must not
+// share OpenCV's pool with the others. Jobs are taken by the first free
+// thread in the order they were submitted
+class WorkerPool {
+ public:
+  // An empty set leaves the threads on any CPU
+  WorkerPool(size_t threads, const std::vector<int> &cpus);
+  // Jobs submitted so far are finished first
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool &operator=(const WorkerPool&) = delete;
+
+  size_t size() const { return threads.size(); }
+
+  // The future rethrows what the job threw
+  std::future<void> submit(std::function<void()> job);
+
+  // Run body(i) for i in [0, count) on the threads of the pool and wait for
+  // all of them. Must not be called from a thread of the same pool
+  void parallelFor(int count, const std::function<void(int)> &body);
+
+ private:
+  void run();
+
+  std::vector<int> cpus;
+  std::mutex lock;
+  std::condition_variable queued;
+  std::deque<std::packaged_task<void()>> jobs;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+// Frames composed in parallel and output in order: every slot has a thread
+// of its own, frames go to the slots in turn and a slot takes the next
+// frame once its previous one is finished
+class InFlightSlots {
+ public:
+  InFlightSlots(size_t slots, const std::vector<int> &cpus);
+
+  size_t size() const { return workers.size(); }
+  // Frames submitted and not finished yet
+  size_t pending() const { return submitted - finished; }
+  // The slot of the next frame still holds one that is not finished
+  bool full() const { return pending() >= size(); }
+  // Slot the next frame goes to
+  size_t next() const { return submitted % size(); }
+
+  // Run the job on the thread of the next slot, which must not be full
+  void submit(std::function<void()> job);
+  // Wait for the oldest frame not finished yet and return its slot. What
+  // the job threw is rethrown
+  size_t finishOldest();
+
+ private:
+  std::vector<std::unique_ptr<WorkerPool>> workers;
+  std::vector<std::future<void>> jobs;
+  size_t submitted = 0;
+  size_t finished = 0;
+};
+
+// Number of pages of the buffer on each of the nodes, pages are sampled.
+// Empty if the kernel can not tell
+std::map<int, size_t> pageNodes(const void *data, size_t size);
+std::string describePageNodes(const std::map<int, size_t> &nodes);
+
+#endif // __INCLUDE_TOPOLOGY_HPP__
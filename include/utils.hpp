@@ -2,6 +2,8 @@
 #ifndef __INCLUDE_UTILS_HPP__
 #define __INCLUDE_UTILS_HPP__
 
+#include "prefilter.hpp"
+
 #include "opencv2/core/core.hpp"
 
 #include <vector>
@@ -10,6 +12,32 @@
 void displayResult(
     const std::string &windowName, const cv::Mat &result, bool wait = false);
 
+// Corners found by findChessboardCorners seen as a by-row 2d array which
+// starts at the top left corner of the board. The view does not copy the
+// points: it refers to the detection buffer, which must outlive it
+struct chessboard_view_t {
+  const cv::Point2f *points = nullptr;
+  int rows = 0;
+  int cols = 0;
+  // The board was found rotated by 90 degrees
+  bool transposed = false;
+
+  // Corner in y-th row and x-th column is points[origin + y * rowStep +
+  // x * colStep]
+  int origin = 0;
+  int rowStep = 0;
+  int colStep = 0;
+
+  const cv::Point2f &at(int y, int x) const {
+    return points[origin + y * rowStep + x * colStep];
+  }
+};
+
+chessboard_view_t viewChessboardCorners(
+    const std::vector<cv::Point2f> &chessboardCorners,
+    const cv::Size &boardSize);
+
+// Copy of the ordered corners, prefer viewChessboardCorners
 std::vector<std::vector<cv::Point2f>> orderChessboardCorners(
     const std::vector<cv::Point2f> &chessboardCorners,
     const cv::Size &boardSize);
@@ -17,6 +45,9 @@ std::vector<std::vector<cv::Point2f>> orderChessboardCorners(
 std::vector<cv::Point2f> extractCorners(
     const std::vector<std::vector<cv::Point2f>> &points);
 
+// Four outer corners: bottom left, bottom right, top right, top left
+std::vector<cv::Point2f> extractCorners(const chessboard_view_t &view);
+
 std::vector<cv::Point2f> extractCorners(const cv::Mat &image);
 
 std::vector<cv::Point2f> extractCorners(const cv::Size &size);
@@ -44,9 +75,13 @@ struct corners_info_t {
 float angleToHorizon(const std::vector<cv::Point2f> &chessboardCorners,
     const cv::Size &chessboardSize);
 
+float angleToHorizon(const chessboard_view_t &view);
+
+// Frames rejected by the filter, if any, are not searched
 bool findChessboardCorners(const cv::Mat &image,
     const cv::Size &chessboardSize,
-    std::vector<cv::Point2f> &chessboardCorners);
+    std::vector<cv::Point2f> &chessboardCorners,
+    frame_filter_t *filter = nullptr);
 
 bool projectToTheFloor(const cv::Mat &image, const cv::Size &chessboardSize,
     cv::Mat &result, std::vector<cv::Point2f> &chessboardCornersOrig,
@@ -57,4 +92,15 @@ void computeHomography(const std::vector<cv::Point2f> &from,
     const std::vector<cv::Point2f> &to, const cv::Size &size_from,
     cv::Mat &H, cv::Size &shift, std::vector<cv::Point2f> &imageCorners);
 
+// Largest factor (1, 2, 4 or 8) by which an image of the given size could be
+// downscaled before warping with H without losing canvas resolution
+int chooseDecodeReduction(const cv::Mat &H, const cv::Size &imageSize);
+
+// Adjust homography computed for full-resolution image to be applied to
+// an image decoded with 1/reduction resolution
+cv::Mat scaleHomography(const cv::Mat &H, int reduction);
+
+// Decode image at 1/reduction resolution (reduction is 1, 2, 4 or 8)
+cv::Mat readImage(const std::string &path, int reduction = 1);
+
 #endif // __INCLUDE_UTILS_HPP__
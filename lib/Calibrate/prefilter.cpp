@@ -0,0 +1,126 @@
+#include "prefilter.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+namespace {
+
+// Distances from a pixel to the centers of squares which are compared to
+// find X-junctions of the board. The short one is compared without blurring
+// and keeps boards whose squares are 2-3 pixels of the downsampled copy,
+// e.g. distant boards in 1080p frames
+const int kSmallSaddleOffset = 1;
+const int kSaddleOffset = 2;
+
+// Keep the larger of response and the response of X-junctions centered at
+// every pixel of the image whose squares are offset pixels away along both
+// axes. Pixels closer than offset to the border are left as they are
+void accumulateSaddleResponse(const cv::Mat &image, int offset,
+    cv::Mat &response) {
+  const int d = 2 * offset;
+  cv::Size size(image.cols - d, image.rows - d);
+  cv::Mat a = image(cv::Rect(cv::Point(0, 0), size));
+  cv::Mat b = image(cv::Rect(cv::Point(d, 0), size));
+  cv::Mat c = image(cv::Rect(cv::Point(0, d), size));
+  cv::Mat e = image(cv::Rect(cv::Point(d, d), size));
+  cv::Mat current = cv::abs(a + e - b - c) * 0.5 - cv::abs(a - e) -
+      cv::abs(b - c);
+  cv::Mat centers = response(cv::Rect(cv::Point(offset, offset), size));
+  cv::max(centers, current, centers);
+}
+
+// Stage which rejects the grayscale image or -1 if it passes all of them
+int rejectingStage(const cv::Mat &gray, const cv::Size &chessboardSize,
+    const frame_filter_t &filter) {
+  cv::Scalar mean;
+  cv::Scalar dev;
+  cv::meanStdDev(gray, mean, dev);
+  if (dev[0] < filter.contrast) {
+    return (int)FilterStage::Contrast;
+  }
+
+  cv::Mat laplacian;
+  cv::Laplacian(gray, laplacian, CV_16S);
+  cv::meanStdDev(laplacian, mean, dev);
+  if (dev[0] * dev[0] < filter.sharpness) {
+    return (int)FilterStage::Sharpness;
+  }
+
+  // At an X-junction the diagonal neighbours are of the same color and the
+  // other two are of the opposite one. Differences along the diagonals are
+  // subtracted, so edges and corners of other objects have no response
+  const int d = 2 * kSaddleOffset;
+  if (gray.cols <= d || gray.rows <= d) {
+    return (int)FilterStage::Checkerboard;
+  }
+  cv::Mat plain;
+  gray.convertTo(plain, CV_32F);
+  cv::Mat blurred;
+  cv::boxFilter(gray, blurred, CV_32F, cv::Size(3, 3));
+  cv::Mat response = cv::Mat::zeros(gray.size(), CV_32F);
+  accumulateSaddleResponse(plain, kSmallSaddleOffset, response);
+  accumulateSaddleResponse(blurred, kSaddleOffset, response);
+
+  cv::Mat maxima;
+  cv::dilate(response, maxima, cv::Mat());
+  cv::Mat saddles = (response >= maxima) &
+      (response > filter.saddle_response);
+  // the board size is given in inner corners
+  if (cv::countNonZero(saddles) <
+      filter.saddle_fraction * chessboardSize.area()) {
+    return (int)FilterStage::Checkerboard;
+  }
+  return -1;
+}
+
+}
+
+void frame_filter_t::reset() {
+  checked = 0;
+  for (int stage = 0; stage < kFilterStages; ++stage) {
+    rejected[stage] = 0;
+  }
+  searched = 0;
+  detected = 0;
+}
+
+const char *filterStageName(FilterStage stage) {
+  switch (stage) {
+    case FilterStage::Contrast: return "contrast";
+    case FilterStage::Sharpness: return "sharpness";
+    case FilterStage::Checkerboard: return "checkerboard";
+  }
+  return "unknown";
+}
+
+bool passesFrameFilter(const cv::Mat &image, const cv::Size &chessboardSize,
+    frame_filter_t &filter) {
+  ++filter.checked;
+
+  cv::Mat small = image;
+  if (image.cols > filter.width) {
+    double scale = (double)filter.width / image.cols;
+    cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_AREA);
+  }
+  cv::Mat gray = small;
+  if (small.channels() == 3) {
+    cv::cvtColor(small, gray, CV_BGR2GRAY);
+  }
+
+  int stage = rejectingStage(gray, chessboardSize, filter);
+  if (stage >= 0) {
+    ++filter.rejected[stage];
+    return false;
+  }
+  ++filter.searched;
+  return true;
+}
+
+void printFrameFilterStats(std::ostream &os, const frame_filter_t &filter) {
+  os << "Prefilter: " << filter.checked.load() << " frames checked";
+  for (int stage = 0; stage < kFilterStages; ++stage) {
+    os << ", " << filter.rejected[stage].load() << " rejected by "
+        << filterStageName((FilterStage)stage);
+  }
+  os << ", " << filter.searched.load() << " searched, "
+      << filter.detected.load() << " with the board" << std::endl;
+}
@@ -0,0 +1,186 @@
+#include "scan.hpp"
+#include "capture.hpp"
+#include "utils.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// Chunks shorter than this many scored frames are not worth a separate seek
+const int kMinChunkFrames = 16;
+
+// Frames [begin, end) of a video, begin is a multiple of step
+struct scan_chunk_t {
+  size_t camera;
+  int begin;
+  int end;
+};
+
+class ScanBody : public cv::ParallelLoopBody {
+ public:
+  ScanBody(const std::vector<std::string> &paths,
+      const std::vector<cv::Mat> &cameraMatrix,
+      const std::vector<cv::Mat> &distCoeffs, const cv::Size &chessboardSize,
+      bool bothHalves, int step, frame_filter_t *filter,
+      const std::vector<scan_chunk_t> &chunks,
+      std::vector<std::vector<float>> &scores)
+      : paths(paths), cameraMatrix(cameraMatrix), distCoeffs(distCoeffs),
+      chessboardSize(chessboardSize), bothHalves(bothHalves), step(step),
+      filter(filter), chunks(chunks), scores(scores) {}
+
+  void operator()(const cv::Range &range) const override {
+    for (int c = range.start; c < range.end; ++c) {
+      scan(chunks[c], scores[c]);
+    }
+  }
+
+ private:
+  void scan(const scan_chunk_t &chunk, std::vector<float> &result) const {
+    // captures are not thread safe, so every chunk opens its own
+    FrameSource capture(paths[chunk.camera]);
+    cv::Mat frame;
+    if (capture.isOpened() && capture.seek(chunk.begin)) {
+      for (int index = chunk.begin; index < chunk.end; ++index) {
+        // skipped frames are decoded only as far as the codec requires
+        if ((index - chunk.begin) % step != 0) {
+          if (!capture.grab()) {
+            break;
+          }
+          continue;
+        }
+        if (!capture.read(frame)) {
+          break;
+        }
+        result.push_back(scoreCalibrationFrame(frame,
+            cameraMatrix[chunk.camera], distCoeffs[chunk.camera],
+            chessboardSize, bothHalves, filter));
+      }
+    }
+
+    // frames the capture failed to deliver keep scores of the next chunks
+    // in place
+    if (chunk.end != INT_MAX) {
+      result.resize((chunk.end - chunk.begin + step - 1) / step, kNoBoard);
+    }
+  }
+
+  const std::vector<std::string> &paths;
+  const std::vector<cv::Mat> &cameraMatrix;
+  const std::vector<cv::Mat> &distCoeffs;
+  const cv::Size chessboardSize;
+  const bool bothHalves;
+  const int step;
+  frame_filter_t *filter;
+  const std::vector<scan_chunk_t> &chunks;
+  std::vector<std::vector<float>> &scores;
+};
+
+}
+
+float scoreCalibrationFrame(const cv::Mat &frame, const cv::Mat &cameraMatrix,
+    const cv::Mat &distCoeffs, const cv::Size &chessboardSize,
+    bool bothHalves, frame_filter_t *filter) {
+  cv::Rect leftHalfRect(0, 0, frame.cols / 2, frame.rows);
+  cv::Rect rightHalfRect(frame.cols / 2, 0, frame.cols / 2, frame.rows);
+  cv::Mat leftHalf = bothHalves ? frame(leftHalfRect) : frame;
+
+  std::vector<cv::Point2f> left;
+  std::vector<cv::Point2f> right;
+  if (!findChessboardCorners(leftHalf, chessboardSize, left, filter)) {
+    return kNoBoard;
+  }
+  if (bothHalves && !findChessboardCorners(frame(rightHalfRect),
+      chessboardSize, right, filter)) {
+    return kNoBoard;
+  }
+
+  // Only the corners are undistorted, which is much cheaper than the frame
+  if (!cameraMatrix.empty() && !distCoeffs.empty()) {
+    std::vector<cv::Point2f> undistorted;
+    cv::undistortPoints(left, undistorted, cameraMatrix, distCoeffs,
+        cv::noArray(), cameraMatrix);
+    left = undistorted;
+  }
+  return angleToHorizon(left, chessboardSize);
+}
+
+std::vector<std::vector<float>> scanCalibrationVideos(
+    const std::vector<std::string> &paths,
+    const std::vector<cv::Mat> &cameraMatrix,
+    const std::vector<cv::Mat> &distCoeffs, const cv::Size &chessboardSize,
+    bool bothHalves, int step, frame_filter_t *filter) {
+  CV_Assert(step > 0);
+  CV_Assert(cameraMatrix.size() == paths.size());
+  CV_Assert(distCoeffs.size() == paths.size());
+
+  std::vector<scan_chunk_t> chunks;
+  const int threads = std::max(1, cv::getNumberOfCPUs());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    FrameSource capture(paths[i]);
+    int count = capture.count();
+    if (count <= 0) {
+      // length is unknown, the video is read to the end in one go
+      chunks.push_back({i, 0, INT_MAX});
+      continue;
+    }
+
+    int samples = (count + step - 1) / step;
+    int perChunk = std::max(kMinChunkFrames, (samples + threads - 1) / threads);
+    for (int begin = 0; begin < count; begin += perChunk * step) {
+      chunks.push_back({i, begin, std::min(count, begin + perChunk * step)});
+    }
+  }
+
+  std::vector<std::vector<float>> chunkScores(chunks.size());
+  cv::parallel_for_(cv::Range(0, (int)chunks.size()),
+      ScanBody(paths, cameraMatrix, distCoeffs, chessboardSize, bothHalves,
+          step, filter, chunks, chunkScores));
+
+  std::vector<std::vector<float>> scores(paths.size());
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    std::vector<float> &result = scores[chunks[c].camera];
+    result.insert(result.end(), chunkScores[c].begin(), chunkScores[c].end());
+  }
+  return scores;
+}
+
+int chooseCalibrationFrame(const std::vector<std::vector<float>> &scores,
+    float &angle) {
+  if (scores.empty()) {
+    return -1;
+  }
+  size_t n = scores[0].size();
+  for (size_t i = 1; i < scores.size(); ++i) {
+    n = std::min(n, scores[i].size());
+  }
+
+  int best = -1;
+  for (size_t k = 0; k < n; ++k) {
+    // the set is as good as its worst frame
+    float worst = 0;
+    for (size_t i = 0; i < scores.size() && worst != kNoBoard; ++i) {
+      worst = (scores[i][k] == kNoBoard)
+          ? kNoBoard : std::max(worst, scores[i][k]);
+    }
+    if (worst != kNoBoard && (best < 0 || worst < angle)) {
+      best = (int)k;
+      angle = worst;
+    }
+  }
+  return best;
+}
+
+bool readVideoFrame(const std::string &path, int index, cv::Mat &frame) {
+  // frames of raw files are views which do not outlive the source
+  FrameSource capture(path);
+  cv::Mat view;
+  if (!capture.isOpened() || !capture.seek(index) || !capture.read(view)) {
+    return false;
+  }
+  view.copyTo(frame);
+  return true;
+}
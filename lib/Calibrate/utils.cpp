@@ -33,48 +33,6 @@ const cv::Size calculateSizeForDisplaying(const cv::Size &originalSize,
       (int)round(originalSize.height / ratio));
 }
 
-std::vector<std::vector<cv::Point2f>> transpose(
-    const std::vector<std::vector<cv::Point2f>> &src) {
-  std::vector<std::vector<cv::Point2f>> result(src.front().size());
-  for (size_t i = 0; i < result.size(); ++i) {
-    for (size_t j = 0; j < src.size(); ++j) {
-      result[i].push_back(src[j][i]);
-    }
-  }
-
-  return result;
-}
-
-std::vector<std::vector<cv::Point2f>> interpretAsByColumn2dArray(
-    const std::vector<cv::Point2f> &src, const cv::Size &size) {
-  std::vector<std::vector<cv::Point2f>> result(size.height);
-  assert(src.size() == size.height * size.width && "Invalid input");
-  size_t index = 0;
-  for (int i = 0; i < size.width; ++i) {
-    for (size_t j = 0; j < result.size(); ++j) {
-      result[j].push_back(src[index]);
-      ++index;
-    }
-  }
-
-  return result;
-}
-
-std::vector<std::vector<cv::Point2f>> interpretAsByRow2dArray(
-    const std::vector<cv::Point2f> &src, const cv::Size &size) {
-  std::vector<std::vector<cv::Point2f>> result(size.height);
-  assert(src.size() == size.height * size.width && "Invalid input");
-  size_t index = 0;
-  for (size_t i = 0; i < result.size(); ++i) {
-    for (int j = 0; j < size.width; ++j) {
-      result[i].push_back(src[index]);
-      ++index;
-    }
-  }
-
-  return result;
-}
-
 enum class Component : size_t {
   X = 0, Y = 1
 };
@@ -145,28 +103,27 @@ void getPointsOrientation(const std::vector<cv::Point2f> &p,
 
 }
 
-std::vector<std::vector<cv::Point2f>> orderChessboardCorners(
+chessboard_view_t viewChessboardCorners(
     const std::vector<cv::Point2f> &chessboardCorners,
     const cv::Size &boardSize) {
   bool isByRow = false;
   bool isTransposed = false;
   getPointsOrientation(chessboardCorners, boardSize, isByRow, isTransposed);
 
-  std::vector<std::vector<cv::Point2f>> result;
+  // Points are laid out as a 2d array of tSize either by rows or by columns
   cv::Size tSize = isTransposed ? cv::Size(boardSize.height, boardSize.width)
       : boardSize;
-
-  if (isByRow) {
-    result = interpretAsByRow2dArray(chessboardCorners, tSize);
-  } else {
-    result = interpretAsByColumn2dArray(chessboardCorners, tSize);
-  }
-
+  chessboard_view_t view;
+  view.points = chessboardCorners.data();
+  view.transposed = isTransposed;
+  view.rowStep = isByRow ? tSize.width : 1;
+  view.colStep = isByRow ? 1 : tSize.height;
   if (isTransposed) {
-    result = transpose(result);
+    std::swap(view.rowStep, view.colStep);
   }
-
-  // Now result is by-row 2d array of points
+  // Now view is by-row 2d array of points
+  view.rows = boardSize.height;
+  view.cols = boardSize.width;
 
   bool needToReverseColumns = false;
   bool needToReverseRows = false;
@@ -174,35 +131,45 @@ std::vector<std::vector<cv::Point2f>> orderChessboardCorners(
   if (isTransposed) {
     // the top row should have the smallest X value, because it was the
     // leftmost column before transpose
-    if (result[0][0].x > result[1][0].x)
+    if (view.at(0, 0).x > view.at(1, 0).x)
       needToReverseRows = true;
     // the leftmost column should have the biggest Y value, because it was
     // the bottom row before transpose
-    if (result[0][0].y < result[0][1].y)
+    if (view.at(0, 0).y < view.at(0, 1).y)
       needToReverseColumns = true;
   } else {
-    if (result[0][0].y > result[1][0].y)
+    if (view.at(0, 0).y > view.at(1, 0).y)
       needToReverseRows = true;
-    if (result[0][0].x > result[0][1].x)
+    if (view.at(0, 0).x > view.at(0, 1).x)
       needToReverseColumns = true;
   }
 
   if (needToReverseColumns) {
-    for (auto &row : result) {
-      std::reverse(row.begin(), row.end());
-    }
+    view.origin += (view.cols - 1) * view.colStep;
+    view.colStep = -view.colStep;
   }
 
   if (needToReverseRows) {
-    std::reverse(result.begin(), result.end());
+    view.origin += (view.rows - 1) * view.rowStep;
+    view.rowStep = -view.rowStep;
   }
 
-  return result;
+  return view;
 }
 
-std::pair<cv::Point2f, cv::Point2f> getTwoBottomLeftPoints(
-    const std::vector<std::vector<cv::Point2f>> &points) {
-  return std::make_pair(points.back()[0], points.back()[1]);
+std::vector<std::vector<cv::Point2f>> orderChessboardCorners(
+    const std::vector<cv::Point2f> &chessboardCorners,
+    const cv::Size &boardSize) {
+  chessboard_view_t view = viewChessboardCorners(chessboardCorners, boardSize);
+  std::vector<std::vector<cv::Point2f>> result(view.rows,
+      std::vector<cv::Point2f>(view.cols));
+  for (int y = 0; y < view.rows; ++y) {
+    for (int x = 0; x < view.cols; ++x) {
+      result[y][x] = view.at(y, x);
+    }
+  }
+
+  return result;
 }
 
 void displayResult(
@@ -229,6 +196,16 @@ std::vector<cv::Point2f> extractCorners(
   return result;
 }
 
+std::vector<cv::Point2f> extractCorners(const chessboard_view_t &view) {
+  std::vector<cv::Point2f> result(4);
+  result[0] = view.at(view.rows - 1, 0); // bottom left
+  result[1] = view.at(view.rows - 1, view.cols - 1); // bottom right
+  result[2] = view.at(0, view.cols - 1); // top right
+  result[3] = view.at(0, 0); // top left
+
+  return result;
+}
+
 std::vector<cv::Point2f> extractCorners(const cv::Mat &image) {
   return extractCorners(cv::Size(image.cols, image.rows));
 }
@@ -244,16 +221,22 @@ std::vector<cv::Point2f> extractCorners(const cv::Size &size) {
 
 bool findChessboardCorners(const cv::Mat &image,
     const cv::Size &chessboardSize,
-    std::vector<cv::Point2f> &chessboardCorners) {
+    std::vector<cv::Point2f> &chessboardCorners, frame_filter_t *filter) {
+  if (filter && !passesFrameFilter(image, chessboardSize, *filter))
+    return false;
+
   // search for chessboard corners
   if (!cv::findChessboardCorners(image, chessboardSize, chessboardCorners,
       CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_FAST_CHECK |
       CV_CALIB_CB_NORMALIZE_IMAGE))
     return false;
+  if (filter)
+    ++filter->detected;
 
   // optimize results
-  cv::Mat viewGray;
-  cv::cvtColor(image, viewGray, CV_BGR2GRAY);
+  cv::Mat viewGray = image;
+  if (image.channels() == 3)
+    cv::cvtColor(image, viewGray, CV_BGR2GRAY);
   cv::cornerSubPix(viewGray, chessboardCorners, cv::Size(11, 11),
       cv::Size(-1, -1),
       cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
@@ -262,10 +245,14 @@ bool findChessboardCorners(const cv::Mat &image,
 
 float angleToHorizon(const std::vector<cv::Point2f> &chessboardCorners,
     const cv::Size &chessboardSize) {
-  auto twoPoints = getTwoBottomLeftPoints(orderChessboardCorners(
-    chessboardCorners, chessboardSize));
-  auto A = twoPoints.first;
-  auto B = twoPoints.second;
+  return angleToHorizon(viewChessboardCorners(chessboardCorners,
+      chessboardSize));
+}
+
+float angleToHorizon(const chessboard_view_t &view) {
+  // two leftmost points at the bottom
+  const cv::Point2f &A = view.at(view.rows - 1, 0);
+  const cv::Point2f &B = view.at(view.rows - 1, 1);
   cv::Point2f C(B.x, A.y);
 
   float BC = fabs(B.y - A.y);
@@ -303,16 +290,16 @@ bool projectToTheFloor(const cv::Mat &image, const cv::Size &chessboardSize,
 
   displayResult("before", temp, true);
 
-  bool t;
-  getPointsOrientation(chessboardCornersTemp, chessboardSize, t, isTransposed);
-  auto ordered = orderChessboardCorners(chessboardCornersTemp, chessboardSize);
+  chessboard_view_t ordered = viewChessboardCorners(chessboardCornersTemp,
+      chessboardSize);
+  isTransposed = ordered.transposed;
 
 #if 0
   {
     int r = 1;
-    for (size_t i = 0; i < ordered.size(); ++i) {
-      for (size_t j = 0; j < ordered[i].size(); ++j) {
-        const cv::Point2f &P = ordered[i][j];
+    for (int i = 0; i < ordered.rows; ++i) {
+      for (int j = 0; j < ordered.cols; ++j) {
+        const cv::Point2f &P = ordered.at(i, j);
         cv::circle(temp, P, (r * 5), cv::Scalar(200, 250, 250), 3);
         ++r;
       }
@@ -326,11 +313,11 @@ bool projectToTheFloor(const cv::Mat &image, const cv::Size &chessboardSize,
   if (isTransposed) {
     // image was transposed, so, instead of two leftmost points at the bottom
     // we should use two upper points in the leftmost column
-    blp = ordered[0][0];
-    blpn = ordered[1][0];
+    blp = ordered.at(0, 0);
+    blpn = ordered.at(1, 0);
   } else {
-    blp = ordered[chessboardSize.height - 1][0];
-    blpn = ordered[chessboardSize.height - 1][1];
+    blp = ordered.at(ordered.rows - 1, 0);
+    blpn = ordered.at(ordered.rows - 1, 1);
   }
 
   float squareSize = norm(blp - blpn);
@@ -429,3 +416,76 @@ void computeHomography(const std::vector<cv::Point2f> &from,
   // recalculate homography accounting offsets
   H = cv::findHomography(cv::Mat(from), cv::Mat(to_), CV_RANSAC);
 }
+
+int chooseDecodeReduction(const cv::Mat &H, const cv::Size &imageSize) {
+  cv::Mat_<double> h;
+  H.convertTo(h, CV_64F);
+
+  // Estimate the biggest magnification of the homography: a canvas pixel
+  // must not be covered by less than a source pixel after reduction.
+  // Projective transform changes its scale monotonically along any line,
+  // so it is enough to check the corners of the image
+  double maxScale = 0;
+  for (const auto &P : extractCorners(imageSize)) {
+    double w = h(2, 0) * P.x + h(2, 1) * P.y + h(2, 2);
+    double u = (h(0, 0) * P.x + h(0, 1) * P.y + h(0, 2)) / w;
+    double v = (h(1, 0) * P.x + h(1, 1) * P.y + h(1, 2)) / w;
+
+    // Jacobian of the transform at P
+    double a = (h(0, 0) - u * h(2, 0)) / w;
+    double b = (h(0, 1) - u * h(2, 1)) / w;
+    double c = (h(1, 0) - v * h(2, 0)) / w;
+    double d = (h(1, 1) - v * h(2, 1)) / w;
+
+    // the largest singular value of the Jacobian
+    double S = a * a + b * b + c * c + d * d;
+    double det = a * d - b * c;
+    double sigma = sqrt((S + sqrt(fmax(S * S - 4 * det * det, 0.0))) / 2);
+    maxScale = fmax(maxScale, sigma);
+  }
+
+  int reduction = 1;
+  while (reduction < 8 && maxScale * reduction * 2 <= 1.0) {
+    reduction *= 2;
+  }
+
+  return reduction;
+}
+
+cv::Mat scaleHomography(const cv::Mat &H, int reduction) {
+  if (reduction == 1) {
+    return H;
+  }
+
+  // Pixel x of reduced image covers pixels [x * r, x * r + r) of the
+  // original one, so its center is at x * r + (r - 1) / 2
+  double offset = (reduction - 1) / 2.0;
+  cv::Mat S = (cv::Mat_<double>(3, 3) <<
+      reduction, 0, offset,
+      0, reduction, offset,
+      0, 0, 1);
+  return H * S;
+}
+
+cv::Mat readImage(const std::string &path, int reduction) {
+#if CV_MAJOR_VERSION > 3 || (CV_MAJOR_VERSION == 3 && CV_MINOR_VERSION >= 2)
+  // libjpeg is able to skip DCT coefficients and produce smaller image
+  // without decoding it at full resolution
+  switch (reduction) {
+    case 2: return cv::imread(path, cv::IMREAD_REDUCED_COLOR_2);
+    case 4: return cv::imread(path, cv::IMREAD_REDUCED_COLOR_4);
+    case 8: return cv::imread(path, cv::IMREAD_REDUCED_COLOR_8);
+    default: return cv::imread(path);
+  }
+#else
+  cv::Mat image = cv::imread(path);
+  if (reduction == 1 || image.empty()) {
+    return image;
+  }
+
+  cv::Mat reduced;
+  cv::resize(image, reduced, cv::Size(image.cols / reduction,
+      image.rows / reduction), 0, 0, cv::INTER_AREA);
+  return reduced;
+#endif
+}
@@ -0,0 +1,171 @@
+#include "capture.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+size_t alignUp(size_t size) {
+  return (size + kRawAlignment - 1) / kRawAlignment * kRawAlignment;
+}
+
+size_t headerSize(size_t cameras) {
+  return alignUp(sizeof(raw_header_t) + cameras * sizeof(raw_camera_t));
+}
+
+}
+
+RawFrameFile::RawFrameFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(raw_header_t)) {
+    ::close(fd);
+    return;
+  }
+
+  // Private mapping: pages are shared with the page cache until someone
+  // draws on a frame
+  length = (size_t)info.st_size;
+  void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+      fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == mapped) {
+    return;
+  }
+  data = (uint8_t*)mapped;
+
+  raw_header_t header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kRawMagic, sizeof(kRawMagic)) != 0 ||
+      header.version != kRawVersion || header.cameras == 0 ||
+      length < headerSize(header.cameras) || header.set_size == 0) {
+    munmap(data, length);
+    data = nullptr;
+    return;
+  }
+
+  layout.resize(header.cameras);
+  std::memcpy(layout.data(), data + sizeof(header),
+      header.cameras * sizeof(raw_camera_t));
+  first = headerSize(header.cameras);
+  setSize = (size_t)header.set_size;
+  count = (length - first) / setSize;
+  for (const raw_camera_t &camera : layout) {
+    size_t frameSize = (size_t)std::max(camera.width, 0) *
+        std::max(camera.height, 0) * CV_ELEM_SIZE(camera.type);
+    if (frameSize == 0 || camera.offset + frameSize > setSize) {
+      count = 0;
+    }
+  }
+
+  // Frames are usually replayed in order
+  madvise(data, length, MADV_SEQUENTIAL);
+}
+
+RawFrameFile::~RawFrameFile() {
+  if (data) {
+    munmap(data, length);
+  }
+}
+
+cv::Size RawFrameFile::frameSize(size_t camera) const {
+  return cv::Size(layout[camera].width, layout[camera].height);
+}
+
+int RawFrameFile::frameType(size_t camera) const {
+  return layout[camera].type;
+}
+
+FrameFormat RawFrameFile::frameFormat(size_t camera) const {
+  return (FrameFormat)layout[camera].format;
+}
+
+cv::Mat RawFrameFile::frame(size_t index, size_t camera) const {
+  CV_Assert(index < count && camera < layout.size());
+  const raw_camera_t &info = layout[camera];
+  return cv::Mat(info.height, info.width, info.type,
+      data + first + index * setSize + info.offset);
+}
+
+int64_t RawFrameFile::timestamp(size_t index, size_t camera) const {
+  CV_Assert(index < count && camera < layout.size());
+  int64_t stamp;
+  std::memcpy(&stamp, data + first + index * setSize +
+      camera * sizeof(int64_t), sizeof(stamp));
+  return stamp;
+}
+
+RawFrameWriter::RawFrameWriter(const std::string &path,
+    const std::vector<cv::Size> &sizes, const std::vector<int> &types,
+    const std::vector<FrameFormat> &formats)
+    : out(path.c_str(), std::ios::binary | std::ios::trunc) {
+  CV_Assert(!sizes.empty() && sizes.size() == types.size());
+  CV_Assert(formats.empty() || formats.size() == sizes.size());
+
+  layout.resize(sizes.size());
+  size_t offset = alignUp(sizes.size() * sizeof(int64_t));
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    raw_camera_t &camera = layout[i];
+    std::memset(&camera, 0, sizeof(camera));
+    camera.width = sizes[i].width;
+    camera.height = sizes[i].height;
+    camera.type = types[i];
+    camera.format = (uint32_t)(formats.empty()
+        ? FrameFormat::Packed : formats[i]);
+    camera.offset = offset;
+    offset += alignUp((size_t)sizes[i].area() * CV_ELEM_SIZE(types[i]));
+  }
+  setSize = offset;
+
+  raw_header_t header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kRawMagic, sizeof(kRawMagic));
+  header.version = kRawVersion;
+  header.cameras = (uint32_t)layout.size();
+  header.set_size = setSize;
+
+  std::vector<char> block(headerSize(layout.size()), 0);
+  std::memcpy(block.data(), &header, sizeof(header));
+  std::memcpy(block.data() + sizeof(header), layout.data(),
+      layout.size() * sizeof(raw_camera_t));
+  out.write(block.data(), block.size());
+}
+
+bool RawFrameWriter::write(const std::vector<cv::Mat> &frames,
+    const std::vector<int64_t> &timestamps) {
+  if (!isOpened() || frames.size() != layout.size() ||
+      timestamps.size() != layout.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i].cols != layout[i].width ||
+        frames[i].rows != layout[i].height ||
+        frames[i].type() != layout[i].type) {
+      return false;
+    }
+  }
+
+  std::vector<char> padding(kRawAlignment, 0);
+  size_t written = timestamps.size() * sizeof(int64_t);
+  out.write((const char*)timestamps.data(), written);
+  for (size_t i = 0; i < frames.size(); ++i) {
+    out.write(padding.data(), layout[i].offset - written);
+    written = layout[i].offset;
+    // rows of a submatrix are not contiguous
+    const size_t rowSize = frames[i].cols * frames[i].elemSize();
+    for (int y = 0; y < frames[i].rows; ++y) {
+      out.write((const char*)frames[i].ptr(y), rowSize);
+    }
+    written += rowSize * frames[i].rows;
+  }
+  out.write(padding.data(), setSize - written);
+  return out.good();
+}
@@ -0,0 +1,125 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// FNV-1a, 64 bit
+const uint64_t kFnvOffset = 14695981039346656037ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+
+uint64_t fnv(uint64_t hash, const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+}
+
+double LatencyStats::mean() const {
+  if (samples.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (double sample : samples) {
+    sum += sample;
+  }
+  return sum / samples.size();
+}
+
+double LatencyStats::percentile(double p) const {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::vector<double> sorted = samples;
+  size_t rank = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+  rank = std::min(rank, sorted.size() - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+void LatencyStats::print(std::ostream &os, const std::string &name) const {
+  os << name << ": mean " << mean() << " ms, p50 " << percentile(50)
+      << " ms, p99 " << percentile(99) << " ms, max " << percentile(100)
+      << " ms" << std::endl;
+}
+
+void StageTimings::add(const std::string &stage, double ms) {
+  for (std::pair<std::string, double> &timing : timed) {
+    if (timing.first == stage) {
+      timing.second += ms;
+      return;
+    }
+  }
+  timed.push_back(std::make_pair(stage, ms));
+}
+
+double StageTimings::get(const std::string &stage) const {
+  for (const std::pair<std::string, double> &timing : timed) {
+    if (timing.first == stage) {
+      return timing.second;
+    }
+  }
+  return -1;
+}
+
+bool StageTimings::write(const std::string &path) const {
+  std::ofstream file(path.c_str());
+  for (const std::pair<std::string, double> &timing : timed) {
+    file << timing.first << " " << timing.second << std::endl;
+  }
+  return (bool)file;
+}
+
+bool StageTimings::read(const std::string &path) {
+  std::ifstream file(path.c_str());
+  if (!file) {
+    return false;
+  }
+  timed.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string stage;
+    double ms;
+    if (!(fields >> stage)) {
+      continue; // empty line
+    }
+    if (!(fields >> ms)) {
+      return false;
+    }
+    add(stage, ms);
+  }
+  return true;
+}
+
+uint64_t imageChecksum(const cv::Mat &image) {
+  uint64_t hash = kFnvOffset;
+  const size_t rowSize = image.cols * image.elemSize();
+  for (int y = 0; y < image.rows; ++y) {
+    hash = fnv(hash, image.ptr(y), rowSize);
+  }
+  return hash;
+}
+
+uint64_t combineChecksums(uint64_t sequence, uint64_t checksum) {
+  return fnv(sequence, (const uint8_t*)&checksum, sizeof(checksum));
+}
+
+void ReplayPacer::wait(int64_t timestamp) {
+  if (!enabled) {
+    return;
+  }
+  if (!started) {
+    started = true;
+    first = timestamp;
+    start = std::chrono::steady_clock::now();
+    return;
+  }
+  std::this_thread::sleep_until(start +
+      std::chrono::microseconds(timestamp - first));
+}
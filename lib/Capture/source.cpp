@@ -0,0 +1,171 @@
+#include "capture.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+const std::string kRawExtension = ".raw";
+
+// Split "file.raw#k" into the path of the file and the camera, false if the
+// path is not a path of a raw file
+bool parseRawPath(const std::string &path, std::string &file,
+    size_t &camera) {
+  std::string::size_type pos = path.rfind(kRawExtension);
+  if (std::string::npos == pos) {
+    return false;
+  }
+  std::string::size_type end = pos + kRawExtension.size();
+  if (end == path.size()) {
+    file = path;
+    camera = 0;
+    return true;
+  }
+  if (path[end] != '#' || end + 1 == path.size()) {
+    return false;
+  }
+  file = path.substr(0, end);
+  camera = (size_t)atoi(path.substr(end + 1).c_str());
+  return true;
+}
+
+}
+
+bool FrameSource::open(const std::string &path) {
+  this->path = path;
+  capture.release();
+  raw.reset();
+  position = 0;
+  stamp = 0;
+  nv12 = false;
+
+  std::string file;
+  if (parseRawPath(path, file, camera)) {
+    raw = std::make_shared<RawFrameFile>(file);
+    if (!raw->isOpened() || camera >= raw->cameras()) {
+      raw.reset();
+    }
+    return isOpened();
+  }
+  return capture.open(path);
+}
+
+bool FrameSource::isOpened() const {
+  return raw ? true : capture.isOpened();
+}
+
+bool FrameSource::read(cv::Mat &frame) {
+  if (!raw) {
+    if (!capture.read(frame)) {
+      frame.release();
+      return false;
+    }
+    stamp = (int64_t)(capture.get(CV_CAP_PROP_POS_MSEC) * 1000);
+    return true;
+  }
+
+  if (position >= raw->frames()) {
+    frame.release();
+    return false;
+  }
+  frame = raw->frame(position, camera);
+  stamp = raw->timestamp(position, camera);
+  ++position;
+  return true;
+}
+
+FrameSource &FrameSource::operator>>(cv::Mat &frame) {
+  read(frame);
+  return *this;
+}
+
+bool FrameSource::grab() {
+  if (!raw) {
+    return capture.grab();
+  }
+  if (position >= raw->frames()) {
+    return false;
+  }
+  ++position;
+  return true;
+}
+
+bool FrameSource::seek(int index) {
+  if (raw) {
+    if (index < 0 || (size_t)index > raw->frames()) {
+      return false;
+    }
+    position = (size_t)index;
+    return true;
+  }
+
+  capture.set(CV_CAP_PROP_POS_FRAMES, index);
+  if ((int)capture.get(CV_CAP_PROP_POS_FRAMES) == index) {
+    return true;
+  }
+
+  capture.open(path);
+  if (nv12) {
+    capture.set(CV_CAP_PROP_CONVERT_RGB, 0);
+  }
+  for (int i = 0; i < index; ++i) {
+    if (!capture.grab()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int FrameSource::count() {
+  if (raw) {
+    return (int)raw->frames();
+  }
+  return std::max(0, (int)capture.get(CV_CAP_PROP_FRAME_COUNT));
+}
+
+bool FrameSource::requestNV12() {
+  if (raw || !capture.isOpened()) {
+    return FrameFormat::NV12 == format();
+  }
+
+  // Without conversion frames come in whatever layout the backend decodes
+  // to, e.g. YUYV from V4L2 or encoded packets from FFmpeg, so it is kept
+  // only if the backend reports NV12 pixels. Cameras are asked for them
+  // first, files ignore it
+  const int fourcc = CV_FOURCC('N', 'V', '1', '2');
+  capture.set(CV_CAP_PROP_FOURCC, fourcc);
+  if (capture.set(CV_CAP_PROP_CONVERT_RGB, 0) &&
+      (int)capture.get(CV_CAP_PROP_FOURCC) == fourcc) {
+    nv12 = true;
+  } else {
+    capture.set(CV_CAP_PROP_CONVERT_RGB, 1);
+  }
+  return nv12;
+}
+
+FrameFormat FrameSource::format() const {
+  if (raw) {
+    return raw->frameFormat(camera);
+  }
+  return nv12 ? FrameFormat::NV12 : FrameFormat::Packed;
+}
+
+std::vector<std::string> expandFramePaths(
+    const std::vector<std::string> &paths) {
+  std::vector<std::string> expanded;
+  for (const std::string &path : paths) {
+    std::string file;
+    size_t camera;
+    if (parseRawPath(path, file, camera) && file == path) {
+      RawFrameFile raw(file);
+      if (raw.isOpened()) {
+        for (size_t i = 0; i < raw.cameras(); ++i) {
+          expanded.push_back(file + "#" + std::to_string(i));
+        }
+        continue;
+      }
+    }
+    expanded.push_back(path);
+  }
+  return expanded;
+}
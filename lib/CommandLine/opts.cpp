@@ -56,6 +56,24 @@ bool parse_command_line_opts(int argc, char *argv[]) {
       opts.stitch_config = arg.substr(pos + 1);
     } else if ("--video" == arg) {
       opts.video = true;
+    } else if ("--no-gains" == arg) {
+      opts.gain_compensation = false;
+    } else if ("--no-prefilter" == arg) {
+      opts.prefilter = false;
+    } else if ("--planar" == arg) {
+      opts.planar = true;
+    } else if ("--crop" == arg) {
+      opts.crop = true;
+    } else if (arg.find("--max-mpix") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.max_megapixels = atof(arg.substr(pos + 1).c_str());
+    } else if ("--no-owners" == arg) {
+      opts.owner_map = false;
     } else if (arg.find("--delay") == 0) {
       std::string::size_type pos = arg.find("=");
       if (std::string::npos == pos) {
@@ -80,6 +98,34 @@ bool parse_command_line_opts(int argc, char *argv[]) {
       }
 
       opts.angle = atoi(arg.substr(pos + 1).c_str());
+    } else if (arg.find("--scan") == 0) {
+      opts.scan_step = 10;
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos != pos) {
+        opts.scan_step = atoi(arg.substr(pos + 1).c_str());
+        if (opts.scan_step < 1) {
+          valid = false;
+          break;
+        }
+      }
+    } else if (arg.find("--reduce") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string reduction = arg.substr(pos + 1);
+      if ("auto" == reduction) {
+        opts.decode_reduction = 0;
+      } else {
+        opts.decode_reduction = atoi(reduction.c_str());
+        if (opts.decode_reduction != 1 && opts.decode_reduction != 2 &&
+            opts.decode_reduction != 4 && opts.decode_reduction != 8) {
+          valid = false;
+          break;
+        }
+      }
     } else if (arg.find("--mode") == 0) {
       std::string::size_type pos = arg.find("=");
       if (std::string::npos == pos) {
@@ -96,6 +142,411 @@ bool parse_command_line_opts(int argc, char *argv[]) {
         valid = false;
         break;
       }
+    } else if (arg.find("--grid") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.map_grid = atoi(arg.substr(pos + 1).c_str());
+      if (opts.map_grid < 1) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--incremental") == 0) {
+      opts.incremental = true;
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos != pos) {
+        opts.change_threshold = atof(arg.substr(pos + 1).c_str());
+        if (opts.change_threshold < 0) {
+          valid = false;
+          break;
+        }
+      }
+    } else if (arg.find("--drift") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.drift_interval = atof(arg.substr(pos + 1).c_str());
+      if (opts.drift_interval < 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--read-cpus") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.read_cpus = arg.substr(pos + 1);
+    } else if (arg.find("--compose-cpus") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.compose_cpus = arg.substr(pos + 1);
+    } else if (arg.find("--encode-cpus") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.encode_cpus = arg.substr(pos + 1);
+    } else if (arg.find("--http") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.http_port = atoi(arg.substr(pos + 1).c_str());
+      if (opts.http_port <= 0 || opts.http_port > 65535) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--jpeg-quality") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.jpeg_quality = atoi(arg.substr(pos + 1).c_str());
+      if (opts.jpeg_quality < 1 || opts.jpeg_quality > 100) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--metrics-port") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.metrics_port = atoi(arg.substr(pos + 1).c_str());
+      if (opts.metrics_port <= 0 || opts.metrics_port > 65535) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--metrics-file") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.metrics_path = arg.substr(pos + 1);
+      if (opts.metrics_path.empty()) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--metrics-interval") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.metrics_interval = atof(arg.substr(pos + 1).c_str());
+      if (opts.metrics_interval <= 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--timings") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.timings_path = arg.substr(pos + 1);
+    } else if (arg.find("--cameras") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.synthetic_cameras = atoi(arg.substr(pos + 1).c_str());
+      if (opts.synthetic_cameras < 1) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--frame-size") == 0) {
+      std::string::size_type pos = arg.find("=");
+      std::string::size_type x = arg.find("x", pos);
+      if (std::string::npos == pos || std::string::npos == x) {
+        valid = false;
+        break;
+      }
+
+      opts.frame_width = atoi(arg.substr(pos + 1, x - pos - 1).c_str());
+      opts.frame_height = atoi(arg.substr(x + 1).c_str());
+      if (opts.frame_width <= 0 || opts.frame_height <= 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--fov") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.fov = atof(arg.substr(pos + 1).c_str());
+      if (opts.fov <= 0 || opts.fov >= 180) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--distortion") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.distortion.clear();
+      std::string coeffs = arg.substr(pos + 1);
+      for (std::string::size_type start = 0; start <= coeffs.size(); ) {
+        std::string::size_type comma = coeffs.find(",", start);
+        if (std::string::npos == comma) {
+          comma = coeffs.size();
+        }
+        opts.distortion.push_back(
+            atof(coeffs.substr(start, comma - start).c_str()));
+        start = comma + 1;
+      }
+      if (opts.distortion.size() > 5) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--camera-height") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.camera_height = atof(arg.substr(pos + 1).c_str());
+      if (opts.camera_height <= 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--pitch") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.pitch = atof(arg.substr(pos + 1).c_str());
+      if (opts.pitch <= 0 || opts.pitch > 90) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--arc") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.arc = atof(arg.substr(pos + 1).c_str());
+      if (opts.arc < 0 || opts.arc >= 180) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--jitter") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.pose_jitter = atof(arg.substr(pos + 1).c_str());
+      if (opts.pose_jitter < 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--seed") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.seed = (unsigned)strtoul(arg.substr(pos + 1).c_str(), nullptr, 10);
+    } else if (arg.find("--supersampling") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.supersampling = atoi(arg.substr(pos + 1).c_str());
+      if (opts.supersampling < 1) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--truth") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.truth_config = arg.substr(pos + 1);
+    } else if (arg.find("--shard-worker") == 0) {
+      std::string::size_type pos = arg.find("=");
+      std::string::size_type colon = arg.rfind(":");
+      if (std::string::npos == pos || std::string::npos == colon ||
+          colon < pos) {
+        valid = false;
+        break;
+      }
+
+      opts.shard_segment = arg.substr(pos + 1, colon - pos - 1);
+      opts.shard_index = atoi(arg.substr(colon + 1).c_str());
+      if (opts.shard_segment.empty() || opts.shard_index < 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--shards") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.shard_workers = atoi(arg.substr(pos + 1).c_str());
+      if (opts.shard_workers < 0) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--record") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.record_path = arg.substr(pos + 1);
+    } else if (arg.find("--replay") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.replay_path = arg.substr(pos + 1);
+    } else if (arg.find("--pace") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string pace = arg.substr(pos + 1);
+      if ("original" == pace) {
+        opts.original_pace = true;
+      } else if ("max" == pace) {
+        opts.original_pace = false;
+      } else {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--traversal") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string traversal = arg.substr(pos + 1);
+      if ("blocks" == traversal) {
+        opts.blocked_traversal = true;
+      } else if ("rows" == traversal) {
+        opts.blocked_traversal = false;
+      } else {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--schedule") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string schedule = arg.substr(pos + 1);
+      if ("latency" == schedule) {
+        opts.schedule = Schedule::Latency;
+      } else if ("throughput" == schedule) {
+        opts.schedule = Schedule::Throughput;
+      } else {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--in-flight") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      opts.frames_in_flight = atoi(arg.substr(pos + 1).c_str());
+      if (opts.frames_in_flight < 1) {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--kernel") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string kernel_str = arg.substr(pos + 1);
+      if ("auto" == kernel_str) {
+        opts.remap_kernel = RemapKernel::Auto;
+      } else if ("scalar" == kernel_str) {
+        opts.remap_kernel = RemapKernel::Scalar;
+      } else if ("sse42" == kernel_str) {
+        opts.remap_kernel = RemapKernel::SSE42;
+      } else if ("avx2" == kernel_str) {
+        opts.remap_kernel = RemapKernel::AVX2;
+      } else if ("avx512" == kernel_str) {
+        opts.remap_kernel = RemapKernel::AVX512;
+      } else {
+        valid = false;
+        break;
+      }
+    } else if (arg.find("--projection") == 0) {
+      std::string::size_type pos = arg.find("=");
+      if (std::string::npos == pos) {
+        valid = false;
+        break;
+      }
+
+      std::string projection = arg.substr(pos + 1);
+      if ("plane" == projection) {
+        opts.projection = Projection::Plane;
+      } else if ("cylindrical" == projection) {
+        opts.projection = Projection::Cylindrical;
+      } else if ("spherical" == projection) {
+        opts.projection = Projection::Spherical;
+      } else {
+        valid = false;
+        break;
+      }
     } else {
       // assume argument is a path to an image
       opts.file_paths.push_back(arg);
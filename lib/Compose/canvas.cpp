@@ -0,0 +1,72 @@
+#include "compose.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+double budgetScale(const cv::Size &canvasSize, double megapixels) {
+  const double area = (double)canvasSize.width * canvasSize.height;
+  if (megapixels <= 0 || area <= megapixels * 1e6) {
+    return 1;
+  }
+  return sqrt(megapixels * 1e6 / area);
+}
+
+cv::Size scaleCanvasSize(const cv::Size &canvasSize, double scale) {
+  // the last pixel must not move beyond the last pixel of the old canvas
+  return cv::Size(std::max((int)floor((canvasSize.width - 1) * scale) + 1, 1),
+      std::max((int)floor((canvasSize.height - 1) * scale) + 1, 1));
+}
+
+cv::Rect largestCoveredRect(const cv::Mat &owners) {
+  CV_Assert(owners.type() == CV_8UC1);
+
+  // Every row is the base of a histogram of covered pixels above it, the
+  // largest rectangle under each histogram is found with a stack of bars
+  // of increasing height
+  std::vector<int> heights(owners.cols + 1, 0);
+  std::vector<int> stack;
+  cv::Rect best;
+  for (int y = 0; y < owners.rows; ++y) {
+    const uint8_t *owner = owners.ptr<uint8_t>(y);
+    for (int x = 0; x < owners.cols; ++x) {
+      heights[x] = (owner[x] != kNoOwner) ? heights[x] + 1 : 0;
+    }
+
+    stack.clear();
+    // the bar of zero height after the last column empties the stack
+    for (int x = 0; x <= owners.cols; ++x) {
+      while (!stack.empty() && heights[stack.back()] >= heights[x]) {
+        const int height = heights[stack.back()];
+        stack.pop_back();
+        const int left = stack.empty() ? 0 : stack.back() + 1;
+        const int width = x - left;
+        if ((long long)width * height > (long long)best.area()) {
+          best = cv::Rect(left, y - height + 1, width, height);
+        }
+      }
+      stack.push_back(x);
+    }
+  }
+  return best;
+}
+
+void transformCanvas(const cv::Point2d &offset, double scale,
+    std::vector<cv::Mat> &H, projection_t &projection) {
+  if (projection.type != Projection::Plane) {
+    projection.origin = projection.origin +
+        offset * (1.0 / projection.scale);
+    projection.scale *= scale;
+    return;
+  }
+
+  const cv::Mat A = (cv::Mat_<double>(3, 3) <<
+      scale, 0, -scale * offset.x,
+      0, scale, -scale * offset.y,
+      0, 0, 1);
+  for (cv::Mat &h : H) {
+    cv::Mat h64;
+    h.convertTo(h64, CV_64F);
+    h = A * h64;
+  }
+}
@@ -0,0 +1,138 @@
+#include "compose.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Mean absolute difference of blocks of the frame and the reference, one
+// row of blocks per item
+class BlockDifferenceBody : public cv::ParallelLoopBody {
+ public:
+  BlockDifferenceBody(const cv::Mat &frame, frame_changes_t &changes,
+      double threshold)
+      : frame(frame), changes(changes), threshold(threshold) {
+  }
+
+  void operator()(const cv::Range &range) const override {
+    const int block = changes.block;
+    for (int by = range.start; by < range.end; ++by) {
+      uint8_t *changed = changes.changed.ptr<uint8_t>(by);
+      for (int bx = 0; bx < changes.changed.cols; ++bx) {
+        cv::Rect area(bx * block, by * block,
+            std::min(block, frame.cols - bx * block),
+            std::min(block, frame.rows - by * block));
+        cv::Mat current = frame(area);
+        cv::Mat reference = changes.reference(area);
+        double difference = cv::norm(current, reference, cv::NORM_L1) /
+            ((double)area.area() * frame.channels());
+        changed[bx] = (difference > threshold) ? 1 : 0;
+        if (changed[bx]) {
+          // blocks which change slowly are compared with the state they
+          // were composed in, so small differences do not accumulate
+          current.copyTo(reference);
+        }
+      }
+    }
+  }
+
+ private:
+  const cv::Mat &frame;
+  frame_changes_t &changes;
+  double threshold;
+};
+
+}
+
+void planTileSources(warp_maps_t &maps, const cv::Size &imageSize) {
+  maps.tileSources.assign(maps.tiles.size(), cv::Rect());
+  const cv::Rect image(cv::Point(), imageSize);
+
+  std::vector<float> row;
+  for (size_t t = 0; t < maps.tiles.size(); ++t) {
+    const cv::Rect &tile = maps.tiles[t];
+    row.resize(2 * tile.width);
+    float minU = 0, minV = 0, maxU = -1, maxV = -1;
+    for (int y = tile.y; y < tile.y + tile.height; ++y) {
+      const float *map = nullptr;
+      if (maps.grid > 1) {
+        interpolateMapRow(maps, y, tile.x, tile.width, row.data());
+        map = row.data();
+      } else {
+        map = maps.map.ptr<float>(y) + 2 * tile.x;
+      }
+      for (int x = 0; x < tile.width; ++x) {
+        const float u = map[2 * x];
+        const float v = map[2 * x + 1];
+        if (!(u >= 0 && v >= 0 && u <= imageSize.width - 1 &&
+            v <= imageSize.height - 1)) {
+          continue;
+        }
+        if (maxU < minU) {
+          minU = maxU = u;
+          minV = maxV = v;
+        } else {
+          minU = std::min(minU, u);
+          maxU = std::max(maxU, u);
+          minV = std::min(minV, v);
+          maxV = std::max(maxV, v);
+        }
+      }
+    }
+
+    if (maxU >= minU) {
+      // bilinear interpolation reads the next pixel too
+      cv::Point from((int)floor(minU), (int)floor(minV));
+      cv::Point to((int)floor(maxU) + 2, (int)floor(maxV) + 2);
+      maps.tileSources[t] = cv::Rect(from, to) & image;
+    }
+  }
+}
+
+int detectChanges(const cv::Mat &frame, frame_changes_t &changes,
+    double threshold) {
+  const int block = std::max(changes.block, 1);
+  changes.block = block;
+  const cv::Size blocks((frame.cols + block - 1) / block,
+      (frame.rows + block - 1) / block);
+
+  if (changes.reference.size() != frame.size() ||
+      changes.reference.type() != frame.type()) {
+    // nothing to compare the first frame with
+    frame.copyTo(changes.reference);
+    changes.changed = cv::Mat(blocks, CV_8UC1, cv::Scalar(1));
+  } else {
+    changes.changed.create(blocks, CV_8UC1);
+    cv::parallel_for_(cv::Range(0, blocks.height),
+        BlockDifferenceBody(frame, changes, threshold));
+  }
+
+  cv::integral(changes.changed, changes.integral, CV_32S);
+  return cv::countNonZero(changes.changed);
+}
+
+void selectDirtyTiles(const warp_maps_t &maps, const frame_changes_t &changes,
+    std::vector<int> &dirty) {
+  CV_Assert(maps.tileSources.size() == maps.tiles.size());
+
+  dirty.clear();
+  const int block = changes.block;
+  for (size_t t = 0; t < maps.tiles.size(); ++t) {
+    const cv::Rect &source = maps.tileSources[t];
+    if (source.area() <= 0) {
+      continue;
+    }
+    const int x0 = source.x / block;
+    const int y0 = source.y / block;
+    const int x1 = (source.x + source.width - 1) / block + 1;
+    const int y1 = (source.y + source.height - 1) / block + 1;
+    const cv::Mat &sum = changes.integral;
+    if (sum.at<int>(y1, x1) - sum.at<int>(y0, x1) - sum.at<int>(y1, x0) +
+        sum.at<int>(y0, x0) > 0) {
+      dirty.push_back((int)t);
+    }
+  }
+}
@@ -0,0 +1,103 @@
+#include "compose.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+// Canvas is downscaled to roughly this number of pixels: mean intensities
+// of the overlaps do not need full resolution
+const double kEstimationArea = 1e6;
+
+// Standard deviations of the intensity error and of the gain, see
+// M. Brown, D. Lowe, "Automatic Panoramic Image Stitching using Invariant
+// Features", the same values are used by cv::detail::GainCompensator
+const double kSigmaN = 10.0;
+const double kSigmaG = 0.1;
+
+}
+
+std::vector<cv::Vec3f> estimateGains(const std::vector<cv::Mat> &images,
+    const std::vector<cv::Mat> &H, const cv::Size &canvasSize) {
+  const size_t n = images.size();
+  std::vector<cv::Vec3f> gains(n, cv::Vec3f(1, 1, 1));
+  if (n < 2) {
+    return gains;
+  }
+
+  double scale = std::min(1.0, sqrt(kEstimationArea / canvasSize.area()));
+  cv::Size size((int)round(canvasSize.width * scale),
+      (int)round(canvasSize.height * scale));
+  cv::Mat S = (cv::Mat_<double>(3, 3) <<
+      scale, 0, 0,
+      0, scale, 0,
+      0, 0, 1);
+
+  std::vector<cv::Mat> warped(n);
+  std::vector<cv::Mat> masks(n);
+  for (size_t i = 0; i < n; ++i) {
+    cv::Mat SH = S * H[i];
+    cv::warpPerspective(images[i], warped[i], SH, size, cv::INTER_LINEAR,
+        cv::BORDER_CONSTANT);
+    cv::Mat ones(images[i].size(), CV_8U, cv::Scalar(255));
+    cv::warpPerspective(ones, masks[i], SH, size, cv::INTER_NEAREST,
+        cv::BORDER_CONSTANT);
+  }
+
+  // N(i, j) - number of pixels in overlap of i-th and j-th images,
+  // I(i, j) - mean intensity of i-th image in this overlap
+  cv::Mat_<double> N = cv::Mat_<double>::zeros((int)n, (int)n);
+  std::vector<cv::Mat_<double>> I(3);
+  for (int c = 0; c < 3; ++c) {
+    I[c] = cv::Mat_<double>::zeros((int)n, (int)n);
+  }
+
+  for (int i = 0; i < (int)n; ++i) {
+    for (int j = i; j < (int)n; ++j) {
+      cv::Mat overlap;
+      cv::bitwise_and(masks[i], masks[j], overlap);
+      int count = cv::countNonZero(overlap);
+      N(i, j) = N(j, i) = std::max(count, 1);
+      if (0 == count) {
+        continue;
+      }
+
+      cv::Scalar Ii = cv::mean(warped[i], overlap);
+      cv::Scalar Ij = cv::mean(warped[j], overlap);
+      for (int c = 0; c < 3; ++c) {
+        I[c](i, j) = Ii[c];
+        I[c](j, i) = Ij[c];
+      }
+    }
+  }
+
+  // Minimize sum of N(i, j) * ((g_i * I(i, j) - g_j * I(j, i))^2 / sigmaN^2 +
+  // (1 - g_i)^2 / sigmaG^2) independently for each channel
+  const double alpha = 1.0 / (kSigmaN * kSigmaN);
+  const double beta = 1.0 / (kSigmaG * kSigmaG);
+  for (int c = 0; c < 3; ++c) {
+    cv::Mat_<double> A = cv::Mat_<double>::zeros((int)n, (int)n);
+    cv::Mat_<double> b = cv::Mat_<double>::zeros((int)n, 1);
+    for (int i = 0; i < (int)n; ++i) {
+      for (int j = 0; j < (int)n; ++j) {
+        b(i, 0) += beta * N(i, j);
+        A(i, i) += beta * N(i, j);
+        if (j == i) {
+          continue;
+        }
+        A(i, i) += 2 * alpha * I[c](i, j) * I[c](i, j) * N(i, j);
+        A(i, j) -= 2 * alpha * I[c](i, j) * I[c](j, i) * N(i, j);
+      }
+    }
+
+    cv::Mat_<double> g;
+    cv::solve(A, b, g);
+    for (int i = 0; i < (int)n; ++i) {
+      gains[i][c] = (float)g(i, 0);
+    }
+  }
+
+  return gains;
+}
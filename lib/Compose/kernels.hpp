@@ -0,0 +1,80 @@
+
+#ifndef __LIB_COMPOSE_KERNELS_HPP__
+#define __LIB_COMPOSE_KERNELS_HPP__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// Row kernels know nothing about cv::Mat, so each of them can be compiled
+// with its own instruction set flags
+
+struct remap_source_t {
+  const uint8_t *data; // pixels of any type remapRowScalarT is built for
+  size_t step; // in bytes
+  int cols;
+  int rows;
+};
+
+// Remap n pixels of a canvas row. map contains n pairs of source coordinates,
+// gain - a multiplier per channel (up to 4). dst points to the first byte
+// of the first pixel
+typedef void (*remap_row_fn_t)(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+
+// Must stay static: an inline function with external linkage could be
+// emitted from a translation unit compiled with AVX flags and then be
+// picked by the linker for the scalar path. T and CN are the depth and the
+// number of channels, so every instantiation has its own inner loop
+template <typename T, int CN>
+static inline void remapRowScalarT(const remap_source_t &src,
+    const float *map, const float *gain, uint8_t *dst, int n) {
+  const int maxX = src.cols - 1;
+  const int maxY = src.rows - 1;
+  const long maxValue = std::numeric_limits<T>::max();
+  T *out = (T*)dst;
+
+  for (int x = 0; x < n; ++x) {
+    const float sx = map[2 * x];
+    const float sy = map[2 * x + 1];
+    if (!(sx >= 0 && sy >= 0 && sx <= maxX && sy <= maxY)) {
+      continue; // transparent border
+    }
+
+    const int x0 = (int)sx;
+    const int y0 = (int)sy;
+    const int x1 = x0 < maxX ? x0 + 1 : maxX;
+    const int y1 = y0 < maxY ? y0 + 1 : maxY;
+    const float ax = sx - x0;
+    const float ay = sy - y0;
+
+    const T *row0 = (const T*)(src.data + y0 * src.step);
+    const T *row1 = (const T*)(src.data + y1 * src.step);
+    const T *p00 = row0 + CN * x0;
+    const T *p01 = row0 + CN * x1;
+    const T *p10 = row1 + CN * x0;
+    const T *p11 = row1 + CN * x1;
+    for (int c = 0; c < CN; ++c) {
+      float top = p00[c] + ax * (p01[c] - p00[c]);
+      float bottom = p10[c] + ax * (p11[c] - p10[c]);
+      long v = lrintf((top + ay * (bottom - top)) * gain[c]);
+      out[CN * x + c] = (T)(v < 0 ? 0 : (v > maxValue ? maxValue : v));
+    }
+  }
+}
+
+// SIMD kernels handle 8-bit pixels of CN = 1, 2 or 3 channels, e.g. luma and
+// chroma planes of NV12 or BGR. They are instantiated in their own
+// translation units and fall back to remapRowScalarT for the tail of a row
+template <int CN>
+void remapRowSSE42(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template <int CN>
+void remapRowAVX2(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template <int CN>
+void remapRowAVX512(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+
+#endif // __LIB_COMPOSE_KERNELS_HPP__
@@ -0,0 +1,257 @@
+#include "compose.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// Transformation from canvas to source image coordinates: inverse
+// homography (of the viewing direction of the canvas pixel for curved
+// canvases) followed by the same distortion model as used by cv::undistort
+class CanvasToSource {
+ public:
+  CanvasToSource(const cv::Mat &H, const projection_t &projection,
+      const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+      const cv::Size &imageSize)
+      : projection(projection), undistort(!cameraMatrix.empty()),
+        maxX(imageSize.width - 1), maxY(imageSize.height - 1) {
+    if (Projection::Plane == projection.type) {
+      cv::Mat_<double> h;
+      H.convertTo(h, CV_64F);
+      Hinv = h.inv();
+    } else {
+      Hinv = directionsToImage(H, projection, imageSize);
+    }
+
+    std::fill(k, k + 8, 0.0);
+    if (undistort) {
+      cv::Mat_<double> K;
+      cameraMatrix.convertTo(K, CV_64F);
+      fx = K(0, 0);
+      fy = K(1, 1);
+      cx = K(0, 2);
+      cy = K(1, 2);
+
+      // k1, k2, p1, p2[, k3[, k4, k5, k6]]
+      cv::Mat_<double> D;
+      distCoeffs.convertTo(D, CV_64F);
+      for (size_t i = 0; i < std::min<size_t>(D.total(), 8); ++i) {
+        k[i] = D.at<double>((int)i);
+      }
+    }
+  }
+
+  // Returns false if (u, v) has no source: it is beyond the horizon or, if
+  // clip is set, outside of the undistorted image
+  bool operator()(double u, double v, bool clip, cv::Vec2f &P) const {
+    cv::Vec3d p(u, v, 1);
+    if (projection.type != Projection::Plane) {
+      p = canvasDirection(projection, u, v);
+    }
+    double w = Hinv(2, 0) * p[0] + Hinv(2, 1) * p[1] + Hinv(2, 2) * p[2];
+    if (w <= 0) {
+      return false;
+    }
+    double xu = (Hinv(0, 0) * p[0] + Hinv(0, 1) * p[1] + Hinv(0, 2) * p[2]) /
+        w;
+    double yu = (Hinv(1, 0) * p[0] + Hinv(1, 1) * p[1] + Hinv(1, 2) * p[2]) /
+        w;
+    if (clip && (xu < 0 || yu < 0 || xu > maxX || yu > maxY)) {
+      return false;
+    }
+
+    if (!undistort) {
+      P = cv::Vec2f((float)xu, (float)yu);
+      return true;
+    }
+
+    double xn = (xu - cx) / fx;
+    double yn = (yu - cy) / fy;
+    double r2 = xn * xn + yn * yn;
+    double radial = (1 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2) /
+        (1 + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2);
+    double xd = xn * radial + 2 * k[2] * xn * yn + k[3] * (r2 + 2 * xn * xn);
+    double yd = yn * radial + k[2] * (r2 + 2 * yn * yn) + 2 * k[3] * xn * yn;
+
+    P = cv::Vec2f((float)(fx * xd + cx), (float)(fy * yd + cy));
+    return true;
+  }
+
+ private:
+  const projection_t &projection;
+  cv::Mat_<double> Hinv;
+  bool undistort;
+  double fx = 1, fy = 1, cx = 0, cy = 0;
+  double k[8];
+  double maxX, maxY;
+};
+
+// Bounding box of the image transformed with H, clipped by the canvas
+cv::Rect footprint(const cv::Mat &H, const cv::Size &imageSize,
+    const cv::Size &canvasSize) {
+  cv::Mat_<double> h;
+  H.convertTo(h, CV_64F);
+
+  const cv::Rect canvas(0, 0, canvasSize.width, canvasSize.height);
+  const double xs[] = { 0.0, (double)imageSize.width, 0.0,
+      (double)imageSize.width };
+  const double ys[] = { 0.0, 0.0, (double)imageSize.height,
+      (double)imageSize.height };
+
+  double minX = HUGE_VAL, minY = HUGE_VAL;
+  double maxX = -HUGE_VAL, maxY = -HUGE_VAL;
+  for (int i = 0; i < 4; ++i) {
+    double w = h(2, 0) * xs[i] + h(2, 1) * ys[i] + h(2, 2);
+    if (w <= 0) {
+      // part of the image is projected beyond the horizon, bounding box
+      // of the corners means nothing in this case
+      return canvas;
+    }
+    double u = (h(0, 0) * xs[i] + h(0, 1) * ys[i] + h(0, 2)) / w;
+    double v = (h(1, 0) * xs[i] + h(1, 1) * ys[i] + h(1, 2)) / w;
+    minX = std::min(minX, u);
+    maxX = std::max(maxX, u);
+    minY = std::min(minY, v);
+    maxY = std::max(maxY, v);
+  }
+
+  cv::Rect box((int)floor(minX), (int)floor(minY),
+      (int)ceil(maxX) - (int)floor(minX) + 1,
+      (int)ceil(maxY) - (int)floor(minY) + 1);
+  return box & canvas;
+}
+
+// The same for a curved canvas
+cv::Rect footprint(const cv::Mat &H, const projection_t &projection,
+    const cv::Size &imageSize, const cv::Size &canvasSize) {
+  cv::Point2d low, high;
+  projectedBounds(H, projection, imageSize, low, high);
+
+  // one more pixel for edges bulging between the samples
+  cv::Rect box((int)floor(low.x) - 1, (int)floor(low.y) - 1,
+      (int)ceil(high.x) - (int)floor(low.x) + 3,
+      (int)ceil(high.y) - (int)floor(low.y) + 3);
+  return box & cv::Rect(0, 0, canvasSize.width, canvasSize.height);
+}
+
+}
+
+cv::Size warpMapSize(const cv::Rect &roi, int grid) {
+  if (grid <= 1) {
+    return roi.size();
+  }
+
+  // one more node than needed to cover roi, so the last pixels have nodes
+  // on both sides
+  return cv::Size((roi.width + grid - 1) / grid + 1,
+      (roi.height + grid - 1) / grid + 1);
+}
+
+void interpolateMapRow(const warp_maps_t &maps, int y, int x, int n,
+    float *row) {
+  const int grid = maps.grid;
+  const int gy = y / grid;
+  const float fy = (float)(y - gy * grid) / grid;
+  const float *top = maps.map.ptr<float>(gy);
+  const float *bottom = maps.map.ptr<float>(gy + 1);
+
+  const int end = x + n;
+  for (int j = x / grid; j * grid < end; ++j) {
+    const float ax = top[2 * j] + (bottom[2 * j] - top[2 * j]) * fy;
+    const float ay = top[2 * j + 1] + (bottom[2 * j + 1] - top[2 * j + 1]) * fy;
+    const float bx = top[2 * j + 2] + (bottom[2 * j + 2] - top[2 * j + 2]) * fy;
+    const float by = top[2 * j + 3] + (bottom[2 * j + 3] - top[2 * j + 3]) * fy;
+    const float dx = (bx - ax) / grid;
+    const float dy = (by - ay) / grid;
+
+    const int from = std::max(j * grid, x);
+    const int to = std::min((j + 1) * grid, end);
+    for (int p = from; p < to; ++p) {
+      const int i = p - j * grid;
+      row[2 * (p - x)] = ax + dx * i;
+      row[2 * (p - x) + 1] = ay + dy * i;
+    }
+  }
+}
+
+void interpolateMapRow(const warp_maps_t &maps, int y, float *row) {
+  interpolateMapRow(maps, y, 0, maps.roi.width, row);
+}
+
+void buildWarpMaps(const cv::Mat &H, const cv::Mat &cameraMatrix,
+    const cv::Mat &distCoeffs, const cv::Size &imageSize,
+    const cv::Size &canvasSize, warp_maps_t &maps, int grid) {
+  buildWarpMaps(H, projection_t(), cameraMatrix, distCoeffs, imageSize,
+      canvasSize, maps, grid);
+}
+
+void buildWarpMaps(const cv::Mat &H, const projection_t &projection,
+    const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs,
+    const cv::Size &imageSize, const cv::Size &canvasSize, warp_maps_t &maps,
+    int grid) {
+  CanvasToSource toSource(H, projection, cameraMatrix, distCoeffs,
+      imageSize);
+
+  maps.roi = (Projection::Plane == projection.type)
+      ? footprint(H, imageSize, canvasSize)
+      : footprint(H, projection, imageSize, canvasSize);
+  maps.grid = std::max(grid, 1);
+  maps.maxError = 0;
+  maps.tiles.clear();
+  maps.tilePixels.clear();
+  maps.tileSources.clear();
+  maps.spans.clear();
+  maps.spanRows.clear();
+  maps.map.create(warpMapSize(maps.roi, maps.grid), CV_32FC2);
+
+  if (1 == maps.grid) {
+    for (int y = 0; y < maps.roi.height; ++y) {
+      cv::Vec2f *row = maps.map.ptr<cv::Vec2f>(y);
+      for (int x = 0; x < maps.roi.width; ++x) {
+        if (!toSource(maps.roi.x + x, maps.roi.y + y, true, row[x])) {
+          row[x] = cv::Vec2f(-1, -1);
+        }
+      }
+    }
+    return;
+  }
+
+  // Nodes are not clipped by the undistorted image: pixels are checked
+  // against source bounds after interpolation. Nodes beyond the horizon
+  // turn the whole cell transparent
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  for (int i = 0; i < maps.map.rows; ++i) {
+    cv::Vec2f *row = maps.map.ptr<cv::Vec2f>(i);
+    for (int j = 0; j < maps.map.cols; ++j) {
+      if (!toSource(maps.roi.x + j * maps.grid, maps.roi.y + i * maps.grid,
+          false, row[j])) {
+        row[j] = cv::Vec2f(nan, nan);
+      }
+    }
+  }
+
+  // Measure the error introduced by interpolation over pixels which are
+  // sampled by the kernel
+  std::vector<float> row(2 * maps.roi.width);
+  double maxError = 0;
+  for (int y = 0; y < maps.roi.height; ++y) {
+    interpolateMapRow(maps, y, row.data());
+    for (int x = 0; x < maps.roi.width; ++x) {
+      const float sx = row[2 * x];
+      const float sy = row[2 * x + 1];
+      if (!(sx >= 0 && sy >= 0 && sx <= imageSize.width - 1 &&
+          sy <= imageSize.height - 1)) {
+        continue;
+      }
+
+      cv::Vec2f P;
+      if (toSource(maps.roi.x + x, maps.roi.y + y, false, P)) {
+        maxError = std::max(maxError,
+            (double)std::hypot(P[0] - sx, P[1] - sy));
+      }
+    }
+  }
+  maps.maxError = maxError;
+}
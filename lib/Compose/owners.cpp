@@ -0,0 +1,151 @@
+#include "compose.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+cv::Mat buildOwnerMap(const std::vector<warp_maps_t> &maps,
+    const std::vector<cv::Size> &imageSizes, const cv::Size &canvasSize) {
+  CV_Assert(maps.size() == imageSizes.size() && maps.size() < kNoOwner);
+
+  cv::Mat owners(canvasSize, CV_8UC1, cv::Scalar(kNoOwner));
+  // Normalized squared distance from image center of the source pixel
+  // chosen so far
+  cv::Mat_<float> best(canvasSize, std::numeric_limits<float>::max());
+
+  std::vector<float> row;
+  for (size_t i = 0; i < maps.size(); ++i) {
+    const warp_maps_t &m = maps[i];
+    const float w = (float)imageSizes[i].width;
+    const float h = (float)imageSizes[i].height;
+    row.resize(2 * m.roi.width);
+
+    for (int y = 0; y < m.roi.height; ++y) {
+      const float *map = nullptr;
+      if (m.grid > 1) {
+        interpolateMapRow(m, y, row.data());
+        map = row.data();
+      } else {
+        map = m.map.ptr<float>(y);
+      }
+
+      uint8_t *owner = owners.ptr<uint8_t>(m.roi.y + y) + m.roi.x;
+      float *distance = best[m.roi.y + y] + m.roi.x;
+      for (int x = 0; x < m.roi.width; ++x) {
+        const float u = map[2 * x];
+        const float v = map[2 * x + 1];
+        // the same condition as in remap kernels
+        if (!(u >= 0 && v >= 0 && u <= w - 1 && v <= h - 1)) {
+          continue;
+        }
+        const float du = (u - w / 2) / w;
+        const float dv = (v - h / 2) / h;
+        const float d = du * du + dv * dv;
+        if (d < distance[x]) {
+          distance[x] = d;
+          owner[x] = (uint8_t)i;
+        }
+      }
+    }
+  }
+
+  return owners;
+}
+
+cv::Mat encodeOwnerMap(const cv::Mat &owners) {
+  CV_Assert(owners.type() == CV_8UC1);
+
+  std::vector<cv::Vec2i> runs;
+  for (int y = 0; y < owners.rows; ++y) {
+    const uint8_t *owner = owners.ptr<uint8_t>(y);
+    for (int x = 0; x < owners.cols; ++x) {
+      const int label = (kNoOwner == owner[x]) ? -1 : owner[x];
+      if (!runs.empty() && runs.back()[0] == label) {
+        ++runs.back()[1];
+      } else {
+        runs.push_back(cv::Vec2i(label, 1));
+      }
+    }
+  }
+
+  return cv::Mat(runs, true).reshape(1);
+}
+
+cv::Mat decodeOwnerMap(const cv::Mat &runs, const cv::Size &canvasSize) {
+  cv::Mat owners(canvasSize, CV_8UC1, cv::Scalar(kNoOwner));
+  if (runs.empty()) {
+    return owners;
+  }
+  CV_Assert(runs.type() == CV_32SC1 && runs.cols == 2);
+
+  uint8_t *owner = owners.ptr<uint8_t>();
+  const size_t total = owners.total();
+  size_t offset = 0;
+  for (int i = 0; i < runs.rows && offset < total; ++i) {
+    const int label = runs.at<int>(i, 0);
+    const size_t n = std::min((size_t)std::max(runs.at<int>(i, 1), 0),
+        total - offset);
+    std::fill(owner + offset, owner + offset + n,
+        (label < 0) ? kNoOwner : (uint8_t)label);
+    offset += n;
+  }
+
+  return owners;
+}
+
+void applyOwnerMap(warp_maps_t &maps, const cv::Mat &owners, int camera) {
+  CV_Assert(owners.type() == CV_8UC1);
+
+  maps.spans.clear();
+  maps.spanRows.assign(1, 0);
+  for (int y = 0; y < maps.roi.height; ++y) {
+    const uint8_t *owner = owners.ptr<uint8_t>(maps.roi.y + y) + maps.roi.x;
+    for (int x = 0; x < maps.roi.width; ) {
+      if (owner[x] != camera) {
+        ++x;
+        continue;
+      }
+      map_span_t span = { x, 0 };
+      while (x < maps.roi.width && owner[x] == camera) {
+        ++span.n;
+        ++x;
+      }
+      maps.spans.push_back(span);
+    }
+    maps.spanRows.push_back((int)maps.spans.size());
+  }
+}
+
+void restrictToRows(warp_maps_t &maps, const cv::Range &rows) {
+  if (rows == cv::Range::all()) {
+    return;
+  }
+  const int from = std::min(std::max(rows.start - maps.roi.y, 0),
+      maps.roi.height);
+  const int to = std::min(std::max(rows.end - maps.roi.y, from),
+      maps.roi.height);
+
+  // maps without owner map compose every pixel of roi
+  if (maps.spanRows.empty()) {
+    maps.spans.clear();
+    maps.spanRows.assign(1, 0);
+    for (int y = 0; y < maps.roi.height; ++y) {
+      if (y >= from && y < to && maps.roi.width > 0) {
+        map_span_t span = { 0, maps.roi.width };
+        maps.spans.push_back(span);
+      }
+      maps.spanRows.push_back((int)maps.spans.size());
+    }
+    return;
+  }
+
+  std::vector<map_span_t> spans(maps.spans.begin() + maps.spanRows[from],
+      maps.spans.begin() + maps.spanRows[to]);
+  std::vector<int> spanRows(maps.roi.height + 1);
+  for (int y = 0; y <= maps.roi.height; ++y) {
+    const int row = std::min(std::max(y, from), to);
+    spanRows[y] = maps.spanRows[row] - maps.spanRows[from];
+  }
+  maps.spans.swap(spans);
+  maps.spanRows.swap(spanRows);
+}
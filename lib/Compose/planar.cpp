@@ -0,0 +1,161 @@
+#include "compose.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <vector>
+
+void splitNV12(const cv::Mat &nv12, cv::Mat &luma, cv::Mat &chroma) {
+  CV_Assert(nv12.type() == CV_8UC1 && nv12.rows % 3 == 0 &&
+      nv12.cols % 2 == 0);
+
+  const int height = nv12.rows / 3 * 2;
+  luma = nv12.rowRange(0, height);
+  chroma = cv::Mat(height / 2, nv12.cols / 2, CV_8UC2,
+      (void*)nv12.ptr(height), nv12.step);
+}
+
+cv::Size nv12ImageSize(const cv::Mat &nv12) {
+  return cv::Size(nv12.cols, nv12.rows / 3 * 2);
+}
+
+cv::Mat createNV12Canvas(const cv::Size &size) {
+  const cv::Size even((size.width + 1) & ~1, (size.height + 1) & ~1);
+  cv::Mat canvas(even.height / 2 * 3, even.width, CV_8UC1);
+  cv::Mat luma, chroma;
+  splitNV12(canvas, luma, chroma);
+  luma.setTo(cv::Scalar::all(0));
+  chroma.setTo(cv::Scalar::all(128));
+  return canvas;
+}
+
+void convertBGRToNV12(const cv::Mat &bgr, cv::Mat &nv12) {
+  CV_Assert(bgr.type() == CV_8UC3 && bgr.cols % 2 == 0 &&
+      bgr.rows % 2 == 0);
+
+  // OpenCV converts to I420 only: U and V planes follow the luma one
+  cv::Mat i420;
+  cv::cvtColor(bgr, i420, CV_BGR2YUV_I420);
+  const int half = bgr.rows / 2;
+  cv::Mat u(half, bgr.cols / 2, CV_8UC1, i420.ptr(bgr.rows));
+  cv::Mat v(half, bgr.cols / 2, CV_8UC1, i420.ptr(bgr.rows) + u.total());
+
+  nv12.create(i420.size(), CV_8UC1);
+  cv::Mat luma, chroma;
+  splitNV12(nv12, luma, chroma);
+  i420.rowRange(0, bgr.rows).copyTo(luma);
+  const cv::Mat planes[] = { u, v };
+  cv::merge(planes, 2, chroma);
+}
+
+void convertNV12ToBGR(const cv::Mat &nv12, cv::Mat &bgr) {
+  cv::cvtColor(nv12, bgr, CV_YUV2BGR_NV12);
+}
+
+float lumaGain(const cv::Vec3f &gain) {
+  return 0.114f * gain[0] + 0.587f * gain[1] + 0.299f * gain[2];
+}
+
+void buildChromaMaps(const warp_maps_t &luma, const cv::Size &imageSize,
+    warp_maps_t &chroma) {
+  const int x0 = luma.roi.x / 2;
+  const int y0 = luma.roi.y / 2;
+  const int x1 = (luma.roi.x + luma.roi.width + 1) / 2;
+  const int y1 = (luma.roi.y + luma.roi.height + 1) / 2;
+
+  chroma = warp_maps_t();
+  chroma.roi = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+  chroma.map.create(chroma.roi.size(), CV_32FC2);
+
+  const float maxX = (float)(imageSize.width - 1);
+  const float maxY = (float)(imageSize.height - 1);
+  const float maxChromaX = (float)(imageSize.width / 2 - 1);
+  const float maxChromaY = (float)(imageSize.height / 2 - 1);
+
+  // A chroma sample covers 2x2 luma pixels: its source is the center of
+  // their sources, expressed in chroma plane coordinates
+  std::vector<float> buffers[2] = {
+    std::vector<float>(luma.grid > 1 ? 2 * luma.roi.width : 0),
+    std::vector<float>(luma.grid > 1 ? 2 * luma.roi.width : 0)
+  };
+  const float *rows[2];
+  for (int cy = 0; cy < chroma.roi.height; ++cy) {
+    for (int k = 0; k < 2; ++k) {
+      const int ly = 2 * (y0 + cy) + k - luma.roi.y;
+      if (ly < 0 || ly >= luma.roi.height) {
+        rows[k] = nullptr;
+      } else if (luma.grid > 1) {
+        interpolateMapRow(luma, ly, buffers[k].data());
+        rows[k] = buffers[k].data();
+      } else {
+        rows[k] = luma.map.ptr<float>(ly);
+      }
+    }
+
+    cv::Vec2f *out = chroma.map.ptr<cv::Vec2f>(cy);
+    for (int cx = 0; cx < chroma.roi.width; ++cx) {
+      float sumX = 0, sumY = 0;
+      int count = 0;
+      for (int k = 0; k < 2; ++k) {
+        for (int j = 0; j < 2 && rows[k]; ++j) {
+          const int lx = 2 * (x0 + cx) + j - luma.roi.x;
+          if (lx < 0 || lx >= luma.roi.width) {
+            continue;
+          }
+          const float sx = rows[k][2 * lx];
+          const float sy = rows[k][2 * lx + 1];
+          if (sx >= 0 && sy >= 0 && sx <= maxX && sy <= maxY) {
+            sumX += sx;
+            sumY += sy;
+            ++count;
+          }
+        }
+      }
+
+      if (0 == count) {
+        out[cx] = cv::Vec2f(-1, -1);
+        continue;
+      }
+      const float sx = (sumX / count - 0.5f) / 2;
+      const float sy = (sumY / count - 0.5f) / 2;
+      out[cx] = cv::Vec2f(std::min(std::max(sx, 0.0f), maxChromaX),
+          std::min(std::max(sy, 0.0f), maxChromaY));
+    }
+  }
+}
+
+cv::Mat halveOwnerMap(const cv::Mat &owners) {
+  CV_Assert(owners.type() == CV_8UC1);
+
+  cv::Mat half((owners.rows + 1) / 2, (owners.cols + 1) / 2, CV_8UC1);
+  for (int y = 0; y < half.rows; ++y) {
+    const uint8_t *owner = owners.ptr<uint8_t>(2 * y);
+    uint8_t *out = half.ptr<uint8_t>(y);
+    for (int x = 0; x < half.cols; ++x) {
+      out[x] = owner[2 * x];
+    }
+  }
+  return half;
+}
+
+void remapTransparentNV12(const cv::Mat &src, const warp_maps_t &luma,
+    const warp_maps_t &chroma, float gain, cv::Mat &canvas,
+    const remap_kernel_t &lumaKernel, const remap_kernel_t &chromaKernel) {
+  cv::Mat srcLuma, srcChroma;
+  cv::Mat canvasLuma, canvasChroma;
+  splitNV12(src, srcLuma, srcChroma);
+  splitNV12(canvas, canvasLuma, canvasChroma);
+
+  // gains equalize brightness, colors are left as they are
+  remapTransparent(srcLuma, luma, cv::Vec3f(gain, gain, gain), canvasLuma,
+      lumaKernel);
+  remapTransparent(srcChroma, chroma, cv::Vec3f(1, 1, 1), canvasChroma,
+      chromaKernel);
+}
+
+void remapTransparentNV12(const cv::Mat &src, const warp_maps_t &luma,
+    const warp_maps_t &chroma, float gain, cv::Mat &canvas,
+    RemapKernel kernel) {
+  remapTransparentNV12(src, luma, chroma, gain, canvas,
+      selectRemapKernel(CV_8UC1, kernel), selectRemapKernel(CV_8UC2, kernel));
+}
@@ -0,0 +1,152 @@
+#include "compose.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+// Points sampled along each side of an image to find its footprint
+const int kBorderSamples = 32;
+// Heights on the cylinder grow without a bound towards its axis, footprints
+// are cut at this latitude
+const double kMaxCylinderLatitude = 75 * CV_PI / 180;
+// Canvases larger than that on a side are a calibration gone wrong
+const double kMaxCanvasSide = 1 << 20;
+
+cv::Mat_<double> referenceMatrix(const cv::Mat &cameraMatrix,
+    const cv::Size &imageSize) {
+  cv::Mat_<double> K;
+  if (!cameraMatrix.empty()) {
+    cameraMatrix.convertTo(K, CV_64F);
+    return K;
+  }
+
+  const double f = std::max(imageSize.width, imageSize.height);
+  K = (cv::Mat_<double>(3, 3) <<
+      f, 0, imageSize.width / 2.0,
+      0, f, imageSize.height / 2.0,
+      0, 0, 1);
+  return K;
+}
+
+cv::Vec3d multiply(const cv::Mat_<double> &M, const cv::Vec3d &p) {
+  return cv::Vec3d(
+      M(0, 0) * p[0] + M(0, 1) * p[1] + M(0, 2) * p[2],
+      M(1, 0) * p[0] + M(1, 1) * p[1] + M(1, 2) * p[2],
+      M(2, 0) * p[0] + M(2, 1) * p[1] + M(2, 2) * p[2]);
+}
+
+}
+
+cv::Vec3d canvasDirection(const projection_t &projection, double u,
+    double v) {
+  const double longitude = projection.origin.x + u / projection.scale;
+  const double y = projection.origin.y + v / projection.scale;
+  if (Projection::Spherical == projection.type) {
+    return cv::Vec3d(sin(longitude) * cos(y), sin(y),
+        cos(longitude) * cos(y));
+  }
+  return cv::Vec3d(sin(longitude), y, cos(longitude));
+}
+
+cv::Point2d directionToCanvas(const projection_t &projection,
+    const cv::Vec3d &direction) {
+  const double horizontal = std::hypot(direction[0], direction[2]);
+  const double longitude = atan2(direction[0], direction[2]);
+  const double y = (Projection::Spherical == projection.type)
+      ? atan2(direction[1], horizontal) : direction[1] / horizontal;
+  return cv::Point2d((longitude - projection.origin.x) * projection.scale,
+      (y - projection.origin.y) * projection.scale);
+}
+
+cv::Mat_<double> directionsToImage(const cv::Mat &H,
+    const projection_t &projection, const cv::Size &imageSize) {
+  cv::Mat_<double> h;
+  H.convertTo(h, CV_64F);
+  cv::Mat_<double> G = cv::Mat_<double>(h.inv() * projection.P);
+
+  // Homographies are defined up to a scale, so the matrix may take the
+  // camera to look backwards
+  const cv::Vec3d center(imageSize.width / 2.0, imageSize.height / 2.0, 1);
+  if (multiply(cv::Mat_<double>(G.inv()), center)[2] < 0) {
+    G = -G;
+  }
+  return G;
+}
+
+void projectedBounds(const cv::Mat &H, const projection_t &projection,
+    const cv::Size &imageSize, cv::Point2d &low, cv::Point2d &high) {
+  const cv::Mat_<double> toDirection(
+      directionsToImage(H, projection, imageSize).inv());
+
+  // Edges of the image are curves on the canvas, so they are sampled
+  // densely
+  low = cv::Point2d(HUGE_VAL, HUGE_VAL);
+  high = cv::Point2d(-HUGE_VAL, -HUGE_VAL);
+  const double w = imageSize.width;
+  const double h = imageSize.height;
+  for (int k = 0; k <= kBorderSamples; ++k) {
+    const double t = (double)k / kBorderSamples;
+    const cv::Vec3d border[] = { cv::Vec3d(t * w, 0, 1),
+        cv::Vec3d(t * w, h, 1), cv::Vec3d(0, t * h, 1),
+        cv::Vec3d(w, t * h, 1) };
+    for (const cv::Vec3d &p : border) {
+      const cv::Vec3d direction = multiply(toDirection, p);
+      if (0 == cv::norm(direction)) {
+        continue;
+      }
+      cv::Point2d P = directionToCanvas(projection, direction);
+      if (Projection::Cylindrical == projection.type) {
+        const double height = tan(kMaxCylinderLatitude);
+        P.y = std::min(std::max(P.y,
+            (-height - projection.origin.y) * projection.scale),
+            (height - projection.origin.y) * projection.scale);
+      }
+      if (!std::isfinite(P.x) || !std::isfinite(P.y)) {
+        continue;
+      }
+      low = cv::Point2d(std::min(low.x, P.x), std::min(low.y, P.y));
+      high = cv::Point2d(std::max(high.x, P.x), std::max(high.y, P.y));
+    }
+  }
+}
+
+bool fitProjection(Projection type, const std::vector<cv::Mat> &H,
+    const cv::Mat &cameraMatrix, const std::vector<cv::Size> &imageSizes,
+    projection_t &projection, cv::Size &canvasSize) {
+  CV_Assert(Projection::Plane != type && !H.empty() &&
+      H.size() == imageSizes.size());
+
+  const cv::Mat_<double> K = referenceMatrix(cameraMatrix, imageSizes[0]);
+  cv::Mat_<double> H0;
+  H[0].convertTo(H0, CV_64F);
+
+  projection = projection_t();
+  projection.type = type;
+  projection.P = H0 * K;
+  projection.scale = K(0, 0);
+  if (!std::isfinite(projection.scale) || projection.scale <= 0) {
+    return false;
+  }
+
+  // Footprints are measured with the origin at the zero angles first
+  cv::Point2d low(HUGE_VAL, HUGE_VAL), high(-HUGE_VAL, -HUGE_VAL);
+  for (size_t i = 0; i < H.size(); ++i) {
+    cv::Point2d from, to;
+    projectedBounds(H[i], projection, imageSizes[i], from, to);
+    // no point of the image has a direction on the canvas
+    if (from.x > to.x || from.y > to.y) {
+      return false;
+    }
+    low = cv::Point2d(std::min(low.x, from.x), std::min(low.y, from.y));
+    high = cv::Point2d(std::max(high.x, to.x), std::max(high.y, to.y));
+  }
+
+  if (high.x - low.x > kMaxCanvasSide || high.y - low.y > kMaxCanvasSide) {
+    return false;
+  }
+  projection.origin = low * (1.0 / projection.scale);
+  canvasSize = cv::Size((int)ceil(high.x - low.x) + 1,
+      (int)ceil(high.y - low.y) + 1);
+  return true;
+}
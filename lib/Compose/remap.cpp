@@ -0,0 +1,251 @@
+#include "compose.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+// Scalar instantiation for the type, nullptr if there is none
+remap_row_fn_t scalarKernel(int type) {
+  switch (type) {
+    case CV_8UC1: return remapRowScalarT<uint8_t, 1>;
+    case CV_8UC2: return remapRowScalarT<uint8_t, 2>;
+    case CV_8UC3: return remapRowScalarT<uint8_t, 3>;
+    case CV_8UC4: return remapRowScalarT<uint8_t, 4>;
+    case CV_16UC1: return remapRowScalarT<uint16_t, 1>;
+    default: return nullptr;
+  }
+}
+
+// SIMD instantiation of the kernel for CN channels of 8-bit pixels
+template <int CN>
+remap_row_fn_t simdKernelT(RemapKernel kernel) {
+  switch (kernel) {
+#ifdef HAVE_AVX512
+    case RemapKernel::AVX512: return remapRowAVX512<CN>;
+#endif
+#ifdef HAVE_AVX2
+    case RemapKernel::AVX2: return remapRowAVX2<CN>;
+#endif
+#ifdef HAVE_SSE42
+    case RemapKernel::SSE42: return remapRowSSE42<CN>;
+#endif
+    default: return nullptr;
+  }
+}
+
+// SIMD kernel for the type, nullptr if there is none
+remap_row_fn_t simdKernel(int type, RemapKernel kernel) {
+  switch (type) {
+    case CV_8UC1:
+      // without gathers SSE loads pixels one by one, for single bytes it is
+      // not faster than the scalar kernel
+      return RemapKernel::SSE42 == kernel ? nullptr : simdKernelT<1>(kernel);
+    case CV_8UC2: return simdKernelT<2>(kernel);
+    case CV_8UC3: return simdKernelT<3>(kernel);
+    default: return nullptr;
+  }
+}
+
+class RemapTransparentBody : public cv::ParallelLoopBody {
+ public:
+  RemapTransparentBody(const cv::Mat &src, const warp_maps_t &maps,
+      const std::vector<int> *selection, const cv::Vec3f &gain,
+      cv::Mat &canvas, remap_row_fn_t kernel)
+      : maps(maps), selection(selection), canvas(canvas), kernel(kernel),
+      pixelSize(src.elemSize()) {
+    source.data = src.data;
+    source.step = src.step;
+    source.cols = src.cols;
+    source.rows = src.rows;
+    // single channel images are brightness only, alpha is kept as it is
+    if (1 == src.channels()) {
+      this->gain[0] = lumaGain(gain);
+    } else {
+      for (int c = 0; c < 3; ++c) {
+        this->gain[c] = gain[c];
+      }
+    }
+    this->gain[3] = 1;
+  }
+
+  // range is a range of selected tiles, of all tiles or, if there are no
+  // tiles, of roi rows
+  void operator()(const cv::Range &range) const override {
+    // Coordinates interpolated from the sparse map are expanded one row at
+    // a time, so they stay in L1 cache until the kernel consumes them
+    std::vector<float> row(maps.grid > 1 ? 2 * maps.roi.width : 0);
+
+    for (int i = range.start; i < range.end; ++i) {
+      const cv::Rect area = selection ? maps.tiles[(*selection)[i]]
+          : maps.tiles.empty() ? cv::Rect(0, i, maps.roi.width, 1)
+          : maps.tiles[i];
+      for (int y = area.y; y < area.y + area.height; ++y) {
+        if (maps.spanRows.empty()) {
+          remapSpan(y, area.x, area.width, row.data());
+          continue;
+        }
+        for (int s = maps.spanRows[y]; s < maps.spanRows[y + 1]; ++s) {
+          const int from = std::max(maps.spans[s].x, area.x);
+          const int to = std::min(maps.spans[s].x + maps.spans[s].n,
+              area.x + area.width);
+          if (from < to) {
+            remapSpan(y, from, to - from, row.data());
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  // Compose n pixels starting from (x, y) of roi
+  void remapSpan(int y, int x, int n, float *row) const {
+    const float *map = nullptr;
+    if (maps.grid > 1) {
+      interpolateMapRow(maps, y, x, n, row);
+      map = row;
+    } else {
+      map = maps.map.ptr<float>(y) + 2 * x;
+    }
+    kernel(source, map, gain,
+        canvas.ptr<uint8_t>(maps.roi.y + y) + pixelSize * (maps.roi.x + x),
+        n);
+  }
+
+  remap_source_t source;
+  const warp_maps_t &maps;
+  const std::vector<int> *selection;
+  float gain[4];
+  cv::Mat &canvas;
+  remap_row_fn_t kernel;
+  const size_t pixelSize;
+};
+
+}
+
+bool isRemapKernelSupported(RemapKernel kernel) {
+  switch (kernel) {
+    case RemapKernel::Auto:
+    case RemapKernel::Scalar:
+      return true;
+#if defined(HAVE_SSE42) && defined(__GNUC__)
+    case RemapKernel::SSE42:
+      return __builtin_cpu_supports("sse4.2");
+#endif
+#if defined(HAVE_AVX2) && defined(__GNUC__)
+    case RemapKernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+#if defined(HAVE_AVX512) && defined(__GNUC__)
+    case RemapKernel::AVX512:
+      return __builtin_cpu_supports("avx512f") &&
+          __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+      return false;
+  }
+}
+
+RemapKernel bestRemapKernel() {
+  static const RemapKernel best = []() {
+    const RemapKernel candidates[] = { RemapKernel::AVX512, RemapKernel::AVX2,
+        RemapKernel::SSE42 };
+    for (RemapKernel kernel : candidates) {
+      if (isRemapKernelSupported(kernel)) {
+        return kernel;
+      }
+    }
+    return RemapKernel::Scalar;
+  }();
+
+  return best;
+}
+
+bool isRemapTypeSupported(int type) {
+  return scalarKernel(type) != nullptr;
+}
+
+remap_kernel_t selectRemapKernel(int type, RemapKernel kernel) {
+  CV_Assert(isRemapTypeSupported(type) && isRemapKernelSupported(kernel));
+  if (RemapKernel::Auto == kernel) {
+    kernel = bestRemapKernel();
+  }
+
+  remap_kernel_t selected;
+  selected.type = type;
+  selected.kernel = kernel;
+  selected.row = simdKernel(type, kernel);
+  if (!selected.row) {
+    // SIMD kernels are written for 8UC1, 8UC2 and 8UC3 pixels only
+    selected.kernel = RemapKernel::Scalar;
+    selected.row = scalarKernel(type);
+  }
+  return selected;
+}
+
+const char *remapKernelName(RemapKernel kernel) {
+  switch (kernel) {
+    case RemapKernel::Auto: return "auto";
+    case RemapKernel::Scalar: return "scalar";
+    case RemapKernel::SSE42: return "sse42";
+    case RemapKernel::AVX2: return "avx2";
+    case RemapKernel::AVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+namespace {
+
+// selection is nullptr when all of roi is composed
+void remapSelection(const cv::Mat &src, const warp_maps_t &maps,
+    const std::vector<int> *selection, const cv::Vec3f &gain,
+    cv::Mat &canvas, const remap_kernel_t &kernel) {
+  CV_Assert(kernel.row && src.type() == kernel.type &&
+      canvas.type() == kernel.type);
+  CV_Assert(maps.map.type() == CV_32FC2 &&
+      maps.map.size() == warpMapSize(maps.roi, maps.grid));
+  CV_Assert(maps.spanRows.empty() ||
+      maps.spanRows.size() == (size_t)maps.roi.height + 1);
+  // maps built for another canvas would write past this one
+  CV_Assert((maps.roi & cv::Rect(0, 0, canvas.cols, canvas.rows)) ==
+      maps.roi);
+
+  if (!maps.spanRows.empty() && maps.spans.empty()) {
+    return; // the camera owns no pixels
+  }
+
+  const int items = selection ? (int)selection->size()
+      : maps.tiles.empty() ? maps.roi.height : (int)maps.tiles.size();
+  cv::parallel_for_(cv::Range(0, items), RemapTransparentBody(src, maps,
+      selection, gain, canvas, kernel.row));
+}
+
+}
+
+void remapTransparent(const cv::Mat &src, const warp_maps_t &maps,
+    const cv::Vec3f &gain, cv::Mat &canvas, const remap_kernel_t &kernel) {
+  remapSelection(src, maps, nullptr, gain, canvas, kernel);
+}
+
+void remapTransparent(const cv::Mat &src, const warp_maps_t &maps,
+    const cv::Vec3f &gain, cv::Mat &canvas, RemapKernel kernel) {
+  remapSelection(src, maps, nullptr, gain, canvas,
+      selectRemapKernel(src.type(), kernel));
+}
+
+void remapTransparentTiles(const cv::Mat &src, const warp_maps_t &maps,
+    const std::vector<int> &tiles, const cv::Vec3f &gain, cv::Mat &canvas,
+    const remap_kernel_t &kernel) {
+  for (int t : tiles) {
+    CV_Assert(t >= 0 && t < (int)maps.tiles.size());
+  }
+  remapSelection(src, maps, &tiles, gain, canvas, kernel);
+}
+
+void remapTransparentTiles(const cv::Mat &src, const warp_maps_t &maps,
+    const std::vector<int> &tiles, const cv::Vec3f &gain, cv::Mat &canvas,
+    RemapKernel kernel) {
+  remapTransparentTiles(src, maps, tiles, gain, canvas,
+      selectRemapKernel(src.type(), kernel));
+}
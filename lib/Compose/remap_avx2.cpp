@@ -0,0 +1,160 @@
+#include "kernels.hpp"
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace {
+
+// SIMD gathers read 4 bytes per pixel of up to 3 bytes. Offsets beyond the last
+// readable one are moved back and the loaded value is shifted to compensate
+inline __m256i gatherPixels(const uint8_t *base, __m256i offset,
+    __m256i limit) {
+  __m256i clamped = _mm256_min_epi32(offset, limit);
+  __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(offset, clamped), 3);
+  return _mm256_srlv_epi32(
+      _mm256_i32gather_epi32((const int *)base, clamped, 1), shift);
+}
+
+template <int C>
+inline __m256 channel(__m256i pixels) {
+  return _mm256_cvtepi32_ps(_mm256_and_si256(
+      _mm256_srli_epi32(pixels, 8 * C), _mm256_set1_epi32(0xFF)));
+}
+
+template <int C>
+inline __m256i interpolate(__m256i p00, __m256i p01, __m256i p10,
+    __m256i p11, __m256 ax, __m256 ay, __m256 gain) {
+  __m256 v00 = channel<C>(p00);
+  __m256 v10 = channel<C>(p10);
+  __m256 top = _mm256_add_ps(v00,
+      _mm256_mul_ps(ax, _mm256_sub_ps(channel<C>(p01), v00)));
+  __m256 bottom = _mm256_add_ps(v10,
+      _mm256_mul_ps(ax, _mm256_sub_ps(channel<C>(p11), v10)));
+  __m256 v = _mm256_mul_ps(_mm256_add_ps(top,
+      _mm256_mul_ps(ay, _mm256_sub_ps(bottom, top))), gain);
+
+  __m256i result = _mm256_cvtps_epi32(v);
+  result = _mm256_max_epi32(result, _mm256_setzero_si256());
+  result = _mm256_min_epi32(result, _mm256_set1_epi32(255));
+  return _mm256_slli_epi32(result, 8 * C);
+}
+
+// Shuffle taking the first CN bytes of each pixel inside each 128-bit lane
+// and the permutation joining the lanes, so 8 pixels occupy the first
+// 8 * CN bytes
+template <int CN>
+inline void compactPixels(__m256i &compact, __m256i &join) {
+  alignas(32) int8_t bytes[32];
+  memset(bytes, -1, sizeof(bytes));
+  alignas(32) int32_t dwords[8] = { 7, 7, 7, 7, 7, 7, 7, 7 };
+  for (int lane = 0; lane < 2; ++lane) {
+    for (int i = 0; i < 4; ++i) {
+      for (int c = 0; c < CN; ++c) {
+        bytes[16 * lane + CN * i + c] = (int8_t)(4 * i + c);
+      }
+    }
+    for (int d = 0; d < CN; ++d) {
+      dwords[CN * lane + d] = 4 * lane + d;
+    }
+  }
+  compact = _mm256_load_si256((const __m256i *)bytes);
+  join = _mm256_load_si256((const __m256i *)dwords);
+}
+
+}
+
+template <int CN>
+void remapRowAVX2(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 maxX = _mm256_set1_ps((float)(src.cols - 1));
+  const __m256 maxY = _mm256_set1_ps((float)(src.rows - 1));
+  const __m256i maxXi = _mm256_set1_epi32(src.cols - 1);
+  const __m256i maxYi = _mm256_set1_epi32(src.rows - 1);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i channels = _mm256_set1_epi32(CN);
+  const __m256i step = _mm256_set1_epi32((int)src.step);
+  const __m256i limit = _mm256_set1_epi32(
+      (src.rows - 1) * (int)src.step + CN * src.cols - 4);
+  const __m256 g0 = _mm256_set1_ps(gain[0]);
+  const __m256 g1 = _mm256_set1_ps(gain[1]);
+  const __m256 g2 = _mm256_set1_ps(gain[2]);
+
+  __m256i compact, join;
+  compactPixels<CN>(compact, join);
+
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    // x0 y0 x1 y1 ... -> x0 x1 ... and y0 y1 ...
+    __m256 a = _mm256_loadu_ps(map + 2 * x);
+    __m256 b = _mm256_loadu_ps(map + 2 * x + 8);
+    __m256 sx = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(
+        _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+        _MM_SHUFFLE(3, 1, 2, 0)));
+    __m256 sy = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(
+        _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+        _MM_SHUFFLE(3, 1, 2, 0)));
+
+    __m256 valid = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(sx, zero, _CMP_GE_OQ),
+            _mm256_cmp_ps(sy, zero, _CMP_GE_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(sx, maxX, _CMP_LE_OQ),
+            _mm256_cmp_ps(sy, maxY, _CMP_LE_OQ)));
+    if (0 == _mm256_movemask_ps(valid)) {
+      continue;
+    }
+    __m256i mask = _mm256_castps_si256(valid);
+
+    // invalid lanes read the first pixel of the image
+    __m256i x0 = _mm256_and_si256(_mm256_cvttps_epi32(sx), mask);
+    __m256i y0 = _mm256_and_si256(_mm256_cvttps_epi32(sy), mask);
+    __m256 ax = _mm256_sub_ps(sx, _mm256_cvtepi32_ps(x0));
+    __m256 ay = _mm256_sub_ps(sy, _mm256_cvtepi32_ps(y0));
+    __m256i x1 = _mm256_min_epi32(_mm256_add_epi32(x0, one), maxXi);
+    __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, one), maxYi);
+
+    __m256i r0 = _mm256_mullo_epi32(y0, step);
+    __m256i r1 = _mm256_mullo_epi32(y1, step);
+    __m256i c0 = _mm256_mullo_epi32(x0, channels);
+    __m256i c1 = _mm256_mullo_epi32(x1, channels);
+    __m256i p00 = gatherPixels(src.data, _mm256_add_epi32(r0, c0), limit);
+    __m256i p01 = gatherPixels(src.data, _mm256_add_epi32(r0, c1), limit);
+    __m256i p10 = gatherPixels(src.data, _mm256_add_epi32(r1, c0), limit);
+    __m256i p11 = gatherPixels(src.data, _mm256_add_epi32(r1, c1), limit);
+
+    __m256i pixels = interpolate<0>(p00, p01, p10, p11, ax, ay, g0);
+    if (CN > 1) {
+      pixels = _mm256_or_si256(pixels,
+          interpolate<1>(p00, p01, p10, p11, ax, ay, g1));
+    }
+    if (CN > 2) {
+      pixels = _mm256_or_si256(pixels,
+          interpolate<2>(p00, p01, p10, p11, ax, ay, g2));
+    }
+
+    __m256i packed = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(pixels, compact), join);
+    __m256i bytes = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(mask, compact), join);
+
+    // keep canvas pixels which have no source, only 8 * CN bytes belong to
+    // this block
+    uint8_t *out = dst + CN * x;
+    alignas(32) uint8_t block[32];
+    memcpy(block, out, 8 * CN);
+    __m256i old = _mm256_load_si256((const __m256i *)block);
+    _mm256_store_si256((__m256i *)block,
+        _mm256_blendv_epi8(old, packed, bytes));
+    memcpy(out, block, 8 * CN);
+  }
+
+  remapRowScalarT<uint8_t, CN>(src, map + 2 * x, gain, dst + CN * x, n - x);
+}
+
+template void remapRowAVX2<1>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowAVX2<2>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowAVX2<3>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
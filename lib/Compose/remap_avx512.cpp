@@ -0,0 +1,158 @@
+#include "kernels.hpp"
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace {
+
+// SIMD gathers read 4 bytes per pixel of up to 3 bytes. Offsets beyond the last
+// readable one are moved back and the loaded value is shifted to compensate
+inline __m512i gatherPixels(const uint8_t *base, __mmask16 valid,
+    __m512i offset, __m512i limit) {
+  __m512i clamped = _mm512_min_epi32(offset, limit);
+  __m512i shift = _mm512_slli_epi32(_mm512_sub_epi32(offset, clamped), 3);
+  return _mm512_srlv_epi32(_mm512_mask_i32gather_epi32(
+      _mm512_setzero_si512(), valid, clamped, base, 1), shift);
+}
+
+template <int C>
+inline __m512 channel(__m512i pixels) {
+  return _mm512_cvtepi32_ps(_mm512_and_si512(
+      _mm512_srli_epi32(pixels, 8 * C), _mm512_set1_epi32(0xFF)));
+}
+
+template <int C>
+inline __m512i interpolate(__m512i p00, __m512i p01, __m512i p10,
+    __m512i p11, __m512 ax, __m512 ay, __m512 gain) {
+  __m512 v00 = channel<C>(p00);
+  __m512 v10 = channel<C>(p10);
+  __m512 top = _mm512_add_ps(v00,
+      _mm512_mul_ps(ax, _mm512_sub_ps(channel<C>(p01), v00)));
+  __m512 bottom = _mm512_add_ps(v10,
+      _mm512_mul_ps(ax, _mm512_sub_ps(channel<C>(p11), v10)));
+  __m512 v = _mm512_mul_ps(_mm512_add_ps(top,
+      _mm512_mul_ps(ay, _mm512_sub_ps(bottom, top))), gain);
+
+  __m512i result = _mm512_cvtps_epi32(v);
+  result = _mm512_max_epi32(result, _mm512_setzero_si512());
+  result = _mm512_min_epi32(result, _mm512_set1_epi32(255));
+  return _mm512_slli_epi32(result, 8 * C);
+}
+
+// Shuffle taking the first CN bytes of each pixel inside each 128-bit lane
+// and the permutation joining the lanes, so 16 pixels occupy the first
+// 16 * CN bytes and the rest is zero
+template <int CN>
+inline void compactPixels(__m512i &compact, __m512i &join) {
+  alignas(16) int8_t bytes[16];
+  memset(bytes, -1, sizeof(bytes));
+  for (int i = 0; i < 4; ++i) {
+    for (int c = 0; c < CN; ++c) {
+      bytes[CN * i + c] = (int8_t)(4 * i + c);
+    }
+  }
+  alignas(64) int32_t dwords[16];
+  for (int d = 0; d < 16; ++d) {
+    dwords[d] = 15;
+  }
+  for (int lane = 0; lane < 4; ++lane) {
+    for (int d = 0; d < CN; ++d) {
+      dwords[CN * lane + d] = 4 * lane + d;
+    }
+  }
+  compact = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *)bytes));
+  join = _mm512_load_si512(dwords);
+}
+
+}
+
+template <int CN>
+void remapRowAVX512(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n) {
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 maxX = _mm512_set1_ps((float)(src.cols - 1));
+  const __m512 maxY = _mm512_set1_ps((float)(src.rows - 1));
+  const __m512i maxXi = _mm512_set1_epi32(src.cols - 1);
+  const __m512i maxYi = _mm512_set1_epi32(src.rows - 1);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i channels = _mm512_set1_epi32(CN);
+  const __m512i step = _mm512_set1_epi32((int)src.step);
+  const __m512i limit = _mm512_set1_epi32(
+      (src.rows - 1) * (int)src.step + CN * src.cols - 4);
+  const __m512 g0 = _mm512_set1_ps(gain[0]);
+  const __m512 g1 = _mm512_set1_ps(gain[1]);
+  const __m512 g2 = _mm512_set1_ps(gain[2]);
+
+  const __m512i evens = _mm512_setr_epi32(
+      0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i odds = _mm512_setr_epi32(
+      1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+
+  __m512i compact, join;
+  compactPixels<CN>(compact, join);
+
+  int x = 0;
+  for (; x + 16 <= n; x += 16) {
+    // x0 y0 x1 y1 ... -> x0 x1 ... and y0 y1 ...
+    __m512 a = _mm512_loadu_ps(map + 2 * x);
+    __m512 b = _mm512_loadu_ps(map + 2 * x + 16);
+    __m512 sx = _mm512_permutex2var_ps(a, evens, b);
+    __m512 sy = _mm512_permutex2var_ps(a, odds, b);
+
+    __mmask16 valid = _mm512_cmp_ps_mask(sx, zero, _CMP_GE_OQ);
+    valid = _mm512_mask_cmp_ps_mask(valid, sy, zero, _CMP_GE_OQ);
+    valid = _mm512_mask_cmp_ps_mask(valid, sx, maxX, _CMP_LE_OQ);
+    valid = _mm512_mask_cmp_ps_mask(valid, sy, maxY, _CMP_LE_OQ);
+    if (0 == valid) {
+      continue;
+    }
+
+    __m512i x0 = _mm512_maskz_cvttps_epi32(valid, sx);
+    __m512i y0 = _mm512_maskz_cvttps_epi32(valid, sy);
+    __m512 ax = _mm512_sub_ps(sx, _mm512_cvtepi32_ps(x0));
+    __m512 ay = _mm512_sub_ps(sy, _mm512_cvtepi32_ps(y0));
+    __m512i x1 = _mm512_min_epi32(_mm512_add_epi32(x0, one), maxXi);
+    __m512i y1 = _mm512_min_epi32(_mm512_add_epi32(y0, one), maxYi);
+
+    __m512i r0 = _mm512_mullo_epi32(y0, step);
+    __m512i r1 = _mm512_mullo_epi32(y1, step);
+    __m512i c0 = _mm512_mullo_epi32(x0, channels);
+    __m512i c1 = _mm512_mullo_epi32(x1, channels);
+    __m512i p00 = gatherPixels(src.data, valid,
+        _mm512_add_epi32(r0, c0), limit);
+    __m512i p01 = gatherPixels(src.data, valid,
+        _mm512_add_epi32(r0, c1), limit);
+    __m512i p10 = gatherPixels(src.data, valid,
+        _mm512_add_epi32(r1, c0), limit);
+    __m512i p11 = gatherPixels(src.data, valid,
+        _mm512_add_epi32(r1, c1), limit);
+
+    __m512i pixels = interpolate<0>(p00, p01, p10, p11, ax, ay, g0);
+    if (CN > 1) {
+      pixels = _mm512_or_si512(pixels,
+          interpolate<1>(p00, p01, p10, p11, ax, ay, g1));
+    }
+    if (CN > 2) {
+      pixels = _mm512_or_si512(pixels,
+          interpolate<2>(p00, p01, p10, p11, ax, ay, g2));
+    }
+    __m512i packed = _mm512_permutexvar_epi32(join,
+        _mm512_shuffle_epi8(pixels, compact));
+
+    // store only bytes of the pixels which have source
+    __m512i mask = _mm512_maskz_mov_epi32(valid, _mm512_set1_epi32(-1));
+    __mmask64 bytes = _mm512_movepi8_mask(_mm512_permutexvar_epi32(join,
+        _mm512_shuffle_epi8(mask, compact)));
+    _mm512_mask_storeu_epi8(dst + CN * x, bytes, packed);
+  }
+
+  remapRowScalarT<uint8_t, CN>(src, map + 2 * x, gain, dst + CN * x, n - x);
+}
+
+template void remapRowAVX512<1>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowAVX512<2>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowAVX512<3>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
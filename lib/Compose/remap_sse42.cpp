@@ -0,0 +1,147 @@
+#include "kernels.hpp"
+
+#include <nmmintrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// There are no gathers in SSE, so pixels are loaded one by one. Each load
+// reads 4 bytes per pixel of up to 3 bytes, offsets beyond the last readable one are
+// moved back and the loaded value is shifted to compensate
+inline __m128i gatherPixels(const uint8_t *base, __m128i offset, int limit) {
+  alignas(16) int32_t offsets[4];
+  _mm_store_si128((__m128i *)offsets, offset);
+
+  uint32_t pixels[4];
+  for (int i = 0; i < 4; ++i) {
+    int clamped = std::min(offsets[i], limit);
+    memcpy(&pixels[i], base + clamped, sizeof(pixels[i]));
+    pixels[i] >>= 8 * (offsets[i] - clamped);
+  }
+  return _mm_setr_epi32(pixels[0], pixels[1], pixels[2], pixels[3]);
+}
+
+template <int C>
+inline __m128 channel(__m128i pixels) {
+  return _mm_cvtepi32_ps(_mm_and_si128(
+      _mm_srli_epi32(pixels, 8 * C), _mm_set1_epi32(0xFF)));
+}
+
+template <int C>
+inline __m128i interpolate(__m128i p00, __m128i p01, __m128i p10,
+    __m128i p11, __m128 ax, __m128 ay, __m128 gain) {
+  __m128 v00 = channel<C>(p00);
+  __m128 v10 = channel<C>(p10);
+  __m128 top = _mm_add_ps(v00,
+      _mm_mul_ps(ax, _mm_sub_ps(channel<C>(p01), v00)));
+  __m128 bottom = _mm_add_ps(v10,
+      _mm_mul_ps(ax, _mm_sub_ps(channel<C>(p11), v10)));
+  __m128 v = _mm_mul_ps(_mm_add_ps(top,
+      _mm_mul_ps(ay, _mm_sub_ps(bottom, top))), gain);
+
+  __m128i result = _mm_cvtps_epi32(v);
+  result = _mm_max_epi32(result, _mm_setzero_si128());
+  result = _mm_min_epi32(result, _mm_set1_epi32(255));
+  return _mm_slli_epi32(result, 8 * C);
+}
+
+// Shuffle taking the first CN bytes of each of 4 pixels, so 4 pixels occupy
+// the first 4 * CN bytes and the rest is zero
+template <int CN>
+inline __m128i compactPixels() {
+  alignas(16) int8_t bytes[16];
+  memset(bytes, -1, sizeof(bytes));
+  for (int i = 0; i < 4; ++i) {
+    for (int c = 0; c < CN; ++c) {
+      bytes[CN * i + c] = (int8_t)(4 * i + c);
+    }
+  }
+  return _mm_load_si128((const __m128i *)bytes);
+}
+
+}
+
+template <int CN>
+void remapRowSSE42(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 maxX = _mm_set1_ps((float)(src.cols - 1));
+  const __m128 maxY = _mm_set1_ps((float)(src.rows - 1));
+  const __m128i maxXi = _mm_set1_epi32(src.cols - 1);
+  const __m128i maxYi = _mm_set1_epi32(src.rows - 1);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i channels = _mm_set1_epi32(CN);
+  const __m128i step = _mm_set1_epi32((int)src.step);
+  const int limit = (src.rows - 1) * (int)src.step + CN * src.cols - 4;
+  const __m128 g0 = _mm_set1_ps(gain[0]);
+  const __m128 g1 = _mm_set1_ps(gain[1]);
+  const __m128 g2 = _mm_set1_ps(gain[2]);
+
+  const __m128i compact = compactPixels<CN>();
+
+  int x = 0;
+  for (; x + 4 <= n; x += 4) {
+    // x0 y0 x1 y1 ... -> x0 x1 ... and y0 y1 ...
+    __m128 a = _mm_loadu_ps(map + 2 * x);
+    __m128 b = _mm_loadu_ps(map + 2 * x + 4);
+    __m128 sx = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 sy = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+    __m128 valid = _mm_and_ps(
+        _mm_and_ps(_mm_cmpge_ps(sx, zero), _mm_cmpge_ps(sy, zero)),
+        _mm_and_ps(_mm_cmple_ps(sx, maxX), _mm_cmple_ps(sy, maxY)));
+    if (0 == _mm_movemask_ps(valid)) {
+      continue;
+    }
+    __m128i mask = _mm_castps_si128(valid);
+
+    // invalid lanes read the first pixel of the image
+    __m128i x0 = _mm_and_si128(_mm_cvttps_epi32(sx), mask);
+    __m128i y0 = _mm_and_si128(_mm_cvttps_epi32(sy), mask);
+    __m128 ax = _mm_sub_ps(sx, _mm_cvtepi32_ps(x0));
+    __m128 ay = _mm_sub_ps(sy, _mm_cvtepi32_ps(y0));
+    __m128i x1 = _mm_min_epi32(_mm_add_epi32(x0, one), maxXi);
+    __m128i y1 = _mm_min_epi32(_mm_add_epi32(y0, one), maxYi);
+
+    __m128i r0 = _mm_mullo_epi32(y0, step);
+    __m128i r1 = _mm_mullo_epi32(y1, step);
+    __m128i c0 = _mm_mullo_epi32(x0, channels);
+    __m128i c1 = _mm_mullo_epi32(x1, channels);
+    __m128i p00 = gatherPixels(src.data, _mm_add_epi32(r0, c0), limit);
+    __m128i p01 = gatherPixels(src.data, _mm_add_epi32(r0, c1), limit);
+    __m128i p10 = gatherPixels(src.data, _mm_add_epi32(r1, c0), limit);
+    __m128i p11 = gatherPixels(src.data, _mm_add_epi32(r1, c1), limit);
+
+    __m128i pixels = interpolate<0>(p00, p01, p10, p11, ax, ay, g0);
+    if (CN > 1) {
+      pixels = _mm_or_si128(pixels,
+          interpolate<1>(p00, p01, p10, p11, ax, ay, g1));
+    }
+    if (CN > 2) {
+      pixels = _mm_or_si128(pixels,
+          interpolate<2>(p00, p01, p10, p11, ax, ay, g2));
+    }
+    __m128i packed = _mm_shuffle_epi8(pixels, compact);
+    __m128i bytes = _mm_shuffle_epi8(mask, compact);
+
+    // keep canvas pixels which have no source, only 4 * CN bytes belong to
+    // this block
+    uint8_t *out = dst + CN * x;
+    alignas(16) uint8_t block[16];
+    memcpy(block, out, 4 * CN);
+    __m128i old = _mm_load_si128((const __m128i *)block);
+    _mm_store_si128((__m128i *)block, _mm_blendv_epi8(old, packed, bytes));
+    memcpy(out, block, 4 * CN);
+  }
+
+  remapRowScalarT<uint8_t, CN>(src, map + 2 * x, gain, dst + CN * x, n - x);
+}
+
+template void remapRowSSE42<1>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowSSE42<2>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
+template void remapRowSSE42<3>(const remap_source_t &src, const float *map,
+    const float *gain, uint8_t *dst, int n);
@@ -0,0 +1,183 @@
+#include "compose.hpp"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const size_t kDefaultCacheSize = 256 * 1024;
+
+size_t l2CacheSize() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0) {
+    return (size_t)size;
+  }
+#endif
+  return kDefaultCacheSize;
+}
+
+// Interleave bits of x and y
+uint64_t zOrder(uint32_t x, uint32_t y) {
+  uint64_t result = 0;
+  for (int i = 0; i < 32; ++i) {
+    result |= (uint64_t)((x >> i) & 1) << (2 * i);
+    result |= (uint64_t)((y >> i) & 1) << (2 * i + 1);
+  }
+  return result;
+}
+
+// Source coordinates of a pixel of roi, false if it has no source
+bool sourceOf(const warp_maps_t &maps, const cv::Size &imageSize,
+    int x, int y, cv::Vec2f &P) {
+  if (maps.grid > 1) {
+    float row[2];
+    interpolateMapRow(maps, y, x, 1, row);
+    P = cv::Vec2f(row[0], row[1]);
+  } else {
+    P = maps.map.at<cv::Vec2f>(y, x);
+  }
+  return P[0] >= 0 && P[1] >= 0 && P[0] <= imageSize.width - 1 &&
+      P[1] <= imageSize.height - 1;
+}
+
+// Whether the camera owns any pixel of the tile
+bool isOwned(const warp_maps_t &maps, const cv::Rect &tile) {
+  if (maps.spanRows.empty()) {
+    return true;
+  }
+  for (int y = tile.y; y < tile.y + tile.height; ++y) {
+    for (int s = maps.spanRows[y]; s < maps.spanRows[y + 1]; ++s) {
+      if (maps.spans[s].x < tile.x + tile.width &&
+          maps.spans[s].x + maps.spans[s].n > tile.x) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Number of pixels of the run [x, x + n) of y-th row of roi which have
+// source
+int countSourced(const warp_maps_t &maps, const cv::Size &imageSize,
+    int y, int x, int n, std::vector<float> &row) {
+  const float *map = nullptr;
+  if (maps.grid > 1) {
+    row.resize(2 * n);
+    interpolateMapRow(maps, y, x, n, row.data());
+    map = row.data();
+  } else {
+    map = maps.map.ptr<float>(y) + 2 * x;
+  }
+
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    const float sx = map[2 * i];
+    const float sy = map[2 * i + 1];
+    if (sx >= 0 && sy >= 0 && sx <= imageSize.width - 1 &&
+        sy <= imageSize.height - 1) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// Number of pixels of the tile the camera composes
+int countComposed(const warp_maps_t &maps, const cv::Size &imageSize,
+    const cv::Rect &tile, std::vector<float> &row) {
+  int count = 0;
+  for (int y = tile.y; y < tile.y + tile.height; ++y) {
+    if (maps.spanRows.empty()) {
+      count += countSourced(maps, imageSize, y, tile.x, tile.width, row);
+      continue;
+    }
+    for (int s = maps.spanRows[y]; s < maps.spanRows[y + 1]; ++s) {
+      const int from = std::max(maps.spans[s].x, tile.x);
+      const int to = std::min(maps.spans[s].x + maps.spans[s].n,
+          tile.x + tile.width);
+      if (from < to) {
+        count += countSourced(maps, imageSize, y, from, to - from, row);
+      }
+    }
+  }
+  return count;
+}
+
+}
+
+void planTiles(warp_maps_t &maps, const cv::Size &imageSize,
+    size_t cacheSize) {
+  maps.tiles.clear();
+  maps.tilePixels.clear();
+  maps.tileSources.clear();
+  if (maps.roi.area() <= 0) {
+    return;
+  }
+  if (0 == cacheSize) {
+    cacheSize = l2CacheSize();
+  }
+
+  // Bytes touched per canvas pixel: destination, map (dense only) and
+  // source pixels it is sampled from. Half of the cache is left for
+  // everything else
+  double sourcePerPixel = std::max(1.0,
+      (double)imageSize.area() / maps.roi.area());
+  double bytesPerPixel = 3 + (maps.grid > 1 ? 0 : 8) + 3 * sourcePerPixel;
+  int side = (int)sqrt(cacheSize / 2 / bytesPerPixel);
+  // keep blocks wide enough for SIMD kernels
+  side = std::max(16, std::min(256, side / 16 * 16));
+
+  struct keyed_tile_t {
+    uint64_t key;
+    cv::Rect tile;
+  };
+  std::vector<keyed_tile_t> tiles;
+  for (int y = 0; y < maps.roi.height; y += side) {
+    for (int x = 0; x < maps.roi.width; x += side) {
+      cv::Rect tile(x, y, std::min(side, maps.roi.width - x),
+          std::min(side, maps.roi.height - y));
+      if (!isOwned(maps, tile)) {
+        continue;
+      }
+
+      // Blocks are ordered by the position of their source: center of the
+      // block if it has source, any of its corners otherwise
+      const cv::Point probes[] = {
+          cv::Point(x + tile.width / 2, y + tile.height / 2),
+          cv::Point(x, y),
+          cv::Point(x + tile.width - 1, y),
+          cv::Point(x, y + tile.height - 1),
+          cv::Point(x + tile.width - 1, y + tile.height - 1) };
+      uint64_t key = std::numeric_limits<uint64_t>::max();
+      for (const cv::Point &probe : probes) {
+        cv::Vec2f P;
+        if (sourceOf(maps, imageSize, probe.x, probe.y, P)) {
+          key = zOrder((uint32_t)(P[0] / side), (uint32_t)(P[1] / side));
+          break;
+        }
+      }
+
+      keyed_tile_t keyed = { key, tile };
+      tiles.push_back(keyed);
+    }
+  }
+
+  std::stable_sort(tiles.begin(), tiles.end(),
+      [](const keyed_tile_t &a, const keyed_tile_t &b) {
+    return a.key < b.key;
+  });
+
+  maps.tiles.reserve(tiles.size());
+  maps.tilePixels.reserve(tiles.size());
+  std::vector<float> row;
+  for (const keyed_tile_t &keyed : tiles) {
+    maps.tiles.push_back(keyed.tile);
+    maps.tilePixels.push_back(countComposed(maps, imageSize, keyed.tile,
+        row));
+  }
+}
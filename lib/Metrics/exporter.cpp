@@ -0,0 +1,154 @@
+#include "metrics.hpp"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Request headers are read and ignored, every path serves the metrics
+const size_t kMaxRequestSize = 8192;
+// A scraper which stops talking is dropped after that long
+const int kSocketTimeoutSeconds = 2;
+
+bool sendAll(int socket, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= (size_t)sent;
+  }
+  return true;
+}
+
+bool readRequest(int socket) {
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+    if (received <= 0 || request.size() > kMaxRequestSize) {
+      return false;
+    }
+    request.append(buffer, (size_t)received);
+  }
+  return true;
+}
+
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry &registry, int port)
+    : registry(registry) {
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return;
+  }
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // metrics are for the local scraper only
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons((uint16_t)port);
+  socklen_t length = sizeof(address);
+  if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, 4) != 0 ||
+      getsockname(listener, (sockaddr*)&address, &length) != 0) {
+    ::close(listener);
+    listener = -1;
+    return;
+  }
+  boundPort = ntohs(address.sin_port);
+
+  server = std::thread(&MetricsServer::serve, this);
+}
+
+MetricsServer::~MetricsServer() {
+  if (listener < 0) {
+    return;
+  }
+  stopping = true;
+  // wakes the server up
+  shutdown(listener, SHUT_RDWR);
+  server.join();
+  ::close(listener);
+}
+
+void MetricsServer::serve() {
+  while (true) {
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0) {
+      if (stopping) {
+        return;
+      }
+      continue;
+    }
+
+    // scrapes are rare and short, they are served one by one
+    timeval timeout;
+    timeout.tv_sec = kSocketTimeoutSeconds;
+    timeout.tv_usec = 0;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (readRequest(socket)) {
+      const std::string body = registry.render();
+      std::ostringstream response;
+      response << "HTTP/1.0 200 OK\r\n"
+          << "Content-Type: text/plain; version=0.0.4\r\n"
+          << "Content-Length: " << body.size() << "\r\n"
+          << "Connection: close\r\n\r\n" << body;
+      const std::string data = response.str();
+      sendAll(socket, data.data(), data.size());
+    }
+    ::close(socket);
+  }
+}
+
+MetricsFileWriter::MetricsFileWriter(const MetricsRegistry &registry,
+    const std::string &path, double intervalSeconds)
+    : registry(registry), path(path), interval(intervalSeconds) {
+  writer = std::thread(&MetricsFileWriter::run, this);
+}
+
+MetricsFileWriter::~MetricsFileWriter() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_one();
+  writer.join();
+  write();
+}
+
+bool MetricsFileWriter::write() const {
+  // renamed over the file, so readers see either version in full
+  const std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary.c_str());
+    file << registry.render();
+    if (!file) {
+      return false;
+    }
+  }
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+void MetricsFileWriter::run() {
+  const std::chrono::microseconds period((long long)(interval * 1e6));
+  std::unique_lock<std::mutex> guard(lock);
+  while (!wake.wait_for(guard, period, [this] { return stopping; })) {
+    guard.unlock();
+    write();
+    guard.lock();
+  }
+}
@@ -0,0 +1,191 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+void formatValue(std::ostream &out, double value) {
+  if (value == std::numeric_limits<double>::infinity()) {
+    out << "+Inf";
+  } else {
+    out << std::setprecision(std::numeric_limits<double>::digits10)
+        << value;
+  }
+}
+
+// name{labels} with an extra label appended when given
+std::string series(const std::string &name, const std::string &labels,
+    const std::string &extra = "") {
+  std::string all = labels;
+  if (!extra.empty()) {
+    all += (all.empty() ? "" : ",") + extra;
+  }
+  return all.empty() ? name : name + "{" + all + "}";
+}
+
+}
+
+void Gauge::set(double value) {
+  uint64_t raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  bits.store(raw, std::memory_order_relaxed);
+}
+
+double Gauge::value() const {
+  const uint64_t raw = bits.load(std::memory_order_relaxed);
+  double value;
+  std::memcpy(&value, &raw, sizeof(value));
+  return value;
+}
+
+Histogram::Histogram(const std::vector<double> &bounds)
+    : upper(bounds), buckets(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  std::sort(upper.begin(), upper.end());
+  for (size_t i = 0; i <= upper.size(); ++i) {
+    buckets[i].store(0);
+  }
+}
+
+void Histogram::observe(double seconds) {
+  const size_t bucket = std::lower_bound(upper.begin(), upper.end(),
+      seconds) - upper.begin();
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  nanoseconds.fetch_add((uint64_t)(std::max(seconds, 0.0) * 1e9),
+      std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> Histogram::counts() const {
+  std::vector<uint64_t> result(upper.size() + 1);
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[i] = buckets[i].load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+double Histogram::sum() const {
+  return nanoseconds.load(std::memory_order_relaxed) / 1e9;
+}
+
+uint64_t Histogram::count() const {
+  uint64_t total = 0;
+  for (uint64_t bucket : counts()) {
+    total += bucket;
+  }
+  return total;
+}
+
+std::vector<double> latencyBounds() {
+  return {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+      1};
+}
+
+std::string metricLabel(const std::string &name, const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if ('\\' == c || '"' == c || '\n' == c) {
+      escaped += '\\';
+    }
+    escaped += '\n' == c ? 'n' : c;
+  }
+  return name + "=\"" + escaped + "\"";
+}
+
+struct MetricsRegistry::family_t {
+  std::string name;
+  std::string help;
+  const char *type;
+  std::vector<std::string> labels;
+  // one of them per labels, by type
+  std::vector<std::unique_ptr<Counter>> counters;
+  std::vector<std::unique_ptr<Gauge>> gauges;
+  std::vector<std::unique_ptr<Histogram>> histograms;
+};
+
+MetricsRegistry::MetricsRegistry() {}
+
+MetricsRegistry::~MetricsRegistry() {}
+
+MetricsRegistry::family_t &MetricsRegistry::family(const std::string &name,
+    const std::string &help, const char *type) {
+  for (const std::unique_ptr<family_t> &family : families) {
+    if (family->name == name) {
+      return *family;
+    }
+  }
+  families.emplace_back(new family_t());
+  family_t &family = *families.back();
+  family.name = name;
+  family.help = help;
+  family.type = type;
+  return family;
+}
+
+Counter &MetricsRegistry::counter(const std::string &name,
+    const std::string &help, const std::string &labels) {
+  std::lock_guard<std::mutex> guard(lock);
+  family_t &counters = family(name, help, "counter");
+  counters.labels.push_back(labels);
+  counters.counters.emplace_back(new Counter());
+  return *counters.counters.back();
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name,
+    const std::string &help, const std::string &labels) {
+  std::lock_guard<std::mutex> guard(lock);
+  family_t &gauges = family(name, help, "gauge");
+  gauges.labels.push_back(labels);
+  gauges.gauges.emplace_back(new Gauge());
+  return *gauges.gauges.back();
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name,
+    const std::string &help, const std::string &labels,
+    const std::vector<double> &bounds) {
+  std::lock_guard<std::mutex> guard(lock);
+  family_t &histograms = family(name, help, "histogram");
+  histograms.labels.push_back(labels);
+  histograms.histograms.emplace_back(new Histogram(bounds));
+  return *histograms.histograms.back();
+}
+
+std::string MetricsRegistry::render() const {
+  // the lock keeps out registration only, metrics are read atomically
+  std::lock_guard<std::mutex> guard(lock);
+  std::ostringstream out;
+  for (const std::unique_ptr<family_t> &family : families) {
+    out << "# HELP " << family->name << " " << family->help << "\n";
+    out << "# TYPE " << family->name << " " << family->type << "\n";
+    for (size_t i = 0; i < family->counters.size(); ++i) {
+      out << series(family->name, family->labels[i]) << " "
+          << family->counters[i]->value() << "\n";
+    }
+    for (size_t i = 0; i < family->gauges.size(); ++i) {
+      out << series(family->name, family->labels[i]) << " ";
+      formatValue(out, family->gauges[i]->value());
+      out << "\n";
+    }
+    for (size_t i = 0; i < family->histograms.size(); ++i) {
+      const Histogram &histogram = *family->histograms[i];
+      const std::vector<uint64_t> counts = histogram.counts();
+      uint64_t cumulative = 0;
+      for (size_t b = 0; b < counts.size(); ++b) {
+        cumulative += counts[b];
+        std::ostringstream bound;
+        formatValue(bound, b < histogram.bounds().size()
+            ? histogram.bounds()[b] : std::numeric_limits<double>::infinity());
+        out << series(family->name + "_bucket", family->labels[i],
+            metricLabel("le", bound.str())) << " " << cumulative << "\n";
+      }
+      out << series(family->name + "_sum", family->labels[i]) << " ";
+      formatValue(out, histogram.sum());
+      out << "\n";
+      out << series(family->name + "_count", family->labels[i]) << " "
+          << cumulative << "\n";
+    }
+  }
+  return out.str();
+}
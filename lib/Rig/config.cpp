@@ -0,0 +1,231 @@
+#include "rig.hpp"
+#include "Debug.hpp"
+
+#include <iostream>
+
+namespace {
+
+// Read a sequence of matrices, false if node is not a sequence
+bool readMatrices(const cv::FileNode &node, std::vector<cv::Mat> &matrices) {
+  if (node.type() != cv::FileNode::SEQ) {
+    return false;
+  }
+
+  matrices.resize(node.size());
+  for (size_t index = 0; index < node.size(); ++index) {
+    node[(int)index] >> matrices[index];
+    WITH_DEBUG(
+      std::cout << "Read matrix " << std::endl << matrices[index]
+          << std::endl;
+    )
+  }
+  return true;
+}
+
+}
+
+int readStitchConfig(const std::string &path, stitch_config_t &config) {
+  cv::FileStorage fs(path, cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    std::cout << "Failed to open configuration file " << path << std::endl;
+    return 2;
+  }
+
+  config = stitch_config_t();
+  fs["video"] >> config.video;
+  cv::FileNode fNames = fs["file_paths"];
+  if (fNames.type() != cv::FileNode::SEQ) {
+    std::cout << "file_paths is not a sequence!" << std::endl;
+    return 4;
+  }
+
+  config.file_paths.resize(fNames.size());
+  for (size_t index = 0; index < fNames.size(); ++index) {
+    fNames[(int)index] >> config.file_paths[index];
+    WITH_DEBUG(
+      std::cout << "Read file path " << std::endl
+          << config.file_paths[index] << std::endl;
+    )
+  }
+  if (config.file_paths.empty()) {
+    return 3;
+  }
+  const size_t n = config.file_paths.size();
+
+  fs["result_size"] >> config.result_size;
+  if (config.result_size.area() <= 0) {
+    std::cout << "result_size is malformed!" << std::endl;
+    return 4;
+  }
+  WITH_DEBUG(
+    std::cout << "Result size: " << config.result_size << std::endl;
+  )
+
+  cv::FileNode fProjection = fs["projection"];
+  if (!fProjection.empty()) {
+    std::string type;
+    fProjection["type"] >> type;
+    if ("cylindrical" == type) {
+      config.projection.type = Projection::Cylindrical;
+    } else if ("spherical" == type) {
+      config.projection.type = Projection::Spherical;
+    } else {
+      std::cout << "Unknown projection " << type << std::endl;
+      return 4;
+    }
+    fProjection["P"] >> config.projection.P;
+    fProjection["scale"] >> config.projection.scale;
+    std::vector<double> origin;
+    fProjection["origin"] >> origin;
+    if (config.projection.P.size() != cv::Size(3, 3) ||
+        config.projection.scale <= 0 || origin.size() != 2) {
+      std::cout << "projection is malformed!" << std::endl;
+      return 4;
+    }
+    config.projection.origin = cv::Point2d(origin[0], origin[1]);
+  }
+
+  if (!readMatrices(fs["H"], config.H)) {
+    std::cout << "H is not a sequence!" << std::endl;
+    return 4;
+  }
+  if (!readMatrices(fs["cameraMatrix"], config.cameraMatrix)) {
+    std::cout << "cameraMatrix is not a sequence!" << std::endl;
+    return 4;
+  }
+  if (!readMatrices(fs["distCoeffs"], config.distCoeffs)) {
+    std::cout << "distCoeffs is not a sequence!" << std::endl;
+    return 4;
+  }
+  if (config.H.size() != n || config.cameraMatrix.size() != n ||
+      config.distCoeffs.size() != n) {
+    std::cout << "H, cameraMatrix and distCoeffs must have " << n
+        << " entries!" << std::endl;
+    return 4;
+  }
+  for (const cv::Mat &H : config.H) {
+    if (H.size() != cv::Size(3, 3)) {
+      std::cout << "H is malformed!" << std::endl;
+      return 4;
+    }
+  }
+
+  config.gains.assign(n, cv::Vec3f(1, 1, 1));
+  std::vector<cv::Mat> gains;
+  if (readMatrices(fs["gains"], gains)) {
+    if (gains.size() != n) {
+      std::cout << "gains must have " << n << " entries!" << std::endl;
+      return 4;
+    }
+    for (size_t index = 0; index < n; ++index) {
+      if (gains[index].type() != CV_32FC1 || gains[index].total() != 3) {
+        std::cout << "gains are malformed!" << std::endl;
+        return 4;
+      }
+      config.gains[index] = cv::Vec3f(gains[index].at<float>(0),
+          gains[index].at<float>(1), gains[index].at<float>(2));
+    }
+  }
+
+  config.image_sizes.resize(n);
+  cv::FileNode fImageSizes = fs["image_sizes"];
+  if (fImageSizes.type() == cv::FileNode::SEQ) {
+    for (size_t index = 0; index < std::min(fImageSizes.size(), n);
+        ++index) {
+      fImageSizes[(int)index] >> config.image_sizes[index];
+    }
+  }
+
+  if (!fs["owners"].empty()) {
+    cv::Mat runs;
+    fs["owners"] >> runs;
+    if (!runs.empty() && (runs.type() != CV_32SC1 || runs.cols != 2)) {
+      std::cout << "owners are malformed!" << std::endl;
+      return 4;
+    }
+    config.owners = decodeOwnerMap(runs, config.result_size);
+  }
+
+  std::vector<cv::Mat> corners;
+  if (readMatrices(fs["board_corners"], corners)) {
+    config.board_corners.resize(n);
+    for (size_t index = 0; index < std::min(corners.size(), n); ++index) {
+      if (!corners[index].empty()) {
+        config.board_corners[index] =
+            (std::vector<cv::Point2f>)corners[index].reshape(2);
+      }
+    }
+  }
+
+  return 0;
+}
+
+bool writeStitchConfig(const std::string &path,
+    const stitch_config_t &config) {
+  cv::FileStorage fs(path, cv::FileStorage::WRITE);
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  const size_t n = config.file_paths.size();
+  fs << "video" << config.video;
+  fs << "file_paths" << "[";
+  for (size_t i = 0; i < n; ++i) {
+    fs << config.file_paths[i];
+  }
+  fs << "]";
+  fs << "result_size" << config.result_size;
+  if (config.image_sizes.size() == n) {
+    fs << "image_sizes" << "[";
+    for (size_t i = 0; i < n; ++i) {
+      fs << config.image_sizes[i];
+    }
+    fs << "]";
+  }
+  if (config.projection.type != Projection::Plane) {
+    const projection_t &projection = config.projection;
+    fs << "projection" << "{";
+    fs << "type" << (Projection::Cylindrical == projection.type
+        ? "cylindrical" : "spherical");
+    fs << "P" << projection.P;
+    fs << "scale" << projection.scale;
+    fs << "origin" << "[" << projection.origin.x << projection.origin.y
+        << "]";
+    fs << "}";
+  }
+  fs << "H" << "[";
+  for (size_t i = 0; i < n; ++i) {
+    fs << config.H[i];
+  }
+  fs << "]";
+  fs << "cameraMatrix" << "[";
+  for (size_t i = 0; i < n; ++i) {
+    fs << config.cameraMatrix[i];
+  }
+  fs << "]";
+  fs << "distCoeffs" << "[";
+  for (size_t i = 0; i < n; ++i) {
+    fs << config.distCoeffs[i];
+  }
+  fs << "]";
+  if (config.gains.size() == n) {
+    fs << "gains" << "[";
+    for (size_t i = 0; i < n; ++i) {
+      fs << cv::Mat(config.gains[i]);
+    }
+    fs << "]";
+  }
+  if (!config.owners.empty()) {
+    fs << "owners" << encodeOwnerMap(config.owners);
+  }
+  if (config.board_corners.size() == n) {
+    fs << "board_corners" << "[";
+    for (size_t i = 0; i < n; ++i) {
+      fs << cv::Mat(config.board_corners[i]);
+    }
+    fs << "]";
+  }
+
+  fs.release();
+  return true;
+}
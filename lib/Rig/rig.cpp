@@ -0,0 +1,113 @@
+#include "rig.hpp"
+#include "utils.hpp"
+#include "opts.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+
+#include <cmath>
+
+extern command_line_opts opts;
+
+std::shared_ptr<const rig_t> buildRig(const stitch_config_t &config,
+    const std::vector<cv::Size> &frameSizes, const cv::Range &rows) {
+  std::shared_ptr<rig_t> rig = std::make_shared<rig_t>();
+  rig->config = config;
+  rig->frame_sizes = frameSizes;
+  rig->rows = rows;
+
+  const size_t n = config.file_paths.size();
+  CV_Assert(frameSizes.size() == n);
+
+  // Undistortion and perspective transformation are combined into
+  // a single map per camera, so each frame is sampled only once
+  rig->maps.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    buildWarpMaps(config.H[i], config.projection, config.cameraMatrix[i],
+        config.distCoeffs[i], frameSizes[i], config.result_size,
+        rig->maps[i], opts.map_grid);
+  }
+
+  cv::Mat owners;
+  if (opts.owner_map && n > 1) {
+    owners = config.owners.empty()
+        ? buildOwnerMap(rig->maps, frameSizes, config.result_size)
+        : config.owners;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!owners.empty()) {
+      applyOwnerMap(rig->maps[i], owners, (int)i);
+    }
+    restrictToRows(rig->maps[i], rows);
+    if (opts.blocked_traversal || opts.incremental) {
+      planTiles(rig->maps[i], frameSizes[i]);
+    }
+    if (opts.incremental) {
+      planTileSources(rig->maps[i], frameSizes[i]);
+    }
+  }
+
+  if (opts.planar) {
+    cv::Mat halfOwners = owners.empty() ? cv::Mat() : halveOwnerMap(owners);
+    rig->chroma.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      buildChromaMaps(rig->maps[i], frameSizes[i], rig->chroma[i]);
+      if (!halfOwners.empty()) {
+        applyOwnerMap(rig->chroma[i], halfOwners, (int)i);
+      }
+      if (opts.blocked_traversal) {
+        planTiles(rig->chroma[i], cv::Size(frameSizes[i].width / 2,
+            frameSizes[i].height / 2));
+      }
+    }
+  }
+
+  rig->gains = opts.gain_compensation
+      ? config.gains : std::vector<cv::Vec3f>(n, cv::Vec3f(1, 1, 1));
+  return rig;
+}
+
+bool estimateDrift(const cv::Mat &frame, size_t camera,
+    stitch_config_t &config, double tolerance) {
+  if (camera >= config.board_corners.size() ||
+      config.board_corners[camera].size() != 4) {
+    return false;
+  }
+
+  // The board is searched for the same way calibrate does
+  const cv::Size chessboardSize(opts.board_width, opts.board_height);
+  cv::Rect leftHalfRect(0, 0, frame.cols / 2, frame.rows);
+  cv::Mat area = (StitchingMode::ChainOfTargets == opts.mode)
+      ? frame(leftHalfRect) : frame;
+  std::vector<cv::Point2f> corners;
+  if (!findChessboardCorners(area, chessboardSize, corners)) {
+    return false;
+  }
+
+  const cv::Mat &cameraMatrix = config.cameraMatrix[camera];
+  if (!cameraMatrix.empty() && !config.distCoeffs[camera].empty()) {
+    std::vector<cv::Point2f> undistorted;
+    cv::undistortPoints(corners, undistorted, cameraMatrix,
+        config.distCoeffs[camera], cv::noArray(), cameraMatrix);
+    corners = undistorted;
+  }
+  std::vector<cv::Point2f> current =
+      extractCorners(viewChessboardCorners(corners, chessboardSize));
+
+  std::vector<cv::Point2f> &previous = config.board_corners[camera];
+  double shift = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    shift = std::max(shift, (double)cv::norm(current[i] - previous[i]));
+  }
+  if (shift <= tolerance) {
+    return false;
+  }
+
+  // Points of the current frame are moved to where the board was and then
+  // transformed by the homography computed for that position
+  cv::Mat D = cv::getPerspectiveTransform(current.data(), previous.data());
+  config.H[camera] = config.H[camera] * D;
+  previous = current;
+  return true;
+}
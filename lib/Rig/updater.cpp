@@ -0,0 +1,178 @@
+#include "rig.hpp"
+
+#include <sys/stat.h>
+
+#include <exception>
+#include <iostream>
+
+namespace {
+
+// How often the config file is checked for changes
+const std::chrono::milliseconds kPollInterval(500);
+
+// Modification time and size of the file packed together, 0 if there is no
+// such file
+long long fileStamp(const std::string &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return 0;
+  }
+  long long stamp = (long long)info.st_mtime * 1000000007LL;
+#ifdef __linux__
+  stamp += info.st_mtim.tv_nsec;
+#endif
+  return stamp * 31 + (long long)info.st_size;
+}
+
+}
+
+RigUpdater::RigUpdater(const std::shared_ptr<const rig_t> &rig,
+    const std::string &configPath, double driftInterval)
+    : rig(rig), configPath(configPath), driftInterval(driftInterval),
+    configStamp(fileStamp(configPath)),
+    nextDriftCheck(std::chrono::steady_clock::now()) {
+  worker = std::thread(&RigUpdater::run, this);
+}
+
+RigUpdater::~RigUpdater() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_one();
+  worker.join();
+}
+
+std::shared_ptr<const rig_t> RigUpdater::current() const {
+  return std::atomic_load(&rig);
+}
+
+void RigUpdater::offerFrames(const std::vector<cv::Mat> &frames) {
+  if (driftInterval.count() <= 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now < nextDriftCheck) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock() || !pendingFrames.empty()) {
+    return;
+  }
+  // frames are copied, so the capture may reuse its buffers
+  pendingFrames.resize(frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i].copyTo(pendingFrames[i]);
+  }
+  nextDriftCheck = now +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          driftInterval);
+  lock.unlock();
+  wakeup.notify_one();
+}
+
+void RigUpdater::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    wakeup.wait_for(lock, kPollInterval);
+    if (stopping) {
+      break;
+    }
+    std::vector<cv::Mat> frames;
+    frames.swap(pendingFrames);
+    lock.unlock();
+
+    checkConfig();
+    if (!frames.empty()) {
+      checkDrift(frames);
+    }
+
+    lock.lock();
+  }
+}
+
+void RigUpdater::checkConfig() {
+  long long stamp = fileStamp(configPath);
+  if (stamp == configStamp) {
+    return;
+  }
+  // The stamp is remembered even if the file is broken: it is re-read when
+  // the writer touches it again
+  configStamp = stamp;
+
+  // A config caught half-written may make OpenCV throw. The updater runs on
+  // its own thread, so anything that escapes it would stop the stitcher
+  stitch_config_t config;
+  int status = 4;
+  try {
+    status = readStitchConfig(configPath, config);
+  } catch (const std::exception &e) {
+    std::cout << e.what() << std::endl;
+  }
+  if (status != 0) {
+    std::cout << "Failed to reload " << configPath << ", keeping maps"
+        << std::endl;
+    return;
+  }
+  if (config.file_paths.size() != current()->config.file_paths.size()) {
+    std::cout << "Number of cameras in " << configPath
+        << " has changed, keeping maps" << std::endl;
+    return;
+  }
+  // Canvases of the frame loop, of the slots in flight and of the shards
+  // are allocated once for the canvas of the first rig
+  const stitch_config_t &running = current()->config;
+  if (config.result_size != running.result_size ||
+      config.projection.type != running.projection.type) {
+    std::cout << "Canvas of " << configPath << " has changed from "
+        << running.result_size << " to " << config.result_size
+        << ", keeping maps, restart to apply it" << std::endl;
+    return;
+  }
+
+  if (publish(config)) {
+    std::cout << "Reloaded " << configPath << std::endl;
+  } else {
+    std::cout << "Failed to build maps of " << configPath
+        << ", keeping maps" << std::endl;
+  }
+}
+
+void RigUpdater::checkDrift(const std::vector<cv::Mat> &frames) {
+  stitch_config_t config = current()->config;
+  bool drifted = false;
+  for (size_t i = 0; i < frames.size() && i < config.H.size(); ++i) {
+    try {
+      if (estimateDrift(frames[i], i, config)) {
+        std::cout << "Camera #" << i << " has drifted, updating its map"
+            << std::endl;
+        drifted = true;
+      }
+    } catch (const std::exception &e) {
+      std::cout << "Failed to estimate drift of camera #" << i << ": "
+          << e.what() << std::endl;
+    }
+  }
+
+  if (drifted) {
+    // footprints have moved, so owners are chosen again
+    config.owners = cv::Mat();
+    if (!publish(config)) {
+      std::cout << "Failed to build maps of drifted cameras, keeping maps"
+          << std::endl;
+    }
+  }
+}
+
+bool RigUpdater::publish(const stitch_config_t &config) {
+  std::shared_ptr<const rig_t> next;
+  try {
+    next = buildRig(config, current()->frame_sizes, current()->rows);
+  } catch (const std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return false;
+  }
+  std::atomic_store(&rig, next);
+  return true;
+}
@@ -0,0 +1,207 @@
+#include "shard.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+namespace {
+
+size_t alignUp(size_t size) {
+  return (size + kShardAlignment - 1) / kShardAlignment * kShardAlignment;
+}
+
+size_t matrixSize(const shard_matrix_t &matrix) {
+  return (size_t)matrix.width * matrix.height * CV_ELEM_SIZE(matrix.type);
+}
+
+shard_matrix_t describeMatrix(const cv::Size &size, int type,
+    size_t &offset) {
+  shard_matrix_t matrix;
+  std::memset(&matrix, 0, sizeof(matrix));
+  matrix.width = size.width;
+  matrix.height = size.height;
+  matrix.type = type;
+  matrix.offset = offset;
+  offset += alignUp(matrixSize(matrix));
+  return matrix;
+}
+
+}
+
+ShardSegment::ShardSegment(const std::string &name,
+    const std::vector<cv::Size> &sizes, const std::vector<int> &types,
+    const cv::Size &canvasSize, int canvasType, int workers)
+    : segmentName(name) {
+  CV_Assert(!sizes.empty() && sizes.size() == types.size() &&
+      sizes.size() <= kMaxShardCameras);
+  CV_Assert(workers > 0 && (size_t)workers <= kMaxShardWorkers);
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return;
+  }
+  owner = true;
+
+  size_t offset = alignUp(sizeof(shard_header_t));
+  std::vector<shard_matrix_t> frames(sizes.size());
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    frames[i] = describeMatrix(sizes[i], types[i], offset);
+  }
+  const shard_matrix_t canvas = describeMatrix(canvasSize, canvasType,
+      offset);
+  length = offset;
+
+  void *mapped = MAP_FAILED;
+  if (ftruncate(fd, (off_t)length) == 0) {
+    mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (MAP_FAILED == mapped) {
+    shm_unlink(name.c_str());
+    owner = false;
+    return;
+  }
+
+  // the mapping is zeroed, so counters start from 0
+  header = new (mapped) shard_header_t;
+  std::memcpy(header->magic, kShardMagic, sizeof(kShardMagic));
+  header->cameras = (uint32_t)sizes.size();
+  header->workers = (uint32_t)workers;
+  header->size = length;
+  std::copy(frames.begin(), frames.end(), header->frames);
+  header->canvas = canvas;
+  for (int i = 0; i < workers; ++i) {
+    sem_init(&header->start[i], 1, 0);
+  }
+  sem_init(&header->done, 1, 0);
+}
+
+ShardSegment::ShardSegment(const std::string &name) : segmentName(name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (size_t)info.st_size < sizeof(shard_header_t)) {
+    ::close(fd);
+    return;
+  }
+
+  length = (size_t)info.st_size;
+  void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == mapped) {
+    return;
+  }
+
+  header = (shard_header_t*)mapped;
+  if (std::memcmp(header->magic, kShardMagic, sizeof(kShardMagic)) != 0 ||
+      header->size != length || header->cameras > kMaxShardCameras ||
+      header->workers > kMaxShardWorkers) {
+    munmap(mapped, length);
+    header = nullptr;
+  }
+}
+
+ShardSegment::~ShardSegment() {
+  if (!header) {
+    return;
+  }
+  if (owner) {
+    for (uint32_t i = 0; i < header->workers; ++i) {
+      sem_destroy(&header->start[i]);
+    }
+    sem_destroy(&header->done);
+  }
+  munmap(header, length);
+  if (owner) {
+    shm_unlink(segmentName.c_str());
+  }
+}
+
+cv::Mat ShardSegment::frame(size_t camera) const {
+  CV_Assert(camera < header->cameras);
+  const shard_matrix_t &info = header->frames[camera];
+  return cv::Mat(info.height, info.width, info.type,
+      (uint8_t*)header + info.offset);
+}
+
+cv::Mat ShardSegment::canvas() const {
+  const shard_matrix_t &info = header->canvas;
+  return cv::Mat(info.height, info.width, info.type,
+      (uint8_t*)header + info.offset);
+}
+
+cv::Range ShardSegment::band(int worker) const {
+  CV_Assert(worker >= 0 && worker < workers());
+  const int64_t height = header->canvas.height;
+  return cv::Range((int)(height * worker / workers()),
+      (int)(height * (worker + 1) / workers()));
+}
+
+bool ShardSegment::composed(int worker) const {
+  return header->composed[worker].load() == header->frame.load();
+}
+
+void ShardSegment::startFrame() {
+  header->frame.fetch_add(1);
+  for (int i = 0; i < workers(); ++i) {
+    sem_post(&header->start[i]);
+  }
+}
+
+void ShardSegment::wake(int worker) {
+  int value = 0;
+  sem_getvalue(&header->start[worker], &value);
+  if (0 == value && !composed(worker)) {
+    sem_post(&header->start[worker]);
+  }
+}
+
+bool ShardSegment::waitDone(int milliseconds) {
+  timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += milliseconds / 1000;
+  deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000;
+  }
+  while (sem_timedwait(&header->done, &deadline) != 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ShardSegment::stop() {
+  header->stopping.store(1);
+  for (int i = 0; i < workers(); ++i) {
+    sem_post(&header->start[i]);
+  }
+}
+
+bool ShardSegment::nextFrame(int worker) {
+  CV_Assert(worker >= 0 && worker < workers());
+  while (sem_wait(&header->start[worker]) != 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return 0 == header->stopping.load();
+}
+
+void ShardSegment::frameDone(int worker) {
+  header->composed[worker].store(header->frame.load());
+  sem_post(&header->done);
+}
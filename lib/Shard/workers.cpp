@@ -0,0 +1,108 @@
+#include "shard.hpp"
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+// Time a worker may spend to notice the frame barrier and exit
+const int kExitPolls = 20;
+const int kPollMilliseconds = 100;
+
+}
+
+ShardWorkers::ShardWorkers(ShardSegment &segment,
+    const std::vector<std::string> &args, int maxRestarts)
+    : segment(segment), args(args), pids(segment.workers(), -1),
+      maxRestarts(maxRestarts) {
+  for (int i = 0; i < segment.workers(); ++i) {
+    spawn(i);
+  }
+}
+
+ShardWorkers::~ShardWorkers() {
+  segment.stop();
+  for (int poll = 0; poll < kExitPolls; ++poll) {
+    bool running = false;
+    for (pid_t &pid : pids) {
+      if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid) {
+        pid = -1;
+      }
+      running = running || pid > 0;
+    }
+    if (!running) {
+      return;
+    }
+    usleep(kPollMilliseconds * 1000);
+  }
+  for (pid_t pid : pids) {
+    if (pid > 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+  }
+}
+
+bool ShardWorkers::isRunning() const {
+  for (pid_t pid : pids) {
+    if (pid <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShardWorkers::spawn(int worker) {
+  std::vector<std::string> workerArgs = args;
+  workerArgs.push_back("--shard-worker=" + segment.name() + ":" +
+      std::to_string(worker));
+  std::vector<char*> argv;
+  for (std::string &arg : workerArgs) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+
+  // the same binary, wherever it was started from
+  pid_t pid;
+  if (posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv.data(),
+      environ) != 0) {
+    pids[worker] = -1;
+    return false;
+  }
+  pids[worker] = pid;
+  return true;
+}
+
+bool ShardWorkers::restartDead() {
+  for (int i = 0; i < (int)pids.size(); ++i) {
+    if (pids[i] > 0 && waitpid(pids[i], nullptr, WNOHANG) != pids[i]) {
+      continue;
+    }
+    if (++restartCount > maxRestarts || !spawn(i)) {
+      return false;
+    }
+    // the dead worker may have taken the frame with it
+    segment.wake(i);
+  }
+  return true;
+}
+
+bool ShardWorkers::compose() {
+  segment.startFrame();
+  while (true) {
+    bool composed = true;
+    for (int i = 0; i < segment.workers(); ++i) {
+      composed = composed && segment.composed(i);
+    }
+    if (composed) {
+      return true;
+    }
+    if (!segment.waitDone(kPollMilliseconds) && !restartDead()) {
+      return false;
+    }
+  }
+}
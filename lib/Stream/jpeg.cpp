@@ -0,0 +1,216 @@
+#include "stream.hpp"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <algorithm>
+
+namespace {
+
+const uchar kSOI = 0xD8;
+const uchar kEOI = 0xD9;
+const uchar kSOF0 = 0xC0;
+const uchar kDHT = 0xC4;
+const uchar kRST0 = 0xD0;
+const uchar kSOS = 0xDA;
+const uchar kDRI = 0xDD;
+
+// Strips are a multiple of the largest MCU high
+const int kStripAlignment = 16;
+// Restart interval is a 16-bit count of MCUs
+const int kMaxRestartInterval = 65535;
+
+// Where the parts of a baseline JPEG are
+struct jpeg_layout_t {
+  // Offset of the SOF0 segment and of the SOS one, the entropy-coded data
+  // lies between the end of SOS and EOI
+  size_t sof;
+  size_t sos;
+  size_t data;
+  size_t end;
+  int width;
+  int height;
+  cv::Size mcu;
+};
+
+int readWord(const std::vector<uchar> &jpeg, size_t pos) {
+  return jpeg[pos] << 8 | jpeg[pos + 1];
+}
+
+bool parseJpeg(const std::vector<uchar> &jpeg, jpeg_layout_t &layout) {
+  if (jpeg.size() < 4 || jpeg[0] != 0xFF || jpeg[1] != kSOI ||
+      jpeg[jpeg.size() - 2] != 0xFF || jpeg[jpeg.size() - 1] != kEOI) {
+    return false;
+  }
+  layout.sof = 0;
+  size_t pos = 2;
+  while (pos + 4 <= jpeg.size()) {
+    if (jpeg[pos] != 0xFF) {
+      return false;
+    }
+    const uchar marker = jpeg[pos + 1];
+    const size_t length = (size_t)readWord(jpeg, pos + 2);
+    if (pos + 2 + length > jpeg.size()) {
+      return false;
+    }
+    // progressive or arithmetic coding and restarts can not be spliced
+    if ((marker > kSOF0 && marker <= 0xCF && marker != kDHT &&
+        marker != 0xC8 && marker != 0xCC) || kDRI == marker) {
+      return false;
+    }
+    if (kSOF0 == marker) {
+      if (length < 8) {
+        return false;
+      }
+      layout.sof = pos;
+      layout.height = readWord(jpeg, pos + 5);
+      layout.width = readWord(jpeg, pos + 7);
+      const int components = jpeg[pos + 9];
+      if (length < 8 + 3 * (size_t)components) {
+        return false;
+      }
+      // a scan of one component has a block per MCU whatever its sampling
+      int h = 1, v = 1;
+      for (int c = 0; c < components && components > 1; ++c) {
+        h = std::max(h, jpeg[pos + 11 + 3 * c] >> 4);
+        v = std::max(v, jpeg[pos + 11 + 3 * c] & 15);
+      }
+      layout.mcu = cv::Size(8 * h, 8 * v);
+    }
+    if (kSOS == marker) {
+      layout.sos = pos;
+      layout.data = pos + 2 + length;
+      layout.end = jpeg.size() - 2;
+      return layout.sof != 0;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+// Tables and everything else but the height of the images match
+bool sameHeaders(const std::vector<uchar> &a, const jpeg_layout_t &la,
+    const std::vector<uchar> &b, const jpeg_layout_t &lb) {
+  if (la.data != lb.data || la.sof != lb.sof || la.width != lb.width) {
+    return false;
+  }
+  const size_t height = la.sof + 5;
+  return std::equal(a.begin(), a.begin() + height, b.begin()) &&
+      std::equal(a.begin() + height + 2, a.begin() + la.data,
+          b.begin() + height + 2);
+}
+
+class EncodeStripsBody : public cv::ParallelLoopBody {
+ public:
+  EncodeStripsBody(const cv::Mat &image, int stripHeight,
+      const std::vector<int> &params, std::vector<std::vector<uchar>> &strips)
+      : image(image), stripHeight(stripHeight), params(params),
+      strips(strips) {}
+
+  void operator()(const cv::Range &range) const override {
+    for (int i = range.start; i < range.end; ++i) {
+      const int top = i * stripHeight;
+      cv::imencode(".jpg", image.rowRange(top,
+          std::min(top + stripHeight, image.rows)), strips[i], params);
+    }
+  }
+
+ private:
+  const cv::Mat &image;
+  int stripHeight;
+  const std::vector<int> &params;
+  std::vector<std::vector<uchar>> &strips;
+};
+
+}
+
+bool spliceJpegStrips(const std::vector<std::vector<uchar>> &strips,
+    std::vector<uchar> &jpeg) {
+  if (strips.empty()) {
+    return false;
+  }
+  std::vector<jpeg_layout_t> layouts(strips.size());
+  int height = 0;
+  for (size_t i = 0; i < strips.size(); ++i) {
+    if (!parseJpeg(strips[i], layouts[i]) ||
+        !sameHeaders(strips[0], layouts[0], strips[i], layouts[i])) {
+      return false;
+    }
+    // every restart interval but the last one is a whole strip
+    if (i + 1 < strips.size() && layouts[i].height != layouts[0].height) {
+      return false;
+    }
+    height += layouts[i].height;
+  }
+
+  const jpeg_layout_t &first = layouts[0];
+  const int mcusPerRow = (first.width + first.mcu.width - 1) /
+      first.mcu.width;
+  const int interval = first.height / first.mcu.height * mcusPerRow;
+  if (strips.size() > 1 && (first.height % first.mcu.height != 0 ||
+      interval > kMaxRestartInterval || height > 65535)) {
+    return false;
+  }
+
+  // headers of the first strip with the height of the whole image and the
+  // restart interval added before the scan
+  const std::vector<uchar> &head = strips[0];
+  jpeg.assign(head.begin(), head.begin() + first.sos);
+  jpeg[first.sof + 5] = (uchar)(height >> 8);
+  jpeg[first.sof + 6] = (uchar)(height & 0xFF);
+  if (strips.size() > 1) {
+    const uchar dri[] = { 0xFF, kDRI, 0, 4,
+        (uchar)(interval >> 8), (uchar)(interval & 0xFF) };
+    jpeg.insert(jpeg.end(), dri, dri + sizeof(dri));
+  }
+  jpeg.insert(jpeg.end(), head.begin() + first.sos, head.begin() + first.data);
+
+  // Every strip starts with zero DC predictions and ends padded to a byte,
+  // just like the data following a restart marker
+  for (size_t i = 0; i < strips.size(); ++i) {
+    if (i > 0) {
+      jpeg.push_back(0xFF);
+      jpeg.push_back((uchar)(kRST0 + (i - 1) % 8));
+    }
+    jpeg.insert(jpeg.end(), strips[i].begin() + layouts[i].data,
+        strips[i].begin() + layouts[i].end);
+  }
+  jpeg.push_back(0xFF);
+  jpeg.push_back(kEOI);
+  return true;
+}
+
+bool encodeJpegStrips(const cv::Mat &image, int quality,
+    std::vector<uchar> &jpeg, int strips, WorkerPool *pool) {
+  std::vector<int> params;
+  params.push_back(CV_IMWRITE_JPEG_QUALITY);
+  params.push_back(quality);
+
+  if (strips <= 0) {
+    strips = pool ? (int)pool->size() : cv::getNumThreads();
+  }
+  // 8x8 MCUs give the longest restart interval for the strip height
+  const int mcusPerRow = (image.cols + 7) / 8;
+  const int maxHeight = kMaxRestartInterval / mcusPerRow / 2 *
+      kStripAlignment;
+  int stripHeight = (image.rows + strips - 1) / strips;
+  stripHeight = (stripHeight + kStripAlignment - 1) / kStripAlignment *
+      kStripAlignment;
+  stripHeight = std::min(stripHeight, maxHeight);
+
+  if (stripHeight > 0 && stripHeight < image.rows) {
+    std::vector<std::vector<uchar>> encoded(
+        (image.rows + stripHeight - 1) / stripHeight);
+    EncodeStripsBody body(image, stripHeight, params, encoded);
+    if (pool) {
+      pool->parallelFor((int)encoded.size(),
+          [&body](int i) { body(cv::Range(i, i + 1)); });
+    } else {
+      cv::parallel_for_(cv::Range(0, (int)encoded.size()), body);
+    }
+    if (spliceJpegStrips(encoded, jpeg)) {
+      return true;
+    }
+  }
+  // a single strip, or the codec does not produce spliceable strips
+  return cv::imencode(".jpg", image, jpeg, params);
+}
@@ -0,0 +1,245 @@
+#include "stream.hpp"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace {
+
+const char kBoundary[] = "frame";
+// Request headers are read and ignored, every path serves the stream
+const size_t kMaxRequestSize = 8192;
+
+bool sendAll(int socket, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= (size_t)sent;
+  }
+  return true;
+}
+
+bool readRequest(int socket) {
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+    if (received <= 0 || request.size() > kMaxRequestSize) {
+      return false;
+    }
+    request.append(buffer, (size_t)received);
+  }
+  return true;
+}
+
+}
+
+// Every client has a slot for a single frame: publishing into a full slot
+// replaces the frame the client has not started to send yet
+struct MjpegServer::client_t {
+  int socket = -1;
+  std::mutex lock;
+  std::condition_variable ready;
+  std::shared_ptr<const std::vector<uchar>> frame;
+  bool closed = false;
+  std::thread sender;
+};
+
+MjpegServer::MjpegServer(int port, int quality,
+    const std::vector<int> &cpus)
+    : quality(quality), cpus(cpus), encodedCount(0), droppedCount(0) {
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    return;
+  }
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons((uint16_t)port);
+  socklen_t length = sizeof(address);
+  if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, 16) != 0 ||
+      getsockname(listener, (sockaddr*)&address, &length) != 0) {
+    ::close(listener);
+    listener = -1;
+    return;
+  }
+  boundPort = ntohs(address.sin_port);
+
+  strips.reset(new WorkerPool(cpus.empty() ? (size_t)cv::getNumberOfCPUs()
+      : cpus.size(), cpus));
+  acceptor = std::thread(&MjpegServer::acceptClients, this);
+  encoder = std::thread(&MjpegServer::encodeFrames, this);
+}
+
+MjpegServer::~MjpegServer() {
+  if (listener < 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  published.notify_all();
+  // wakes the acceptor up
+  shutdown(listener, SHUT_RDWR);
+  acceptor.join();
+  encoder.join();
+  ::close(listener);
+
+  for (const std::shared_ptr<client_t> &client : connected) {
+    {
+      std::lock_guard<std::mutex> guard(client->lock);
+      client->closed = true;
+    }
+    client->ready.notify_all();
+    shutdown(client->socket, SHUT_RDWR);
+    client->sender.join();
+    ::close(client->socket);
+  }
+}
+
+void MjpegServer::publish(const cv::Mat &frame) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    // nobody would see the frame, neither copy nor encode it
+    if (connected.empty()) {
+      return;
+    }
+    if (pending) {
+      ++droppedCount;
+    }
+    frame.copyTo(next);
+    pending = true;
+  }
+  published.notify_one();
+}
+
+size_t MjpegServer::clients() const {
+  std::lock_guard<std::mutex> guard(lock);
+  size_t count = 0;
+  for (const std::shared_ptr<client_t> &client : connected) {
+    std::lock_guard<std::mutex> clientGuard(client->lock);
+    count += client->closed ? 0 : 1;
+  }
+  return count;
+}
+
+void MjpegServer::acceptClients() {
+  while (true) {
+    int socket = accept(listener, nullptr, nullptr);
+    if (socket < 0) {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stopping) {
+        return;
+      }
+      continue;
+    }
+
+    std::shared_ptr<client_t> client = std::make_shared<client_t>();
+    client->socket = socket;
+    std::lock_guard<std::mutex> guard(lock);
+    if (stopping) {
+      ::close(socket);
+      return;
+    }
+    client->sender = std::thread(&MjpegServer::serveClient, client);
+    connected.push_back(client);
+  }
+}
+
+void MjpegServer::encodeFrames() {
+  pinCurrentThread(cpus);
+  cv::Mat frame;
+  std::vector<uchar> jpeg;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      published.wait(guard, [this] { return pending || stopping; });
+      if (stopping) {
+        return;
+      }
+      // the buffers are swapped, publishing never waits for encoding
+      cv::swap(frame, next);
+      pending = false;
+      // the last client may have been forgotten since the frame came
+      if (connected.empty()) {
+        continue;
+      }
+    }
+
+    if (!encodeJpegStrips(frame, quality, jpeg, 0, strips.get())) {
+      continue;
+    }
+    ++encodedCount;
+    // clients share the encoded frame
+    std::shared_ptr<const std::vector<uchar>> encoded =
+        std::make_shared<std::vector<uchar>>(jpeg);
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<std::shared_ptr<client_t>> active;
+    for (const std::shared_ptr<client_t> &client : connected) {
+      std::unique_lock<std::mutex> clientGuard(client->lock);
+      if (client->closed) {
+        clientGuard.unlock();
+        client->sender.join();
+        ::close(client->socket);
+        continue;
+      }
+      if (client->frame) {
+        ++droppedCount;
+      }
+      client->frame = encoded;
+      clientGuard.unlock();
+      client->ready.notify_one();
+      active.push_back(client);
+    }
+    connected.swap(active);
+  }
+}
+
+void MjpegServer::serveClient(std::shared_ptr<client_t> client) {
+  const std::string header = std::string("HTTP/1.0 200 OK\r\n"
+      "Cache-Control: no-cache\r\n"
+      "Pragma: no-cache\r\n"
+      "Connection: close\r\n"
+      "Content-Type: multipart/x-mixed-replace; boundary=") + kBoundary +
+      "\r\n\r\n";
+  bool open = readRequest(client->socket) &&
+      sendAll(client->socket, header.data(), header.size());
+
+  while (open) {
+    std::shared_ptr<const std::vector<uchar>> frame;
+    {
+      std::unique_lock<std::mutex> guard(client->lock);
+      client->ready.wait(guard, [&client] {
+        return client->frame || client->closed;
+      });
+      if (client->closed) {
+        return;
+      }
+      frame.swap(client->frame);
+    }
+
+    const std::string part = std::string("--") + kBoundary + "\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "Content-Length: " + std::to_string(frame->size()) + "\r\n\r\n";
+    open = sendAll(client->socket, part.data(), part.size()) &&
+        sendAll(client->socket, (const char*)frame->data(), frame->size()) &&
+        sendAll(client->socket, "\r\n", 2);
+  }
+
+  std::lock_guard<std::mutex> guard(client->lock);
+  client->closed = true;
+}
@@ -0,0 +1,13 @@
+
+#ifndef __LIB_SYNTHETIC_GEOMETRY_HPP__
+#define __LIB_SYNTHETIC_GEOMETRY_HPP__
+
+#include "synthetic.hpp"
+
+#include "opencv2/core/core.hpp"
+
+// Rotation from coordinates of the camera (x right, y down, z forward) to
+// the world
+cv::Matx33d cameraRotation(const synthetic_camera_t &camera);
+
+#endif // __LIB_SYNTHETIC_GEOMETRY_HPP__
@@ -0,0 +1,129 @@
+#include "geometry.hpp"
+
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const cv::Vec3d kSky(210, 180, 140);
+const cv::Vec3d kBlack(20, 20, 20);
+const cv::Vec3d kWhite(235, 235, 235);
+// The floor fades into the sky that far away, in heights of the camera, so
+// the far floor does not alias
+const double kFogRange = 12;
+// Lines on the floor mark every kGridStep millimeters
+const double kGridStep = 500;
+const double kGridWidth = 12;
+
+// Color of the floor at the point: boards with a white margin of a square,
+// otherwise tinted tiles which show where stitched images meet
+cv::Vec3d floorColor(const std::vector<synthetic_board_t> &boards,
+    double x, double y) {
+  for (const synthetic_board_t &board : boards) {
+    // squares from the top left one as the camera sees it
+    const double u = (x - board.center.x) / board.square +
+        (board.size.width + 1) / 2.0;
+    const double v = (board.center.y - y) / board.square +
+        (board.size.height + 1) / 2.0;
+    if (u < -1 || u >= board.size.width + 2 || v < -1 ||
+        v >= board.size.height + 2) {
+      continue;
+    }
+    if (u < 0 || u >= board.size.width + 1 || v < 0 ||
+        v >= board.size.height + 1) {
+      return kWhite;
+    }
+    return ((int)std::floor(u) + (int)std::floor(v)) % 2 == 0
+        ? kBlack : kWhite;
+  }
+
+  cv::Vec3d color(120 + 25 * std::sin(x / 900), 125 + 25 * std::sin(y / 700),
+      130 + 25 * std::sin((x + y) / 1100));
+  const double gx = x - kGridStep * std::floor(x / kGridStep);
+  const double gy = y - kGridStep * std::floor(y / kGridStep);
+  if (gx < kGridWidth || gy < kGridWidth) {
+    color -= cv::Vec3d(40, 40, 40);
+  }
+  return color;
+}
+
+class RenderBody : public cv::ParallelLoopBody {
+ public:
+  RenderBody(const synthetic_rig_t &rig, const synthetic_camera_t &camera,
+      int supersampling, cv::Mat &view)
+      : rig(rig), camera(camera), supersampling(supersampling), view(view),
+      rotation(cameraRotation(camera)),
+      distorted(cv::countNonZero(camera.distCoeffs) > 0) {}
+
+  void operator()(const cv::Range &range) const override {
+    const int s = supersampling;
+    const cv::Matx33d K = camera.cameraMatrix;
+    std::vector<cv::Point2f> samples(view.cols * s * s);
+    std::vector<cv::Point2f> rays;
+    for (int y = range.start; y < range.end; ++y) {
+      for (int x = 0; x < view.cols; ++x) {
+        for (int i = 0; i < s * s; ++i) {
+          samples[x * s * s + i] = cv::Point2f(
+              x + (i % s + 0.5f) / s - 0.5f, y + (i / s + 0.5f) / s - 0.5f);
+        }
+      }
+      // rays through the samples in normalized coordinates
+      if (distorted) {
+        cv::undistortPoints(samples, rays, camera.cameraMatrix,
+            camera.distCoeffs);
+      } else {
+        rays.resize(samples.size());
+        for (size_t i = 0; i < samples.size(); ++i) {
+          rays[i] = cv::Point2f((float)((samples[i].x - K(0, 2)) / K(0, 0)),
+              (float)((samples[i].y - K(1, 2)) / K(1, 1)));
+        }
+      }
+
+      cv::Vec3b *row = view.ptr<cv::Vec3b>(y);
+      for (int x = 0; x < view.cols; ++x) {
+        cv::Vec3d sum;
+        for (int i = 0; i < s * s; ++i) {
+          sum += shade(rays[x * s * s + i]);
+        }
+        sum *= 1.0 / (s * s);
+        row[x] = cv::Vec3b(cv::saturate_cast<uchar>(sum[0]),
+            cv::saturate_cast<uchar>(sum[1]), cv::saturate_cast<uchar>(sum[2]));
+      }
+    }
+  }
+
+ private:
+  cv::Vec3d shade(const cv::Point2f &ray) const {
+    const cv::Vec3d direction = rotation * cv::Vec3d(ray.x, ray.y, 1);
+    const cv::Vec3d &C = camera.position;
+    if (direction[2] >= 0) {
+      return kSky;
+    }
+    const double t = -C[2] / direction[2];
+    const double fog = std::min(1.0,
+        t * cv::norm(direction) / (kFogRange * C[2]));
+    return floorColor(rig.boards, C[0] + t * direction[0],
+        C[1] + t * direction[1]) * (1 - fog) + kSky * fog;
+  }
+
+  const synthetic_rig_t &rig;
+  const synthetic_camera_t &camera;
+  int supersampling;
+  cv::Mat &view;
+  cv::Matx33d rotation;
+  bool distorted;
+};
+
+}
+
+cv::Mat renderView(const synthetic_rig_t &rig, size_t camera,
+    int supersampling) {
+  const synthetic_camera_t &view_camera = rig.cameras[camera];
+  cv::Mat view(view_camera.size, CV_8UC3);
+  cv::parallel_for_(cv::Range(0, view.rows), RenderBody(rig, view_camera,
+      std::max(supersampling, 1), view));
+  return view;
+}
@@ -0,0 +1,215 @@
+#include "geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double kDegrees = CV_PI / 180;
+// Canvas ends that far away from a camera, measured along the floor in
+// distances of its optical axis to the floor
+const double kMaxRange = 2;
+// Points of each side of an image the footprint and the errors are sampled at
+const int kBorderSamples = 16;
+
+cv::Matx33d rotationZ(double degrees) {
+  const double c = std::cos(degrees * kDegrees);
+  const double s = std::sin(degrees * kDegrees);
+  return cv::Matx33d(c, -s, 0, s, c, 0, 0, 0, 1);
+}
+
+cv::Matx33d rotationX(double degrees) {
+  const double c = std::cos(degrees * kDegrees);
+  const double s = std::sin(degrees * kDegrees);
+  return cv::Matx33d(1, 0, 0, 0, c, -s, 0, s, c);
+}
+
+// Points along the border of the image and across it
+std::vector<cv::Point2f> samplePoints(const cv::Size &size, bool inside) {
+  std::vector<cv::Point2f> points;
+  for (int y = 0; y <= kBorderSamples; ++y) {
+    for (int x = 0; x <= kBorderSamples; ++x) {
+      if (!inside && x > 0 && x < kBorderSamples && y > 0 &&
+          y < kBorderSamples) {
+        continue;
+      }
+      points.push_back(cv::Point2f(
+          (float)(size.width - 1) * x / kBorderSamples,
+          (float)(size.height - 1) * y / kBorderSamples));
+    }
+  }
+  return points;
+}
+
+cv::Point2d applyHomography(const cv::Mat &H, const cv::Point2d &point) {
+  const cv::Matx33d M = H;
+  const cv::Vec3d p = M * cv::Vec3d(point.x, point.y, 1);
+  return cv::Point2d(p[0] / p[2], p[1] / p[2]);
+}
+
+}
+
+cv::Matx33d cameraRotation(const synthetic_camera_t &camera) {
+  // looking along y with the floor below
+  const cv::Matx33d forward(1, 0, 0, 0, 0, 1, 0, -1, 0);
+  return rotationZ(camera.yaw) * forward * rotationX(-camera.pitch) *
+      rotationZ(camera.roll);
+}
+
+synthetic_rig_t makeSyntheticRig(const synthetic_rig_params_t &params) {
+  synthetic_rig_t rig;
+  const int n = std::max(params.cameras, 1);
+  const double focal = params.frameSize.width / 2.0 /
+      std::tan(params.fov / 2 * kDegrees);
+  // The optical axis meets the floor that far along it and along the
+  // floor, views are about twice the spacing wide there
+  const double slant = params.height / std::sin(params.pitch * kDegrees);
+  const double distance = params.height / std::tan(params.pitch * kDegrees);
+  const double spacing = slant * std::tan(params.fov / 2 * kDegrees);
+  // a board with its margin takes half of a half of a view in a chain, most
+  // of the middle of it around a common target
+  const bool chain = StitchingMode::ChainOfTargets == params.mode;
+  const double boardWidth = (chain ? 0.5 : 0.8) * spacing;
+
+  cv::Mat distortion = cv::Mat::zeros(5, 1, CV_64F);
+  for (size_t i = 0; i < std::min<size_t>(params.distortion.size(), 5); ++i) {
+    distortion.at<double>((int)i) = params.distortion[i];
+  }
+
+  cv::RNG rng(params.seed);
+  for (int i = 0; i < n; ++i) {
+    synthetic_camera_t camera;
+    camera.size = params.frameSize;
+    camera.cameraMatrix = (cv::Mat_<double>(3, 3) <<
+        focal, 0, (params.frameSize.width - 1) / 2.0,
+        0, focal, (params.frameSize.height - 1) / 2.0,
+        0, 0, 1);
+    camera.distCoeffs = distortion.clone();
+    camera.pitch = params.pitch;
+    if (chain) {
+      camera.position = cv::Vec3d((i + 0.5) * spacing, 0, params.height);
+    } else {
+      // on the arc around the board, looking at it
+      camera.yaw = n > 1 ? params.arc * ((double)i / (n - 1) - 0.5) : 0;
+      camera.position = cv::Vec3d(
+          distance * std::sin(camera.yaw * kDegrees),
+          distance - distance * std::cos(camera.yaw * kDegrees),
+          params.height);
+    }
+    camera.yaw += rng.uniform(-params.jitter, params.jitter);
+    camera.pitch += rng.uniform(-params.jitter, params.jitter);
+    camera.roll += rng.uniform(-params.jitter, params.jitter);
+    rig.cameras.push_back(camera);
+  }
+
+  for (int j = 0; j < (chain ? n + 1 : 1); ++j) {
+    synthetic_board_t board;
+    board.size = params.board;
+    board.center = cv::Point2d(j * spacing, distance);
+    // squares of the board and a margin of one square around it
+    board.square = boardWidth / (params.board.width + 3);
+    rig.boards.push_back(board);
+  }
+  return rig;
+}
+
+cv::Mat floorHomography(const synthetic_camera_t &camera) {
+  // floor point (x, y) is seen at K R^T ((x, y, 0) - C)
+  const cv::Vec3d &C = camera.position;
+  const cv::Matx33d toCamera(1, 0, -C[0], 0, 1, -C[1], 0, 0, -C[2]);
+  const cv::Matx33d K = camera.cameraMatrix;
+  cv::Mat H = cv::Mat(K * cameraRotation(camera).t() * toCamera).inv();
+  return H / H.at<double>(2, 2);
+}
+
+stitch_config_t syntheticConfig(const synthetic_rig_t &rig,
+    const std::vector<std::string> &paths, double maxMegapixels) {
+  stitch_config_t config;
+  const size_t n = rig.cameras.size();
+  config.file_paths = paths;
+  config.gains.assign(n, cv::Vec3f(1, 1, 1));
+
+  // Footprints of the cameras on the floor, cut where they reach too far
+  double minX = 0, maxX = 0, minY = 0, maxY = 0;
+  bool empty = true;
+  std::vector<cv::Mat> toFloor(n);
+  for (size_t i = 0; i < n; ++i) {
+    const synthetic_camera_t &camera = rig.cameras[i];
+    toFloor[i] = floorHomography(camera);
+    const cv::Point2d C(camera.position[0], camera.position[1]);
+    const double range = kMaxRange * camera.position[2] /
+        std::tan(std::max(camera.pitch, 1.0) * kDegrees);
+    const cv::Matx33d K = camera.cameraMatrix;
+    const cv::Matx33d R = cameraRotation(camera);
+    for (const cv::Point2f &point : samplePoints(camera.size, false)) {
+      const cv::Vec3d ray = R * (K.inv() * cv::Vec3d(point.x, point.y, 1));
+      cv::Point2d direction(ray[0], ray[1]);
+      double reach = range;
+      if (ray[2] < 0) {
+        reach = std::min(range,
+            -camera.position[2] / ray[2] * cv::norm(direction));
+      }
+      const cv::Point2d floor = C + direction * (reach /
+          std::max(cv::norm(direction), 1e-9));
+      if (empty) {
+        minX = maxX = floor.x;
+        minY = maxY = floor.y;
+        empty = false;
+      }
+      minX = std::min(minX, floor.x);
+      maxX = std::max(maxX, floor.x);
+      minY = std::min(minY, floor.y);
+      maxY = std::max(maxY, floor.y);
+    }
+  }
+
+  // Resolution of the first camera where its optical axis meets the floor
+  const synthetic_camera_t &first = rig.cameras.front();
+  double scale = first.cameraMatrix.at<double>(0, 0) *
+      std::sin(std::max(first.pitch, 1.0) * kDegrees) / first.position[2];
+  const double area = (maxX - minX) * (maxY - minY) * scale * scale;
+  if (maxMegapixels > 0 && area > maxMegapixels * 1e6) {
+    scale *= std::sqrt(maxMegapixels * 1e6 / area);
+  }
+  config.result_size = cv::Size((int)std::ceil((maxX - minX) * scale),
+      (int)std::ceil((maxY - minY) * scale));
+
+  // Seen from above with the rig at the bottom
+  const cv::Mat toCanvas = (cv::Mat_<double>(3, 3) <<
+      scale, 0, -minX * scale,
+      0, -scale, maxY * scale,
+      0, 0, 1);
+  for (size_t i = 0; i < n; ++i) {
+    config.H.push_back(toCanvas * toFloor[i]);
+    config.cameraMatrix.push_back(rig.cameras[i].cameraMatrix.clone());
+    config.distCoeffs.push_back(rig.cameras[i].distCoeffs.clone());
+    config.image_sizes.push_back(rig.cameras[i].size);
+  }
+  return config;
+}
+
+std::vector<double> alignmentErrors(const stitch_config_t &estimated,
+    const stitch_config_t &truth) {
+  const size_t n = truth.H.size();
+  if (0 == n || estimated.H.size() != n || truth.image_sizes.size() != n) {
+    return std::vector<double>();
+  }
+  // ground truth canvas to the estimated one
+  const cv::Mat S = estimated.H[0] * truth.H[0].inv();
+  const cv::Rect canvas(cv::Point(), truth.result_size);
+
+  std::vector<double> errors(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    for (const cv::Point2f &point : samplePoints(truth.image_sizes[i],
+        true)) {
+      const cv::Point2d expected = applyHomography(truth.H[i], point);
+      if (!canvas.contains(cv::Point((int)expected.x, (int)expected.y))) {
+        continue;
+      }
+      errors[i] = std::max(errors[i], cv::norm(
+          applyHomography(estimated.H[i], point) -
+          applyHomography(S, expected)));
+    }
+  }
+  return errors;
+}
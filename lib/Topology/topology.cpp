@@ -0,0 +1,409 @@
+#include "topology.hpp"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+const char kNodesPath[] = "/sys/devices/system/node";
+const std::string kNodePrefix = "node";
+// Pages sampled to tell where a buffer lives
+const size_t kMaxSampledPages = 1024;
+// Threads of the pool wait for each other that long at most. Threads which
+// miss the rendezvous are tried again, with twice as long a wait each time
+const int kRendezvousMilliseconds = 100;
+const int kRendezvousAttempts = 4;
+
+bool parseNumber(const std::string &text, int &number) {
+  if (text.empty() ||
+      text.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  number = atoi(text.c_str());
+  return true;
+}
+
+// Plain list of ranges as in sysfs, without nodes
+bool parseRanges(const std::string &list, std::vector<int> &cpus) {
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    std::string::size_type dash = item.find('-');
+    int first, last;
+    if (std::string::npos == dash) {
+      if (!parseNumber(item, first)) {
+        return false;
+      }
+      last = first;
+    } else if (!parseNumber(item.substr(0, dash), first) ||
+        !parseNumber(item.substr(dash + 1), last) || last < first) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return true;
+}
+
+std::vector<int> nodesOf(const std::vector<int> &cpus) {
+  std::vector<int> nodes;
+  for (const numa_node_t &node : numaNodes()) {
+    for (int cpu : cpus) {
+      if (std::binary_search(node.cpus.begin(), node.cpus.end(), cpu)) {
+        nodes.push_back(node.id);
+        break;
+      }
+    }
+  }
+  return nodes;
+}
+
+class PinBody : public cv::ParallelLoopBody {
+ public:
+  PinBody(const std::vector<int> &cpus, std::mutex &lock,
+      std::set<std::thread::id> &pinned, std::atomic<int> &started,
+      int total, int milliseconds)
+      : cpus(cpus), lock(lock), pinned(pinned), started(started),
+      total(total), deadline(std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(milliseconds)) {}
+
+  void operator()(const cv::Range &range) const override {
+    for (int i = range.start; i < range.end; ++i) {
+      if (pinCurrentThread(cpus)) {
+        std::lock_guard<std::mutex> guard(lock);
+        pinned.insert(std::this_thread::get_id());
+      }
+      // A thread which is busy does not take another iteration, so every
+      // thread of the pool gets one
+      ++started;
+      while (started.load() < total &&
+          std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  const std::vector<int> &cpus;
+  std::mutex &lock;
+  std::set<std::thread::id> &pinned;
+  std::atomic<int> &started;
+  int total;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+class ZeroRowsBody : public cv::ParallelLoopBody {
+ public:
+  explicit ZeroRowsBody(cv::Mat &matrix) : matrix(matrix) {}
+
+  void operator()(const cv::Range &range) const override {
+    matrix.rowRange(range.start, range.end).setTo(cv::Scalar::all(0));
+  }
+
+ private:
+  cv::Mat &matrix;
+};
+
+}
+
+std::vector<numa_node_t> numaNodes() {
+  std::vector<numa_node_t> nodes;
+  DIR *dir = opendir(kNodesPath);
+  if (dir) {
+    while (dirent *entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      numa_node_t node;
+      if (name.find(kNodePrefix) != 0 ||
+          !parseNumber(name.substr(kNodePrefix.size()), node.id)) {
+        continue;
+      }
+      std::ifstream list(std::string(kNodesPath) + "/" + name + "/cpulist");
+      std::string cpus;
+      std::getline(list, cpus);
+      // nodes of memory only have no CPUs
+      if (parseRanges(cpus, node.cpus) && !node.cpus.empty()) {
+        nodes.push_back(node);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(nodes.begin(), nodes.end(),
+      [](const numa_node_t &a, const numa_node_t &b) { return a.id < b.id; });
+
+  if (nodes.empty()) {
+    numa_node_t node;
+    node.id = 0;
+    for (int cpu = 0; cpu < cv::getNumberOfCPUs(); ++cpu) {
+      node.cpus.push_back(cpu);
+    }
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+std::vector<int> parseCpuSet(const std::string &spec) {
+  std::vector<int> cpus;
+  std::stringstream stream(spec);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.find(kNodePrefix) == 0) {
+      int id;
+      if (!parseNumber(item.substr(kNodePrefix.size()), id)) {
+        return std::vector<int>();
+      }
+      bool found = false;
+      for (const numa_node_t &node : numaNodes()) {
+        if (node.id == id) {
+          cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+          found = true;
+        }
+      }
+      if (!found) {
+        return std::vector<int>();
+      }
+    } else if (!parseRanges(item, cpus)) {
+      return std::vector<int>();
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::string formatCpuSet(const std::vector<int> &cpus) {
+  std::ostringstream out;
+  for (size_t i = 0; i < cpus.size(); ) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      ++j;
+    }
+    out << (i > 0 ? "," : "") << cpus[i];
+    if (j > i) {
+      out << "-" << cpus[j];
+    }
+    i = j + 1;
+  }
+  return out.str();
+}
+
+std::string describeCpuSet(const std::vector<int> &cpus) {
+  if (cpus.empty()) {
+    return "any cpu";
+  }
+  std::ostringstream out;
+  out << "cpus " << formatCpuSet(cpus);
+  const std::vector<int> nodes = nodesOf(cpus);
+  if (nodes.empty()) {
+    return out.str();
+  }
+  out << (nodes.size() > 1 ? " on nodes " : " on node ");
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    out << (i > 0 ? "," : "") << nodes[i];
+  }
+  return out.str();
+}
+
+std::vector<int> currentThreadCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+bool pinCurrentThread(const std::vector<int> &cpus) {
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+int pinParallelThreads(const std::vector<int> &cpus) {
+  if (!pinCurrentThread(cpus)) {
+    return 0;
+  }
+  const int threads = std::max(cv::getNumThreads(), 1);
+  std::mutex lock;
+  std::set<std::thread::id> pinned;
+  for (int attempt = 0; attempt < kRendezvousAttempts &&
+      (int)pinned.size() < threads; ++attempt) {
+    std::atomic<int> started(0);
+    cv::parallel_for_(cv::Range(0, threads), PinBody(cpus, lock, pinned,
+        started, threads, kRendezvousMilliseconds << attempt), threads);
+  }
+  return (int)pinned.size();
+}
+
+cv::Mat allocateFirstTouch(const cv::Size &size, int type) {
+  cv::Mat matrix(size, type);
+  cv::parallel_for_(cv::Range(0, matrix.rows), ZeroRowsBody(matrix));
+  return matrix;
+}
+
+WorkerPool::WorkerPool(size_t threads, const std::vector<int> &cpus)
+    : cpus(cpus) {
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+    this->threads.push_back(std::thread(&WorkerPool::run, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  queued.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+std::future<void> WorkerPool::submit(std::function<void()> job) {
+  std::packaged_task<void()> task(job);
+  std::future<void> done = task.get_future();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(std::move(task));
+  }
+  queued.notify_one();
+  return done;
+}
+
+void WorkerPool::parallelFor(int count,
+    const std::function<void(int)> &body) {
+  // every thread takes the next index until none are left
+  std::atomic<int> next(0);
+  std::vector<std::future<void>> done;
+  for (size_t i = 0; i < std::min(threads.size(), (size_t)std::max(count, 0));
+      ++i) {
+    done.push_back(submit([&]() {
+      for (int index = next++; index < count; index = next++) {
+        body(index);
+      }
+    }));
+  }
+  // the jobs refer to this frame, so all of them finish before anything
+  // is rethrown
+  std::exception_ptr error;
+  for (std::future<void> &job : done) {
+    try {
+      job.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkerPool::run() {
+  pinCurrentThread(cpus);
+  while (true) {
+    std::packaged_task<void()> job;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      queued.wait(guard, [this]() { return stopping || !jobs.empty(); });
+      if (jobs.empty()) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+InFlightSlots::InFlightSlots(size_t slots, const std::vector<int> &cpus)
+    : jobs(std::max<size_t>(slots, 1)) {
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    workers.push_back(std::unique_ptr<WorkerPool>(new WorkerPool(1, cpus)));
+  }
+}
+
+void InFlightSlots::submit(std::function<void()> job) {
+  CV_Assert(!full());
+  jobs[next()] = workers[next()]->submit(job);
+  ++submitted;
+}
+
+size_t InFlightSlots::finishOldest() {
+  CV_Assert(pending() > 0);
+  const size_t slot = finished % size();
+  ++finished;
+  jobs[slot].get();
+  return slot;
+}
+
+std::map<int, size_t> pageNodes(const void *data, size_t size) {
+  std::map<int, size_t> nodes;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const uintptr_t first = (uintptr_t)data / page * page;
+  const size_t count = ((uintptr_t)data + size - first + page - 1) / page;
+  if (0 == count) {
+    return nodes;
+  }
+  const size_t step = (count + kMaxSampledPages - 1) / kMaxSampledPages;
+
+  std::vector<void*> pages;
+  for (size_t i = 0; i < count; i += step) {
+    pages.push_back((void*)(first + i * page));
+  }
+  // move_pages without target nodes only reports where the pages are
+  std::vector<int> status(pages.size(), -1);
+  if (syscall(SYS_move_pages, 0, (unsigned long)pages.size(), pages.data(),
+      nullptr, status.data(), 0) != 0) {
+    return nodes;
+  }
+  for (int node : status) {
+    if (node >= 0) {
+      ++nodes[node];
+    }
+  }
+  return nodes;
+}
+
+std::string describePageNodes(const std::map<int, size_t> &nodes) {
+  size_t total = 0;
+  for (const auto &node : nodes) {
+    total += node.second;
+  }
+  if (0 == total) {
+    return "unknown nodes";
+  }
+  std::ostringstream out;
+  for (auto node = nodes.begin(); node != nodes.end(); ++node) {
+    out << (node != nodes.begin() ? ", " : "") << "node " << node->first
+        << " " << node->second * 100 / total << "%";
+  }
+  return out.str();
+}
@@ -0,0 +1,154 @@
+#include "replay.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#define _STRINGIFY(X) #X
+#define STRINGIFY(X) _STRINGIFY(X)
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const std::string kInputs = STRINGIFY(INPUTS_DIR);
+const std::string kGolden = STRINGIFY(GOLDEN_DIR);
+const std::string kBaselines = STRINGIFY(BASELINES_DIR);
+const std::string kConfig = "acceptance.conf.xml";
+// Stages shorter than that are too noisy to be compared relatively
+const double kSlackMs = 20;
+// Stitched images differ from the golden one by JPEG and kernel rounding
+const double kMinPsnr = 30;
+
+// Baselines are only written when asked to
+bool updateBaselines() {
+  return std::getenv("UPDATE_BASELINES") != nullptr;
+}
+
+// A missing baseline skips its check: a fresh checkout or build tree has
+// nothing to compare with yet, which is not a regression
+bool haveBaseline(const std::string &path, const std::string &check) {
+  if (std::ifstream(path.c_str()).good()) {
+    return true;
+  }
+  std::cout << "Skipped " << check << ": no baseline " << path
+      << ", record it by running the tests with UPDATE_BASELINES=1"
+      << std::endl;
+  return false;
+}
+
+bool copyFile(const std::string &from, const std::string &to) {
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::ofstream out(to.c_str(), std::ios::binary);
+  out << in.rdbuf();
+  return in.good() && (bool)out;
+}
+
+// Exit status of the tool, its output goes to the log
+int runTool(const std::string &command, const std::string &log) {
+  int status = std::system((command + " > " + log + " 2>&1").c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runs the tool PERFORMANCE_RUNS times and keeps the fastest time of every
+// stage: slow runs are noise of the machine, not of the code
+::testing::AssertionResult timeTool(const std::string &command,
+    const std::string &name, StageTimings &fastest) {
+  const std::string timings_path = name + ".timings";
+  for (int run = 0; run < PERFORMANCE_RUNS; ++run) {
+    const std::string log = name + ".log";
+    int status = runTool(command + " --timings=" + timings_path, log);
+    if (status != 0) {
+      return ::testing::AssertionFailure() << name << " exited with "
+          << status << ", see " << log;
+    }
+    StageTimings timings;
+    if (!timings.read(timings_path)) {
+      return ::testing::AssertionFailure() << name << " wrote no timings";
+    }
+    if (0 == run) {
+      fastest = timings;
+      continue;
+    }
+    StageTimings merged;
+    for (const auto &stage : timings.stages()) {
+      const double best = fastest.get(stage.first);
+      merged.add(stage.first,
+          best < 0 ? stage.second : std::min(best, stage.second));
+    }
+    fastest = merged;
+  }
+  return ::testing::AssertionSuccess();
+}
+
+void expectWithinBaseline(const StageTimings &timings,
+    const std::string &name) {
+  const std::string path = kBaselines + "/" + name + ".timings";
+  if (updateBaselines()) {
+    mkdir(kBaselines.c_str(), 0755);
+    ASSERT_TRUE(timings.write(path)) << "Failed to write " << path;
+    std::cout << "Recorded baseline " << path << std::endl;
+    return;
+  }
+  if (!haveBaseline(path, "timings of " + name)) {
+    return;
+  }
+  StageTimings baseline;
+  ASSERT_TRUE(baseline.read(path)) << "Failed to read " << path;
+  for (const auto &stage : baseline.stages()) {
+    const double ms = timings.get(stage.first);
+    EXPECT_GE(ms, 0) << name << " no longer times " << stage.first;
+    EXPECT_LE(ms, stage.second * (1 + PERFORMANCE_TOLERANCE) + kSlackMs)
+        << name << " got slower at " << stage.first << ": " << ms
+        << " ms, baseline " << stage.second << " ms";
+  }
+}
+
+}
+
+TEST(Acceptance, Calibrate) {
+  StageTimings timings;
+  ASSERT_TRUE(timeTool(std::string(STRINGIFY(CALIBRATE_PATH)) + " " +
+      kInputs + "/1a.jpg " + kInputs + "/1b.jpg -b=3x4 --s-conf=" + kConfig,
+      "calibrate", timings));
+  ASSERT_TRUE(std::ifstream(kConfig.c_str()).good());
+  expectWithinBaseline(timings, "calibrate");
+}
+
+TEST(Acceptance, Stitch) {
+  ASSERT_TRUE(std::ifstream(kConfig.c_str()).good())
+      << "Run after Acceptance.Calibrate";
+  StageTimings timings;
+  ASSERT_TRUE(timeTool(std::string(STRINGIFY(STITCH_PATH)) + " --s-conf=" +
+      kConfig, "stitch", timings));
+
+  cv::Mat result = cv::imread("final.jpg");
+  ASSERT_FALSE(result.empty());
+  const std::string golden_path = kGolden + "/final.jpg";
+  if (updateBaselines()) {
+    mkdir(kGolden.c_str(), 0755);
+    ASSERT_TRUE(copyFile("final.jpg", golden_path))
+        << "Failed to write " << golden_path;
+    std::cout << "Recorded golden image " << golden_path << std::endl;
+  } else if (haveBaseline(golden_path, "comparison of final.jpg")) {
+    cv::Mat golden = cv::imread(golden_path);
+    ASSERT_EQ(golden.size(), result.size());
+    EXPECT_GE(cv::PSNR(golden, result), kMinPsnr)
+        << "final.jpg differs from " << golden_path;
+  }
+
+  expectWithinBaseline(timings, "stitch");
+}
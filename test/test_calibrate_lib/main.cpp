@@ -1,9 +1,12 @@
+#include "prefilter.hpp"
+#include "scan.hpp"
 #include "utils.hpp"
 
 #include "gtest/gtest.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 
 #include <iostream>
 #include <string>
@@ -414,3 +417,113 @@ TEST(OrderChessboardCorners, RealImage3) {
   if (HasFatalFailure())
     FAIL() << "result: " << result;
 }
+
+TEST(ViewChessboardCorners, RefersToDetectionBuffer) {
+  cv::Size boardSize(4, 3);
+  std::vector<cv::Point2f> input;
+  // by columns, transposed: every column of the input is a row of the board
+  // read from right to left
+  for (int i = 0; i < boardSize.height; ++i) {
+    append(input, column(i + 1, boardSize.width, Direction::DEC));
+  }
+
+  chessboard_view_t view = viewChessboardCorners(input, boardSize);
+  EXPECT_EQ(view.points, input.data());
+  EXPECT_EQ(view.rows, boardSize.height);
+  EXPECT_EQ(view.cols, boardSize.width);
+
+  auto expected = orderChessboardCorners(input, boardSize);
+  for (int y = 0; y < view.rows; ++y) {
+    for (int x = 0; x < view.cols; ++x) {
+      EXPECT_EQ(view.at(y, x), expected[y][x]) << "y, x = " << y << ", " << x;
+    }
+  }
+  EXPECT_EQ(extractCorners(view), extractCorners(expected));
+  EXPECT_EQ(angleToHorizon(view), angleToHorizon(input, boardSize));
+}
+
+TEST(ChooseCalibrationFrame, PicksBestSynchronizedSet) {
+  std::vector<std::vector<float>> scores = {
+    {kNoBoard, 0.5f, 3.0f, 1.5f, 0.2f},
+    {0.1f, kNoBoard, 0.4f, 0.8f, 2.0f, 0.1f},
+  };
+
+  float angle = 0;
+  // the last frame of the second camera has no pair, the worst angle of
+  // the third set is the smallest
+  EXPECT_EQ(3, chooseCalibrationFrame(scores, angle));
+  EXPECT_FLOAT_EQ(1.5f, angle);
+
+  scores[0][3] = kNoBoard;
+  EXPECT_EQ(4, chooseCalibrationFrame(scores, angle));
+  EXPECT_FLOAT_EQ(2.0f, angle);
+
+  scores[1][4] = kNoBoard;
+  scores[0][2] = kNoBoard;
+  EXPECT_EQ(-1, chooseCalibrationFrame(scores, angle));
+}
+
+TEST(FrameFilter, RejectsHopelessFrames) {
+  // 6x4 squares make 5x3 inner corners
+  const cv::Size chessboardSize(5, 3);
+  const int square = 60;
+  cv::Mat board(480, 640, CV_8UC3, cv::Scalar::all(255));
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 6; ++x) {
+      if ((x + y) % 2 == 0) {
+        cv::rectangle(board, cv::Rect(140 + x * square, 120 + y * square,
+            square, square), cv::Scalar::all(0), CV_FILLED);
+      }
+    }
+  }
+
+  frame_filter_t filter;
+  EXPECT_TRUE(passesFrameFilter(board, chessboardSize, filter));
+
+  cv::Mat dark(480, 640, CV_8UC3, cv::Scalar::all(20));
+  EXPECT_FALSE(passesFrameFilter(dark, chessboardSize, filter));
+  EXPECT_EQ(1, filter.rejected[(int)FilterStage::Contrast]);
+
+  cv::Mat blurry;
+  cv::GaussianBlur(board, blurry, cv::Size(0, 0), 8);
+  EXPECT_FALSE(passesFrameFilter(blurry, chessboardSize, filter));
+  EXPECT_EQ(1, filter.rejected[(int)FilterStage::Sharpness]);
+
+  // sharp and contrast, but has only four corners
+  cv::Mat box(480, 640, CV_8UC3, cv::Scalar::all(255));
+  cv::rectangle(box, cv::Rect(200, 150, 240, 180), cv::Scalar::all(0),
+      CV_FILLED);
+  EXPECT_FALSE(passesFrameFilter(box, chessboardSize, filter));
+  EXPECT_EQ(1, filter.rejected[(int)FilterStage::Checkerboard]);
+
+  EXPECT_EQ(4, filter.checked);
+  EXPECT_EQ(1, filter.searched);
+}
+
+TEST(FrameFilter, PassesSmallDistantBoard) {
+  // 6x4 squares of 7 pixels in a 1080p frame are about 2 pixels in the
+  // downsampled copy, findChessboardCorners still finds such boards
+  const cv::Size chessboardSize(5, 3);
+  const int square = 7;
+  cv::Mat frame(1080, 1920, CV_8UC3);
+  for (int x = 0; x < frame.cols; ++x) {
+    frame.col(x).setTo(cv::Scalar::all(40 + 175 * x / frame.cols));
+  }
+  const cv::Point origin(1200, 600);
+  cv::rectangle(frame, cv::Rect(origin.x - square, origin.y - square,
+      8 * square, 6 * square), cv::Scalar::all(255), CV_FILLED);
+  for (int y = 0; y < 4; ++y) {
+    for (int x = 0; x < 6; ++x) {
+      if ((x + y) % 2 == 0) {
+        cv::rectangle(frame, cv::Rect(origin.x + x * square,
+            origin.y + y * square, square, square), cv::Scalar::all(0),
+            CV_FILLED);
+      }
+    }
+  }
+  cv::GaussianBlur(frame, frame, cv::Size(0, 0), 1);
+
+  frame_filter_t filter;
+  EXPECT_TRUE(passesFrameFilter(frame, chessboardSize, filter));
+  EXPECT_EQ(0, filter.rejected[(int)FilterStage::Checkerboard]);
+}
@@ -0,0 +1,111 @@
+#include "capture.hpp"
+#include "replay.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+// Frame of the camera which differs from frames of other cameras and
+// other moments
+cv::Mat frameAt(int index, int camera, const cv::Size &size, int type) {
+  cv::Mat frame(size, type);
+  cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+  frame.at<uchar>(0, 0) = (uchar)(index * 16 + camera);
+  return frame;
+}
+
+}
+
+TEST(RawFrameFile, ReadsWhatWasWritten) {
+  const std::string path = "test_capture_lib.raw";
+  const std::vector<cv::Size> sizes = {cv::Size(64, 48), cv::Size(33, 17)};
+  const std::vector<int> types = {CV_8UC3, CV_8UC1};
+  const int count = 3;
+
+  std::vector<std::vector<cv::Mat>> written(count);
+  {
+    RawFrameWriter writer(path, sizes, types);
+    ASSERT_TRUE(writer.isOpened());
+    for (int index = 0; index < count; ++index) {
+      for (size_t i = 0; i < sizes.size(); ++i) {
+        written[index].push_back(frameAt(index, (int)i, sizes[i], types[i]));
+      }
+      // a submatrix has padded rows
+      cv::Mat wide = frameAt(index, 1, cv::Size(40, 17), CV_8UC1);
+      written[index][1] = wide(cv::Rect(0, 0, 33, 17));
+      std::vector<int64_t> timestamps = {index * 1000, index * 1000 + 7};
+      ASSERT_TRUE(writer.write(written[index], timestamps));
+    }
+    // frames must match the layout
+    EXPECT_FALSE(writer.write({written[0][1], written[0][0]}, {0, 0}));
+  }
+
+  RawFrameFile file(path);
+  ASSERT_TRUE(file.isOpened());
+  ASSERT_EQ(sizes.size(), file.cameras());
+  ASSERT_EQ((size_t)count, file.frames());
+  for (int index = 0; index < count; ++index) {
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      cv::Mat frame = file.frame(index, i);
+      EXPECT_EQ(sizes[i], frame.size());
+      EXPECT_EQ(types[i], frame.type());
+      EXPECT_EQ(0u, (size_t)frame.data % kRawAlignment);
+      EXPECT_EQ(0, cv::norm(frame, written[index][i], cv::NORM_INF));
+    }
+    EXPECT_EQ(index * 1000 + 7, file.timestamp(index, 1));
+  }
+
+  std::vector<std::string> paths = expandFramePaths({path});
+  ASSERT_EQ(2u, paths.size());
+  EXPECT_EQ(path + "#1", paths[1]);
+
+  FrameSource source(paths[1]);
+  ASSERT_TRUE(source.isOpened());
+  EXPECT_EQ(count, source.count());
+  ASSERT_TRUE(source.seek(1));
+  cv::Mat frame;
+  ASSERT_TRUE(source.read(frame));
+  EXPECT_EQ(0, cv::norm(frame, written[1][1], cv::NORM_INF));
+  EXPECT_EQ(1007, source.timestamp());
+  ASSERT_TRUE(source.grab());
+  EXPECT_FALSE(source.read(frame));
+  EXPECT_TRUE(frame.empty());
+
+  EXPECT_FALSE(FrameSource(path + "#2").isOpened());
+  std::remove(path.c_str());
+}
+
+TEST(Replay, ChecksumsAndLatencies) {
+  cv::Mat wide = frameAt(0, 0, cv::Size(50, 20), CV_8UC3);
+  cv::Mat image = wide(cv::Rect(5, 0, 40, 20));
+  // padding of rows does not change the checksum, pixels do
+  uint64_t checksum = imageChecksum(image);
+  EXPECT_EQ(checksum, imageChecksum(image.clone()));
+  cv::Mat changed = image.clone();
+  changed.at<cv::Vec3b>(19, 39)[2] ^= 1;
+  EXPECT_NE(checksum, imageChecksum(changed));
+  EXPECT_NE(combineChecksums(combineChecksums(0, checksum), 1),
+      combineChecksums(combineChecksums(0, 1), checksum));
+
+  LatencyStats stats;
+  for (int i = 100; i >= 1; --i) {
+    stats.add(i);
+  }
+  EXPECT_EQ(100u, stats.count());
+  EXPECT_DOUBLE_EQ(50.5, stats.mean());
+  EXPECT_DOUBLE_EQ(1, stats.percentile(0));
+  EXPECT_DOUBLE_EQ(51, stats.percentile(50));
+  EXPECT_DOUBLE_EQ(99, stats.percentile(99));
+  EXPECT_DOUBLE_EQ(100, stats.percentile(100));
+}
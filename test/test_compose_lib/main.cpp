@@ -0,0 +1,594 @@
+#include "compose.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+cv::Mat randomImage(const cv::Size &size, int type = CV_8UC3) {
+  cv::Mat image(size, type);
+  cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+  return image;
+}
+
+cv::Mat translation(double dx, double dy) {
+  return (cv::Mat_<double>(3, 3) <<
+      1, 0, dx,
+      0, 1, dy,
+      0, 0, 1);
+}
+
+// Homography between a camera turned by degrees to the right and the one
+// looking forward, both with camera matrix K
+cv::Mat turnedCamera(const cv::Mat &K, double degrees) {
+  const double a = degrees * CV_PI / 180;
+  cv::Mat R = (cv::Mat_<double>(3, 3) <<
+      cos(a), 0, sin(a),
+      0, 1, 0,
+      -sin(a), 0, cos(a));
+  return K * R * K.inv();
+}
+
+}
+
+TEST(BuildWarpMaps, IdentityCoversImage) {
+  cv::Size size(64, 48);
+  warp_maps_t maps;
+  buildWarpMaps(cv::Mat::eye(3, 3, CV_64F), cv::Mat(), cv::Mat(), size,
+      size, maps);
+
+  ASSERT_EQ(maps.roi, cv::Rect(0, 0, size.width, size.height));
+  for (int y = 0; y < size.height; ++y) {
+    for (int x = 0; x < size.width; ++x) {
+      const cv::Vec2f &P = maps.map.at<cv::Vec2f>(y, x);
+      ASSERT_FLOAT_EQ(P[0], x);
+      ASSERT_FLOAT_EQ(P[1], y);
+    }
+  }
+}
+
+TEST(BuildWarpMaps, RoiIsFootprint) {
+  warp_maps_t maps;
+  buildWarpMaps(translation(10, 20), cv::Mat(), cv::Mat(), cv::Size(30, 40),
+      cv::Size(100, 100), maps);
+
+  EXPECT_EQ(maps.roi.x, 10);
+  EXPECT_EQ(maps.roi.y, 20);
+  EXPECT_GE(maps.roi.width, 30);
+  EXPECT_GE(maps.roi.height, 40);
+  EXPECT_EQ(maps.map.size(), maps.roi.size());
+}
+
+TEST(RemapTransparent, IdentityCopiesImage) {
+  cv::Mat image = randomImage(cv::Size(64, 48));
+  warp_maps_t maps;
+  buildWarpMaps(cv::Mat::eye(3, 3, CV_64F), cv::Mat(), cv::Mat(),
+      image.size(), image.size(), maps);
+
+  cv::Mat canvas = cv::Mat::zeros(image.size(), CV_8UC3);
+  remapTransparent(image, maps, cv::Vec3f(1, 1, 1), canvas);
+  EXPECT_EQ(cv::norm(image, canvas, cv::NORM_INF), 0);
+}
+
+TEST(RemapTransparent, MatchesWarpPerspective) {
+  cv::Mat image = randomImage(cv::Size(80, 60));
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.9, 0.1, 12,
+      -0.05, 1.1, 7,
+      0.0002, 0.0001, 1);
+  cv::Size canvasSize(120, 100);
+
+  cv::Mat expected = cv::Mat::zeros(canvasSize, CV_8UC3);
+  cv::warpPerspective(image, expected, H, canvasSize, cv::INTER_LINEAR,
+      cv::BORDER_TRANSPARENT);
+
+  warp_maps_t maps;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), image.size(), canvasSize, maps);
+  cv::Mat canvas = cv::Mat::zeros(canvasSize, CV_8UC3);
+  remapTransparent(image, maps, cv::Vec3f(1, 1, 1), canvas);
+
+  // Interpolation is done with different precision, and pixels at the very
+  // border of the footprint are handled differently
+  cv::Mat diff;
+  cv::absdiff(expected, canvas, diff);
+  cv::Mat large = diff.reshape(1) > 2;
+  EXPECT_LT(cv::countNonZero(large), canvasSize.area() / 20);
+}
+
+TEST(RemapTransparent, AppliesGain) {
+  cv::Mat image(cv::Size(16, 16), CV_8UC3, cv::Scalar(100, 100, 200));
+  warp_maps_t maps;
+  buildWarpMaps(cv::Mat::eye(3, 3, CV_64F), cv::Mat(), cv::Mat(),
+      image.size(), image.size(), maps);
+
+  cv::Mat canvas = cv::Mat::zeros(image.size(), CV_8UC3);
+  remapTransparent(image, maps, cv::Vec3f(0.5f, 1.5f, 1.5f), canvas);
+  EXPECT_EQ(canvas.at<cv::Vec3b>(8, 8), cv::Vec3b(50, 150, 255));
+}
+
+TEST(EstimateGains, EqualizesOverlap) {
+  cv::Size size(100, 100);
+  cv::Mat base = randomImage(size);
+  cv::Mat darker;
+  base.convertTo(darker, -1, 0.5);
+
+  std::vector<cv::Mat> images;
+  images.push_back(base);
+  images.push_back(darker);
+  std::vector<cv::Mat> H;
+  H.push_back(cv::Mat::eye(3, 3, CV_64F));
+  H.push_back(cv::Mat::eye(3, 3, CV_64F));
+
+  std::vector<cv::Vec3f> gains = estimateGains(images, H, size);
+  ASSERT_EQ(gains.size(), 2u);
+
+  // Gains are regularized towards 1, so the difference is not removed
+  // completely, but it must become much smaller
+  cv::Scalar m0 = cv::mean(base);
+  cv::Scalar m1 = cv::mean(darker);
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_GT(gains[1][c], gains[0][c]);
+    EXPECT_LT(fabs(gains[0][c] * m0[c] - gains[1][c] * m1[c]),
+        fabs(m0[c] - m1[c]) / 2);
+  }
+}
+
+TEST(RemapTransparent, KernelsMatchScalar) {
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.8, 0.3, 5,
+      -0.2, 0.9, 30,
+      0.001, -0.0005, 1);
+  cv::Size canvasSize(150, 130);
+  warp_maps_t maps;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), cv::Size(97, 61), canvasSize, maps);
+  const cv::Vec3f gain(0.9f, 1.0f, 1.2f);
+
+  // BGR frames and luma and chroma planes of NV12
+  const int types[] = { CV_8UC3, CV_8UC1, CV_8UC2 };
+  for (int type : types) {
+    cv::Mat image = randomImage(cv::Size(97, 61), type);
+    cv::Mat background = randomImage(canvasSize, type);
+    cv::Mat expected = background.clone();
+    remapTransparent(image, maps, gain, expected, RemapKernel::Scalar);
+
+    const RemapKernel kernels[] = { RemapKernel::SSE42, RemapKernel::AVX2,
+        RemapKernel::AVX512, RemapKernel::Auto };
+    for (RemapKernel kernel : kernels) {
+      if (!isRemapKernelSupported(kernel)) {
+        continue;
+      }
+      cv::Mat canvas = background.clone();
+      remapTransparent(image, maps, gain, canvas, kernel);
+      EXPECT_EQ(cv::norm(expected, canvas, cv::NORM_INF), 0)
+          << "kernel: " << remapKernelName(kernel) << ", type: " << type;
+    }
+  }
+}
+
+TEST(BuildWarpMaps, SparseMapIsAccurate) {
+  cv::Size imageSize(320, 240);
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.8, 0.3, 5,
+      -0.2, 0.9, 30,
+      0.0005, -0.0002, 1);
+  cv::Size canvasSize(500, 400);
+
+  warp_maps_t dense;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), imageSize, canvasSize, dense);
+  warp_maps_t sparse;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), imageSize, canvasSize, sparse, 16);
+
+  ASSERT_EQ(sparse.roi, dense.roi);
+  ASSERT_EQ(sparse.map.size(), warpMapSize(sparse.roi, 16));
+  EXPECT_LT(sparse.map.total(), dense.map.total() / 100);
+  EXPECT_GT(sparse.maxError, 0);
+  EXPECT_LT(sparse.maxError, 0.5);
+
+  // reported error must bound the actual difference
+  std::vector<float> row(2 * sparse.roi.width);
+  for (int y = 0; y < sparse.roi.height; ++y) {
+    interpolateMapRow(sparse, y, row.data());
+    const cv::Vec2f *expected = dense.map.ptr<cv::Vec2f>(y);
+    for (int x = 0; x < sparse.roi.width; ++x) {
+      if (expected[x][0] < 0) {
+        continue;
+      }
+      ASSERT_LE(hypot(row[2 * x] - expected[x][0],
+          row[2 * x + 1] - expected[x][1]), sparse.maxError + 1e-4);
+    }
+  }
+}
+
+TEST(RemapTransparent, SparseMapMatchesDense) {
+  cv::Mat image;
+  cv::GaussianBlur(randomImage(cv::Size(160, 120)), image, cv::Size(0, 0), 3);
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      1.1, 0.2, 10,
+      -0.1, 1.0, 20,
+      0.0002, 0.0001, 1);
+  cv::Size canvasSize(260, 220);
+
+  warp_maps_t dense;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), image.size(), canvasSize, dense);
+  warp_maps_t sparse;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), image.size(), canvasSize, sparse, 8);
+
+  cv::Mat expected = cv::Mat::zeros(canvasSize, CV_8UC3);
+  remapTransparent(image, dense, cv::Vec3f(1, 1, 1), expected);
+  cv::Mat canvas = cv::Mat::zeros(canvasSize, CV_8UC3);
+  remapTransparent(image, sparse, cv::Vec3f(1, 1, 1), canvas);
+
+  // Coordinates differ by a fraction of a pixel, which is visible only at
+  // the border of the footprint
+  cv::Mat diff;
+  cv::absdiff(expected, canvas, diff);
+  cv::Mat large = diff.reshape(1) > 16;
+  EXPECT_LT(cv::countNonZero(large), canvasSize.area() / 20);
+}
+
+TEST(PlanTiles, CoversRoiOnce) {
+  cv::Size imageSize(320, 240);
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.2, -0.9, 300,
+      0.9, 0.2, 10,
+      0.0005, -0.0002, 1);
+  warp_maps_t maps;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), imageSize, cv::Size(400, 400), maps);
+  planTiles(maps, imageSize, 16 * 1024);
+  ASSERT_GT(maps.tiles.size(), 1u);
+
+  cv::Mat covered = cv::Mat::zeros(maps.roi.size(), CV_8UC1);
+  for (const cv::Rect &tile : maps.tiles) {
+    ASSERT_EQ(tile & cv::Rect(cv::Point(), maps.roi.size()), tile);
+    cv::Mat cell = covered(tile);
+    cell += cv::Scalar::all(1);
+  }
+  EXPECT_EQ(cv::countNonZero(covered != 1), 0);
+}
+
+TEST(PlanTiles, CountsComposedPixels) {
+  const cv::Size imageSize(100, 80);
+  const cv::Size canvasSize(170, 90);
+  const cv::Mat white(imageSize, CV_8UC3, cv::Scalar::all(255));
+  std::vector<warp_maps_t> maps(2);
+  // the second camera is rotated, so its tiles are partly outside of the
+  // footprint
+  buildWarpMaps(translation(0, 5), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, maps[0]);
+  buildWarpMaps((cv::Mat_<double>(3, 3) <<
+      0.9, -0.3, 80,
+      0.3, 0.9, -10,
+      0, 0, 1), cv::Mat(), cv::Mat(), imageSize, canvasSize, maps[1], 4);
+  cv::Mat owners = buildOwnerMap(maps,
+      std::vector<cv::Size>(2, imageSize), canvasSize);
+
+  for (int i = 0; i < 2; ++i) {
+    applyOwnerMap(maps[i], owners, i);
+    planTiles(maps[i], imageSize, 8 * 1024);
+    ASSERT_EQ(maps[i].tiles.size(), maps[i].tilePixels.size());
+
+    cv::Mat canvas = cv::Mat::zeros(canvasSize, CV_8UC3);
+    remapTransparent(white, maps[i], cv::Vec3f(1, 1, 1), canvas);
+    cv::Mat composed;
+    cv::cvtColor(canvas, composed, cv::COLOR_BGR2GRAY);
+    int total = 0;
+    for (size_t t = 0; t < maps[i].tiles.size(); ++t) {
+      EXPECT_LE(maps[i].tilePixels[t], maps[i].tiles[t].area());
+      total += maps[i].tilePixels[t];
+    }
+    EXPECT_EQ(cv::countNonZero(composed), total) << "camera #" << i;
+  }
+}
+
+TEST(RemapTransparent, BlocksMatchRows) {
+  cv::Mat image = randomImage(cv::Size(160, 120));
+  // rotated by almost 90 degrees, so canvas rows go along source columns
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.1, -1.2, 200,
+      1.1, 0.15, 5,
+      0.0003, 0.0001, 1);
+  cv::Size canvasSize(260, 240);
+  const cv::Vec3f gain(1.1f, 1.0f, 0.9f);
+
+  const int grids[] = { 1, 5 };
+  for (int grid : grids) {
+    warp_maps_t maps;
+    buildWarpMaps(H, cv::Mat(), cv::Mat(), image.size(), canvasSize, maps,
+        grid);
+    cv::Mat expected = randomImage(canvasSize);
+    cv::Mat canvas = expected.clone();
+    remapTransparent(image, maps, gain, expected);
+
+    planTiles(maps, image.size(), 16 * 1024);
+    ASSERT_GT(maps.tiles.size(), 1u);
+    remapTransparent(image, maps, gain, canvas);
+    EXPECT_EQ(cv::norm(expected, canvas, cv::NORM_INF), 0) << "grid " << grid;
+  }
+}
+
+TEST(OwnerMap, SplitsOverlapBetweenCameras) {
+  // two 100x80 images overlapping by 40 columns
+  const cv::Size imageSize(100, 80);
+  const cv::Size canvasSize(170, 90);
+  std::vector<warp_maps_t> maps(2);
+  buildWarpMaps(translation(0, 5), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, maps[0]);
+  buildWarpMaps(translation(60, 5), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, maps[1]);
+  std::vector<cv::Size> imageSizes(2, imageSize);
+
+  cv::Mat owners = buildOwnerMap(maps, imageSizes, canvasSize);
+  ASSERT_EQ(owners.type(), CV_8UC1);
+  ASSERT_EQ(owners.size(), canvasSize);
+
+  EXPECT_EQ(owners.at<uint8_t>(0, 50), kNoOwner);
+  EXPECT_EQ(owners.at<uint8_t>(40, 10), 0);
+  EXPECT_EQ(owners.at<uint8_t>(40, 150), 1);
+  EXPECT_EQ(owners.at<uint8_t>(40, 165), kNoOwner);
+  // the overlap is split in the middle between image centers
+  EXPECT_EQ(owners.at<uint8_t>(40, 75), 0);
+  EXPECT_EQ(owners.at<uint8_t>(40, 84), 1);
+
+  cv::Mat decoded = decodeOwnerMap(encodeOwnerMap(owners), canvasSize);
+  EXPECT_EQ(cv::countNonZero(decoded != owners), 0);
+}
+
+TEST(RemapTransparent, OwnerMapSamplesOneCamera) {
+  const cv::Size imageSize(100, 80);
+  const cv::Size canvasSize(170, 90);
+  std::vector<cv::Mat> images = { randomImage(imageSize),
+      randomImage(imageSize) };
+  std::vector<warp_maps_t> maps(2);
+  buildWarpMaps(translation(0, 5), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, maps[0]);
+  buildWarpMaps(translation(60, 5), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, maps[1]);
+  cv::Mat owners = buildOwnerMap(maps,
+      std::vector<cv::Size>(2, imageSize), canvasSize);
+
+  cv::Mat background = randomImage(canvasSize);
+  std::vector<cv::Mat> separate(2);
+  for (int i = 0; i < 2; ++i) {
+    separate[i] = background.clone();
+    remapTransparent(images[i], maps[i], cv::Vec3f(1, 1, 1), separate[i]);
+  }
+  cv::Mat expected = background.clone();
+  separate[0].copyTo(expected, owners == 0);
+  separate[1].copyTo(expected, owners == 1);
+
+  cv::Mat canvas = background.clone();
+  for (int i = 0; i < 2; ++i) {
+    applyOwnerMap(maps[i], owners, i);
+    planTiles(maps[i], imageSize, 8 * 1024);
+    remapTransparent(images[i], maps[i], cv::Vec3f(1, 1, 1), canvas);
+  }
+  EXPECT_EQ(cv::norm(expected, canvas, cv::NORM_INF), 0);
+}
+
+TEST(DetectChanges, RecomposesOnlyDirtyTiles) {
+  cv::Mat frame = randomImage(cv::Size(160, 120));
+  cv::Mat H = (cv::Mat_<double>(3, 3) <<
+      0.9, 0.2, 10,
+      -0.1, 1.1, 20,
+      0.0003, 0.0001, 1);
+  cv::Size canvasSize(240, 220);
+  warp_maps_t maps;
+  buildWarpMaps(H, cv::Mat(), cv::Mat(), frame.size(), canvasSize, maps);
+  planTiles(maps, frame.size(), 8 * 1024);
+  planTileSources(maps, frame.size());
+
+  frame_changes_t changes;
+  changes.block = 16;
+  std::vector<int> dirty;
+  cv::Mat canvas = cv::Mat::zeros(canvasSize, CV_8UC3);
+  EXPECT_GT(detectChanges(frame, changes, 4), 0);
+  selectDirtyTiles(maps, changes, dirty);
+  EXPECT_EQ(dirty.size(), maps.tiles.size());
+  remapTransparentTiles(frame, maps, dirty, cv::Vec3f(1, 1, 1), canvas);
+
+  // the same frame again
+  EXPECT_EQ(detectChanges(frame.clone(), changes, 4), 0);
+  selectDirtyTiles(maps, changes, dirty);
+  EXPECT_TRUE(dirty.empty());
+
+  cv::Mat next = frame.clone();
+  cv::Mat patch = next(cv::Rect(70, 50, 10, 10));
+  randomImage(patch.size()).copyTo(patch);
+  EXPECT_GT(detectChanges(next, changes, 4), 0);
+  selectDirtyTiles(maps, changes, dirty);
+  EXPECT_GT(dirty.size(), 0u);
+  EXPECT_LT(dirty.size(), maps.tiles.size());
+  remapTransparentTiles(next, maps, dirty, cv::Vec3f(1, 1, 1), canvas);
+
+  cv::Mat expected = cv::Mat::zeros(canvasSize, CV_8UC3);
+  remapTransparent(next, maps, cv::Vec3f(1, 1, 1), expected);
+  EXPECT_EQ(cv::norm(expected, canvas, cv::NORM_INF), 0);
+}
+
+TEST(RemapTransparentNV12, ShiftsBothPlanes) {
+  const cv::Size imageSize(64, 48);
+  const cv::Size canvasSize(100, 70);
+  cv::Mat frame;
+  convertBGRToNV12(randomImage(imageSize), frame);
+
+  warp_maps_t luma, chroma;
+  buildWarpMaps(translation(10, 6), cv::Mat(), cv::Mat(), imageSize,
+      canvasSize, luma);
+  buildChromaMaps(luma, imageSize, chroma);
+
+  cv::Mat canvas = createNV12Canvas(canvasSize);
+  remapTransparentNV12(frame, luma, chroma, 1.0f, canvas);
+  EXPECT_EQ(canvasSize, nv12ImageSize(canvas));
+
+  cv::Mat frameLuma, frameChroma, canvasLuma, canvasChroma;
+  splitNV12(frame, frameLuma, frameChroma);
+  splitNV12(canvas, canvasLuma, canvasChroma);
+  EXPECT_EQ(cv::norm(frameLuma,
+      canvasLuma(cv::Rect(cv::Point(10, 6), imageSize)), cv::NORM_INF), 0);
+  EXPECT_EQ(cv::norm(frameChroma,
+      canvasChroma(cv::Rect(cv::Point(5, 3), cv::Size(32, 24))),
+      cv::NORM_INF), 0);
+
+  // the rest of the canvas stays black
+  EXPECT_EQ(canvasLuma.at<uint8_t>(5, 9), 0);
+  EXPECT_EQ(canvasChroma.at<cv::Vec2b>(2, 4), cv::Vec2b(128, 128));
+  EXPECT_EQ(canvasChroma.at<cv::Vec2b>(27, 37), cv::Vec2b(128, 128));
+}
+
+TEST(RemapTransparent, EveryPixelType) {
+  const cv::Size imageSize(40, 30);
+  warp_maps_t maps;
+  buildWarpMaps(translation(5, 3), cv::Mat(), cv::Mat(), imageSize,
+      cv::Size(60, 40), maps);
+  const cv::Rect target(cv::Point(5, 3), imageSize);
+
+  const int types[] = { CV_8UC1, CV_8UC2, CV_8UC3, CV_8UC4, CV_16UC1 };
+  for (int type : types) {
+    ASSERT_TRUE(isRemapTypeSupported(type));
+    const double maxValue = CV_8U == CV_MAT_DEPTH(type) ? 255 : 65535;
+    cv::Mat image(imageSize, type);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(maxValue + 1));
+
+    const remap_kernel_t kernel = selectRemapKernel(type);
+    EXPECT_EQ(kernel.type, type);
+    cv::Mat canvas = cv::Mat::zeros(cv::Size(60, 40), type);
+    remapTransparent(image, maps, cv::Vec3f(1, 1, 1), canvas, kernel);
+    EXPECT_EQ(cv::norm(image, canvas(target), cv::NORM_INF), 0) << type;
+    EXPECT_EQ(cv::countNonZero(canvas.reshape(1).colRange(0,
+        5 * CV_MAT_CN(type))), 0) << type;
+
+    // values saturate at the maximum of the depth
+    image.setTo(cv::Scalar::all(maxValue - 1));
+    remapTransparent(image, maps, cv::Vec3f(2, 2, 2), canvas, kernel);
+    double minValue;
+    cv::minMaxLoc(canvas(target).reshape(1), &minValue);
+    EXPECT_EQ(minValue, CV_8UC4 == type ? maxValue - 1 : maxValue) << type;
+  }
+  EXPECT_FALSE(isRemapTypeSupported(CV_32FC3));
+}
+
+TEST(FitProjection, CanvasGrowsWithFieldOfView) {
+  const double f = 300;
+  const cv::Mat K = (cv::Mat_<double>(3, 3) <<
+      f, 0, 320,
+      0, f, 240,
+      0, 0, 1);
+  const std::vector<cv::Size> sizes(3, cv::Size(640, 480));
+  // homographies are defined up to a scale, including its sign
+  const std::vector<cv::Mat> H = { turnedCamera(K, 0),
+      cv::Mat(-turnedCamera(K, -30)), turnedCamera(K, 30) };
+  // the outer cameras are 60 degrees apart
+  const double width = (CV_PI / 3 + 2 * atan(320 / f)) * f;
+
+  const Projection types[] = { Projection::Cylindrical,
+      Projection::Spherical };
+  for (Projection type : types) {
+    cv::Size canvasSize;
+    projection_t projection;
+    ASSERT_TRUE(fitProjection(type, H, K, sizes, projection, canvasSize));
+    EXPECT_NEAR(canvasSize.width, width, 2);
+    const double height = 2 * f * (Projection::Cylindrical == type
+        ? 240 / f : atan(240 / f));
+    EXPECT_NEAR(canvasSize.height, height, 2);
+
+    // the optical axis of the right camera is 30 degrees to the right
+    cv::Point2d center = directionToCanvas(projection,
+        cv::Vec3d(sin(CV_PI / 6), 0, cos(CV_PI / 6)));
+    warp_maps_t maps;
+    buildWarpMaps(H[2], projection, cv::Mat(), cv::Mat(), sizes[2],
+        canvasSize, maps);
+    ASSERT_TRUE(maps.roi.contains(center));
+    const cv::Vec2f &P = maps.map.at<cv::Vec2f>(
+        (int)round(center.y) - maps.roi.y, (int)round(center.x) - maps.roi.x);
+    EXPECT_NEAR(P[0], 320, 1);
+    EXPECT_NEAR(P[1], 240, 1);
+    EXPECT_LE(maps.roi.width, 640 * 1.1);
+  }
+}
+
+TEST(FitProjection, BoundsCanvasOfSteepCameras) {
+  const double f = 300;
+  const cv::Mat K = (cv::Mat_<double>(3, 3) <<
+      f, 0, 320,
+      0, f, 240,
+      0, 0, 1);
+  const std::vector<cv::Size> sizes(2, cv::Size(640, 480));
+  // an edge of the view of the second camera runs through the axis of the
+  // cylinder, where heights on it are infinite
+  const double a = CV_PI / 2 - atan(240 / f);
+  const cv::Mat R = (cv::Mat_<double>(3, 3) <<
+      1, 0, 0,
+      0, cos(a), -sin(a),
+      0, sin(a), cos(a));
+  const std::vector<cv::Mat> H = { turnedCamera(K, 0),
+      cv::Mat(K * R * K.inv()) };
+
+  cv::Size canvasSize;
+  projection_t projection;
+  ASSERT_TRUE(fitProjection(Projection::Cylindrical, H, K, sizes, projection,
+      canvasSize));
+  // cut at 75 degrees from the horizon
+  EXPECT_LE(canvasSize.height, f * (tan(75 * CV_PI / 180) + 240 / f) + 3);
+  EXPECT_LE(canvasSize.width, 2 * CV_PI * f + 3);
+  ASSERT_TRUE(fitProjection(Projection::Spherical, H, K, sizes, projection,
+      canvasSize));
+  EXPECT_LE(canvasSize.height, CV_PI * f + 3);
+
+  // a degenerate homography has no canvas
+  const std::vector<cv::Mat> degenerate = { turnedCamera(K, 0),
+      cv::Mat(cv::Mat::zeros(3, 3, CV_64F)) };
+  EXPECT_FALSE(fitProjection(Projection::Cylindrical, degenerate, K, sizes,
+      projection, canvasSize));
+}
+
+TEST(LargestCoveredRect, SkipsUncoveredBorders) {
+  cv::Mat owners(40, 60, CV_8UC1, cv::Scalar(kNoOwner));
+  // an L-shaped area and a notch in it
+  owners(cv::Rect(5, 5, 50, 10)).setTo(0);
+  owners(cv::Rect(5, 5, 20, 30)).setTo(1);
+  owners.at<uint8_t>(20, 15) = kNoOwner;
+  EXPECT_EQ(largestCoveredRect(owners), cv::Rect(5, 5, 50, 10));
+
+  owners(cv::Rect(25, 15, 10, 25)).setTo(2);
+  EXPECT_EQ(largestCoveredRect(owners), cv::Rect(16, 5, 19, 30));
+
+  EXPECT_EQ(largestCoveredRect(cv::Mat(4, 4, CV_8UC1,
+      cv::Scalar(kNoOwner))).area(), 0);
+}
+
+TEST(TransformCanvas, CropsAndScales) {
+  const cv::Size imageSize(64, 48);
+  std::vector<cv::Mat> H = { translation(100, 50) };
+  projection_t plane;
+  transformCanvas(cv::Point2d(100, 50), 0.5, H, plane);
+
+  // the image now fills the canvas at half resolution
+  warp_maps_t maps;
+  const cv::Size canvasSize = scaleCanvasSize(imageSize, 0.5);
+  EXPECT_EQ(canvasSize, cv::Size(32, 24));
+  buildWarpMaps(H[0], cv::Mat(), cv::Mat(), imageSize, canvasSize, maps);
+  EXPECT_EQ(maps.roi, cv::Rect(cv::Point(), canvasSize));
+  EXPECT_EQ(maps.map.at<cv::Vec2f>(23, 31), cv::Vec2f(62, 46));
+
+  projection_t curved;
+  curved.type = Projection::Cylindrical;
+  curved.scale = 100;
+  curved.origin = cv::Point2d(-1, -0.5);
+  transformCanvas(cv::Point2d(50, 20), 0.5, H, curved);
+  EXPECT_DOUBLE_EQ(curved.scale, 50);
+  EXPECT_DOUBLE_EQ(curved.origin.x, -0.5);
+  EXPECT_DOUBLE_EQ(curved.origin.y, -0.3);
+
+  EXPECT_DOUBLE_EQ(budgetScale(cv::Size(4000, 1000), 1), 0.5);
+  EXPECT_DOUBLE_EQ(budgetScale(cv::Size(4000, 1000), 0), 1);
+  EXPECT_DOUBLE_EQ(budgetScale(cv::Size(400, 100), 1), 1);
+}
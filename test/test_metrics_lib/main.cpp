@@ -0,0 +1,166 @@
+#include "metrics.hpp"
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+bool contains(const std::string &text, const std::string &line) {
+  return text.find(line + "\n") != std::string::npos;
+}
+
+// Response of the server to a scrape, empty if it failed
+std::string scrape(int port) {
+  int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = sockaddr_in();
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(socket, (sockaddr*)&address, sizeof(address)) != 0) {
+    close(socket);
+    return "";
+  }
+  const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+  send(socket, request.data(), request.size(), 0);
+  std::string response;
+  char buffer[4096];
+  ssize_t received;
+  while ((received = recv(socket, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, (size_t)received);
+  }
+  close(socket);
+  return response;
+}
+
+}
+
+TEST(MetricsRegistry, RendersPrometheusText) {
+  MetricsRegistry registry;
+  Counter &frames = registry.counter("frames_total", "Frames");
+  Gauge &fps = registry.gauge("fps", "Frames per second");
+  Histogram &first = registry.histogram("decode_seconds", "Decode time",
+      metricLabel("camera", "0"), {0.01, 0.1});
+  Histogram &second = registry.histogram("decode_seconds", "",
+      metricLabel("camera", "1"), {0.01, 0.1});
+
+  frames.add();
+  frames.add(2);
+  fps.set(29.5);
+  first.observe(0.005);
+  first.observe(0.05);
+  first.observe(2);
+  second.observe(0.1);
+
+  EXPECT_EQ(3u, first.count());
+  EXPECT_NEAR(2.055, first.sum(), 1e-6);
+  EXPECT_EQ(std::vector<uint64_t>({1, 1, 1}), first.counts());
+
+  const std::string text = registry.render();
+  EXPECT_TRUE(contains(text, "# HELP frames_total Frames"));
+  EXPECT_TRUE(contains(text, "# TYPE frames_total counter"));
+  EXPECT_TRUE(contains(text, "frames_total 3"));
+  EXPECT_TRUE(contains(text, "# TYPE fps gauge"));
+  EXPECT_TRUE(contains(text, "fps 29.5"));
+  // a family of histograms has a single header, buckets are cumulative
+  EXPECT_TRUE(contains(text, "# TYPE decode_seconds histogram"));
+  EXPECT_EQ(text.find("# TYPE decode_seconds"),
+      text.rfind("# TYPE decode_seconds"));
+  EXPECT_TRUE(contains(text, "decode_seconds_bucket{camera=\"0\",le=\"0.01\"} 1"));
+  EXPECT_TRUE(contains(text, "decode_seconds_bucket{camera=\"0\",le=\"0.1\"} 2"));
+  EXPECT_TRUE(contains(text, "decode_seconds_bucket{camera=\"0\",le=\"+Inf\"} 3"));
+  EXPECT_TRUE(contains(text, "decode_seconds_count{camera=\"0\"} 3"));
+  // an observation on a bound falls into its bucket
+  EXPECT_TRUE(contains(text, "decode_seconds_count{camera=\"1\"} 1"));
+  EXPECT_EQ(std::vector<uint64_t>({0, 1, 0}), second.counts());
+
+  EXPECT_EQ("path=\"a\\\"b\\\\c\\n\"", metricLabel("path", "a\"b\\c\n"));
+}
+
+TEST(MetricsRegistry, CountsFromManyThreads) {
+  MetricsRegistry registry;
+  Counter &counter = registry.counter("events_total", "Events");
+  Histogram &histogram = registry.histogram("latency_seconds", "Latency");
+  const int threads = 4;
+  const int events = 100000;
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+      for (int i = 0; i < events; ++i) {
+        counter.add();
+        histogram.observe(0.001);
+      }
+    });
+  }
+  // rendering while the metrics change neither blocks nor breaks them
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_FALSE(registry.render().empty());
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  EXPECT_EQ((uint64_t)threads * events, counter.value());
+  EXPECT_EQ((uint64_t)threads * events, histogram.count());
+  EXPECT_NEAR(threads * events * 0.001, histogram.sum(), 1e-3);
+}
+
+TEST(MetricsServer, ServesScrapes) {
+  MetricsRegistry registry;
+  Gauge &depth = registry.gauge("queue_depth", "Depth");
+  MetricsServer server(registry, 0);
+  ASSERT_TRUE(server.isOpened());
+  ASSERT_GT(server.port(), 0);
+
+  depth.set(3);
+  std::string response = scrape(server.port());
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(std::string::npos, response.find("text/plain; version=0.0.4"));
+  EXPECT_TRUE(contains(response, "queue_depth 3"));
+
+  depth.set(1);
+  EXPECT_TRUE(contains(scrape(server.port()), "queue_depth 1"));
+}
+
+TEST(MetricsFileWriter, RewritesFile) {
+  const std::string path = "test_metrics.prom";
+  std::remove(path.c_str());
+  MetricsRegistry registry;
+  Counter &frames = registry.counter("frames_total", "Frames");
+
+  auto read = [&] {
+    std::ifstream file(path.c_str());
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+  };
+  {
+    MetricsFileWriter writer(registry, path, 0.01);
+    frames.add(5);
+    // rewritten in the background
+    for (int i = 0; i < 500 && !contains(read(), "frames_total 5"); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(contains(read(), "frames_total 5"));
+    frames.add(2);
+  }
+  // and once more when the writer stops
+  EXPECT_TRUE(contains(read(), "frames_total 7"));
+  EXPECT_FALSE(std::ifstream((path + ".tmp").c_str()).good());
+  std::remove(path.c_str());
+}
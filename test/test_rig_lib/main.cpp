@@ -0,0 +1,210 @@
+#include "rig.hpp"
+#include "opts.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern command_line_opts opts;
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+cv::Mat translation(double dx, double dy) {
+  return (cv::Mat_<double>(3, 3) <<
+      1, 0, dx,
+      0, 1, dy,
+      0, 0, 1);
+}
+
+stitch_config_t twoCameras() {
+  stitch_config_t config;
+  config.video = true;
+  config.file_paths = { "left.avi", "right.avi" };
+  config.result_size = cv::Size(170, 90);
+  config.H = { translation(0, 5), translation(60, 5) };
+  config.cameraMatrix.resize(2);
+  config.distCoeffs.resize(2);
+  config.gains = { cv::Vec3f(1.1f, 1.0f, 0.9f), cv::Vec3f(1, 1, 1) };
+  config.image_sizes.assign(2, cv::Size(100, 80));
+  return config;
+}
+
+// White image with a black and white board of (board + 1) squares
+cv::Mat chessboard(const cv::Size &imageSize, const cv::Size &board,
+    const cv::Point &origin, int square) {
+  cv::Mat image(imageSize, CV_8UC3, cv::Scalar::all(255));
+  for (int y = 0; y <= board.height; ++y) {
+    for (int x = 0; x <= board.width; ++x) {
+      if ((x + y) % 2 == 0) {
+        cv::rectangle(image,
+            cv::Rect(origin.x + x * square, origin.y + y * square,
+                square, square),
+            cv::Scalar::all(0), CV_FILLED);
+      }
+    }
+  }
+  return image;
+}
+
+}
+
+TEST(StitchConfig, WriteAndRead) {
+  stitch_config_t config = twoCameras();
+  std::vector<warp_maps_t> maps(2);
+  for (size_t i = 0; i < 2; ++i) {
+    buildWarpMaps(config.H[i], cv::Mat(), cv::Mat(), config.image_sizes[i],
+        config.result_size, maps[i]);
+  }
+  config.owners = buildOwnerMap(maps, config.image_sizes, config.result_size);
+  config.board_corners = {
+      { cv::Point2f(1, 2), cv::Point2f(3, 4), cv::Point2f(5, 6),
+        cv::Point2f(7, 8) },
+      {} };
+  config.projection.type = Projection::Cylindrical;
+  config.projection.P = cv::Mat::eye(3, 3, CV_64F);
+  config.projection.scale = 300;
+  config.projection.origin = cv::Point2d(-0.5, -0.25);
+
+  const std::string path = "test_rig_lib.conf.xml";
+  ASSERT_TRUE(writeStitchConfig(path, config));
+  stitch_config_t read;
+  ASSERT_EQ(readStitchConfig(path, read), 0);
+
+  EXPECT_EQ(read.video, config.video);
+  EXPECT_EQ(read.file_paths, config.file_paths);
+  EXPECT_EQ(read.result_size, config.result_size);
+  EXPECT_EQ(read.projection.type, config.projection.type);
+  EXPECT_EQ(cv::norm(read.projection.P, config.projection.P, cv::NORM_INF),
+      0);
+  EXPECT_EQ(read.projection.scale, config.projection.scale);
+  EXPECT_EQ(read.projection.origin, config.projection.origin);
+  ASSERT_EQ(read.H.size(), 2u);
+  EXPECT_EQ(cv::norm(read.H[1], config.H[1], cv::NORM_INF), 0);
+  EXPECT_EQ(read.gains[0], config.gains[0]);
+  EXPECT_EQ(read.image_sizes, config.image_sizes);
+  EXPECT_EQ(cv::countNonZero(read.owners != config.owners), 0);
+  ASSERT_EQ(read.board_corners.size(), 2u);
+  EXPECT_EQ(read.board_corners[0], config.board_corners[0]);
+  EXPECT_TRUE(read.board_corners[1].empty());
+  std::remove(path.c_str());
+}
+
+TEST(StitchConfig, RejectsMissingEntries) {
+  const std::string path = "test_rig_lib.missing.conf.xml";
+  {
+    // one homography for two cameras
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    fs << "file_paths" << "[" << "left.avi" << "right.avi" << "]";
+    fs << "result_size" << cv::Size(170, 90);
+    fs << "H" << "[" << translation(0, 5) << "]";
+    fs << "cameraMatrix" << "[" << cv::Mat() << cv::Mat() << "]";
+    fs << "distCoeffs" << "[" << cv::Mat() << cv::Mat() << "]";
+  }
+  stitch_config_t read;
+  EXPECT_EQ(readStitchConfig(path, read), 4);
+  std::remove(path.c_str());
+}
+
+TEST(RigUpdater, SwapsRigWhenConfigChanges) {
+  const std::string path = "test_rig_lib.swap.conf.xml";
+  stitch_config_t config = twoCameras();
+  ASSERT_TRUE(writeStitchConfig(path, config));
+
+  RigUpdater updater(buildRig(config, config.image_sizes), path, 0);
+  std::shared_ptr<const rig_t> initial = updater.current();
+  EXPECT_EQ(initial->maps.size(), 2u);
+
+  config.H[1] = translation(50, 5);
+  ASSERT_TRUE(writeStitchConfig(path, config));
+
+  std::shared_ptr<const rig_t> swapped = initial;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (swapped == initial && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    swapped = updater.current();
+  }
+  ASSERT_NE(swapped, initial);
+  EXPECT_EQ(swapped->maps[1].roi.x, 50);
+  // the rig in use stays valid after the swap
+  EXPECT_EQ(initial->maps[1].roi.x, 60);
+  std::remove(path.c_str());
+}
+
+TEST(RigUpdater, KeepsRigWhenCanvasChanges) {
+  const std::string path = "test_rig_lib.canvas.conf.xml";
+  stitch_config_t config = twoCameras();
+  ASSERT_TRUE(writeStitchConfig(path, config));
+
+  RigUpdater updater(buildRig(config, config.image_sizes), path, 0);
+  std::shared_ptr<const rig_t> initial = updater.current();
+
+  // canvases of the running stitcher have the old size
+  config.result_size = cv::Size(200, 120);
+  ASSERT_TRUE(writeStitchConfig(path, config));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  EXPECT_EQ(updater.current(), initial);
+  std::remove(path.c_str());
+}
+
+TEST(RigUpdater, KeepsRigWhenConfigIsBroken) {
+  const std::string path = "test_rig_lib.broken.conf.xml";
+  stitch_config_t config = twoCameras();
+  ASSERT_TRUE(writeStitchConfig(path, config));
+
+  RigUpdater updater(buildRig(config, config.image_sizes), path, 0);
+  std::shared_ptr<const rig_t> initial = updater.current();
+
+  // the file is caught half-written
+  std::string text;
+  {
+    std::ifstream in(path.c_str());
+    std::stringstream whole;
+    whole << in.rdbuf();
+    text = whole.str();
+  }
+  {
+    std::ofstream out(path.c_str(), std::ios::trunc);
+    out << text.substr(0, text.size() / 2);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  EXPECT_EQ(updater.current(), initial);
+  std::remove(path.c_str());
+}
+
+TEST(EstimateDrift, FollowsMovedBoard) {
+  const cv::Size imageSize(640, 480);
+  const cv::Size board(opts.board_width, opts.board_height);
+  stitch_config_t config;
+  config.H = { cv::Mat::eye(3, 3, CV_64F) };
+  config.cameraMatrix.resize(1);
+  config.distCoeffs.resize(1);
+  // somewhere far from the board
+  config.board_corners = { { cv::Point2f(600, 400), cv::Point2f(630, 400),
+      cv::Point2f(630, 430), cv::Point2f(600, 430) } };
+
+  // calibrated position of the board
+  cv::Mat calibrated = chessboard(imageSize, board, cv::Point(40, 60), 40);
+  ASSERT_TRUE(estimateDrift(calibrated, 0, config));
+  config.H[0] = cv::Mat::eye(3, 3, CV_64F);
+  EXPECT_FALSE(estimateDrift(calibrated, 0, config));
+
+  cv::Mat moved = chessboard(imageSize, board, cv::Point(47, 64), 40);
+  ASSERT_TRUE(estimateDrift(moved, 0, config));
+  // points of the moved frame are mapped back to the calibrated position
+  EXPECT_LT(cv::norm(config.H[0], translation(-7, -4), cv::NORM_INF), 0.2);
+  EXPECT_FALSE(estimateDrift(moved, 0, config));
+}
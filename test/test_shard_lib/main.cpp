@@ -0,0 +1,109 @@
+#include "shard.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+namespace {
+
+const std::string kWorkerArg = "--shard-worker=";
+const char kCrashMarker[] = "test_shard_lib.crashed";
+
+// Worker copying its band of the first frame to the canvas. The second
+// worker dies at the third frame unless it did before
+int runWorker(const std::string &name, int index) {
+  ShardSegment segment(name);
+  if (!segment.isOpened()) {
+    return 1;
+  }
+  const cv::Range band = segment.band(index);
+  cv::Mat canvas = segment.canvas().rowRange(band);
+  while (segment.nextFrame(index)) {
+    if (1 == index && 3 == segment.frameNumber() &&
+        !std::ifstream(kCrashMarker)) {
+      std::ofstream(kCrashMarker) << index;
+      raise(SIGKILL);
+    }
+    segment.frame(0).rowRange(band).copyTo(canvas);
+    segment.frameDone(index);
+  }
+  return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+  // the test spawns itself as workers
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.find(kWorkerArg) == 0) {
+      const std::string::size_type colon = arg.rfind(":");
+      return runWorker(arg.substr(kWorkerArg.size(),
+          colon - kWorkerArg.size()), atoi(arg.substr(colon + 1).c_str()));
+    }
+  }
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+TEST(ShardSegment, LaysOutFramesAndBands) {
+  const std::string name = "/test_shard_lib-" + std::to_string(getpid());
+  {
+    ShardSegment segment(name, {cv::Size(33, 17), cv::Size(8, 8)},
+        {CV_8UC3, CV_16UC1}, cv::Size(40, 31), CV_8UC4, 3);
+    ASSERT_TRUE(segment.isOpened());
+    EXPECT_FALSE(ShardSegment(name, {cv::Size(8, 8)}, {CV_8UC1},
+        cv::Size(8, 8), CV_8UC1, 1).isOpened());
+
+    ShardSegment attached(name);
+    ASSERT_TRUE(attached.isOpened());
+    EXPECT_EQ(2u, attached.cameras());
+    EXPECT_EQ(3, attached.workers());
+    EXPECT_EQ(cv::Size(8, 8), attached.frame(1).size());
+    EXPECT_EQ(CV_16UC1, attached.frame(1).type());
+    EXPECT_EQ(CV_8UC4, attached.canvas().type());
+    EXPECT_EQ(0u, (size_t)attached.frame(1).data % kShardAlignment);
+    EXPECT_EQ(0u, (size_t)attached.canvas().data % kShardAlignment);
+
+    // both processes see the same pixels
+    segment.frame(1).setTo(cv::Scalar::all(1000));
+    EXPECT_EQ(1000, attached.frame(1).at<uint16_t>(7, 7));
+
+    // bands cover the canvas without overlaps
+    EXPECT_EQ(0, attached.band(0).start);
+    EXPECT_EQ(attached.band(0).end, attached.band(1).start);
+    EXPECT_EQ(attached.band(1).end, attached.band(2).start);
+    EXPECT_EQ(31, attached.band(2).end);
+  }
+  // the creator removes the segment
+  EXPECT_FALSE(ShardSegment(name).isOpened());
+}
+
+TEST(ShardWorkers, ComposeBandsAndRestartCrashed) {
+  std::remove(kCrashMarker);
+  const std::string name = "/test_shard_lib-" + std::to_string(getpid());
+  const cv::Size size(40, 30);
+  ShardSegment segment(name, {size}, {CV_8UC3}, size, CV_8UC3, 3);
+  ASSERT_TRUE(segment.isOpened());
+
+  ShardWorkers workers(segment, {"test_shard_lib"});
+  ASSERT_TRUE(workers.isRunning());
+  for (int index = 1; index <= 5; ++index) {
+    cv::Mat frame = segment.frame(0);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+    ASSERT_TRUE(workers.compose());
+    EXPECT_EQ((uint64_t)index, segment.frameNumber());
+    EXPECT_EQ(0, cv::norm(frame, segment.canvas(), cv::NORM_INF));
+  }
+  EXPECT_EQ(1, workers.restarts());
+  std::remove(kCrashMarker);
+}
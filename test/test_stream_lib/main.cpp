@@ -0,0 +1,157 @@
+#include "stream.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+// Gradient with some noise, compresses like a photo
+cv::Mat testImage(const cv::Size &size, int type) {
+  cv::Mat image(size, type);
+  cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(32));
+  for (int y = 0; y < image.rows; ++y) {
+    uchar *row = image.ptr<uchar>(y);
+    for (int x = 0; x < image.cols * image.channels(); ++x) {
+      row[x] = (uchar)(row[x] + (x + 2 * y) % 200);
+    }
+  }
+  return image;
+}
+
+int connectTo(int port) {
+  int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = sockaddr_in();
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(socket, (sockaddr*)&address, sizeof(address)) != 0) {
+    close(socket);
+    return -1;
+  }
+  return socket;
+}
+
+// Read from the socket until the data has the given size or contains the
+// given text
+bool receiveUntil(int socket, std::string &data, size_t size,
+    const std::string &text = "") {
+  char buffer[4096];
+  while (data.size() < size &&
+      (text.empty() || data.find(text) == std::string::npos)) {
+    ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      return false;
+    }
+    data.append(buffer, (size_t)received);
+  }
+  return true;
+}
+
+}
+
+TEST(EncodeJpegStrips, DecodesAsWholeImage) {
+  const int types[] = {CV_8UC3, CV_8UC1};
+  for (int type : types) {
+    cv::Mat image = testImage(cv::Size(333, 217), type);
+    std::vector<uchar> whole;
+    ASSERT_TRUE(cv::imencode(".jpg", image, whole,
+        std::vector<int>{CV_IMWRITE_JPEG_QUALITY, 80}));
+    cv::Mat expected = cv::imdecode(whole, -1);
+
+    for (int strips : {1, 3, 7, 40}) {
+      std::vector<uchar> jpeg;
+      ASSERT_TRUE(encodeJpegStrips(image, 80, jpeg, strips));
+      cv::Mat decoded = cv::imdecode(jpeg, -1);
+      ASSERT_EQ(image.size(), decoded.size());
+      // restart markers change nothing but the entropy-coded data
+      EXPECT_EQ(0, cv::norm(expected, decoded, cv::NORM_INF));
+      const uchar dri[] = {0xFF, 0xDD};
+      EXPECT_EQ(strips > 1, std::search(jpeg.begin(), jpeg.end(), dri,
+          dri + 2) != jpeg.end());
+    }
+
+    // strips encoded on a pool of its own are the same
+    WorkerPool pool(3, std::vector<int>());
+    std::vector<uchar> pooled, shared;
+    ASSERT_TRUE(encodeJpegStrips(image, 80, pooled, 7, &pool));
+    ASSERT_TRUE(encodeJpegStrips(image, 80, shared, 7));
+    EXPECT_EQ(shared, pooled);
+  }
+
+  std::vector<uchar> jpeg;
+  EXPECT_FALSE(spliceJpegStrips({}, jpeg));
+  EXPECT_FALSE(spliceJpegStrips({std::vector<uchar>(16, 0)}, jpeg));
+}
+
+TEST(MjpegServer, StreamsToLocalClient) {
+  MjpegServer server(0);
+  ASSERT_TRUE(server.isOpened());
+  ASSERT_GT(server.port(), 0);
+
+  // nobody watches: frames are neither encoded nor counted as dropped
+  cv::Mat frame = testImage(cv::Size(640, 480), CV_8UC3);
+  for (int i = 0; i < 10; ++i) {
+    server.publish(frame);
+  }
+  usleep(100000);
+  EXPECT_EQ(0u, server.encoded());
+  EXPECT_EQ(0u, server.dropped());
+
+  int socket = connectTo(server.port());
+  ASSERT_GE(socket, 0);
+  const std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  ASSERT_EQ((ssize_t)request.size(),
+      send(socket, request.data(), request.size(), 0));
+  while (server.clients() < 1) {
+    usleep(1000);
+  }
+
+  // the client does not read: frames are dropped, publishing goes on
+  for (int i = 0; i < 100; ++i) {
+    server.publish(frame);
+  }
+  while (server.encoded() < 1) {
+    usleep(1000);
+  }
+  EXPECT_GT(server.dropped(), 0u);
+
+  std::string data;
+  ASSERT_TRUE(receiveUntil(socket, data, (size_t)-1, "\r\n\r\n--frame"));
+  EXPECT_NE(std::string::npos,
+      data.find("multipart/x-mixed-replace; boundary=frame"));
+  const std::string length = "Content-Length: ";
+  ASSERT_TRUE(receiveUntil(socket, data, (size_t)-1, "\r\n\r\n\xFF\xD8"));
+  const size_t pos = data.find(length);
+  ASSERT_NE(std::string::npos, pos);
+  const size_t size = (size_t)atol(data.c_str() + pos + length.size());
+  const size_t start = data.find("\r\n\r\n", pos) + 4;
+  ASSERT_TRUE(receiveUntil(socket, data, start + size));
+
+  std::vector<uchar> jpeg(data.begin() + start, data.begin() + start + size);
+  std::vector<uchar> expected;
+  ASSERT_TRUE(encodeJpegStrips(frame, 80, expected));
+  EXPECT_TRUE(expected == jpeg);
+
+  // closed clients are forgotten
+  close(socket);
+  while (server.clients() > 0) {
+    server.publish(frame);
+    usleep(10000);
+  }
+}
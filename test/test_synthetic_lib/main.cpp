@@ -0,0 +1,127 @@
+#include "synthetic.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+namespace {
+
+synthetic_rig_params_t smallRig(StitchingMode mode) {
+  synthetic_rig_params_t params;
+  params.cameras = 3;
+  params.frameSize = cv::Size(640, 360);
+  params.mode = mode;
+  params.jitter = 2;
+  params.seed = 7;
+  return params;
+}
+
+// Distance in squares from the floor point to the nearest inner corner of
+// the board
+double cornerDistance(const synthetic_board_t &board,
+    const cv::Point2d &point) {
+  const double u = (point.x - board.center.x) / board.square +
+      (board.size.width + 1) / 2.0;
+  const double v = (board.center.y - point.y) / board.square +
+      (board.size.height + 1) / 2.0;
+  if (u < 0.5 || u > board.size.width + 0.5 || v < 0.5 ||
+      v > board.size.height + 0.5) {
+    return 1e9;
+  }
+  return std::hypot(u - std::round(u), v - std::round(v));
+}
+
+cv::Point2d toFloor(const cv::Mat &H, const cv::Point2f &point) {
+  const cv::Matx33d M = H;
+  const cv::Vec3d p = M * cv::Vec3d(point.x, point.y, 1);
+  return cv::Point2d(p[0] / p[2], p[1] / p[2]);
+}
+
+}
+
+TEST(SyntheticRig, ChainCamerasSeeTwoBoards) {
+  const synthetic_rig_t rig = makeSyntheticRig(
+      smallRig(StitchingMode::ChainOfTargets));
+  ASSERT_EQ(3u, rig.cameras.size());
+  ASSERT_EQ(4u, rig.boards.size());
+  const cv::Size board(5, 3);
+
+  for (size_t i = 0; i < rig.cameras.size(); ++i) {
+    cv::Mat view = renderView(rig, i);
+    ASSERT_EQ(rig.cameras[i].size, view.size());
+    const cv::Mat H = floorHomography(rig.cameras[i]);
+    // boards i and i + 1 in the left and the right half, where the ground
+    // truth puts them
+    for (int half = 0; half < 2; ++half) {
+      const int offset = half * view.cols / 2;
+      std::vector<cv::Point2f> corners;
+      ASSERT_TRUE(findChessboardCorners(view.colRange(offset,
+          offset + view.cols / 2), board, corners))
+          << "camera #" << i << ", half " << half;
+      ASSERT_EQ((size_t)board.area(), corners.size());
+      for (const cv::Point2f &corner : corners) {
+        EXPECT_LT(cornerDistance(rig.boards[i + half],
+            toFloor(H, corner + cv::Point2f((float)offset, 0))), 0.1);
+      }
+    }
+  }
+}
+
+TEST(SyntheticRig, CamerasAroundCommonTarget) {
+  synthetic_rig_params_t params = smallRig(StitchingMode::OneCommonTarget);
+  params.distortion = {-0.05, 0.01};
+  const synthetic_rig_t rig = makeSyntheticRig(params);
+  ASSERT_EQ(1u, rig.boards.size());
+
+  for (size_t i = 0; i < rig.cameras.size(); ++i) {
+    std::vector<cv::Point2f> corners;
+    ASSERT_TRUE(findChessboardCorners(renderView(rig, i), cv::Size(5, 3),
+        corners)) << "camera #" << i;
+  }
+}
+
+TEST(SyntheticConfig, GroundTruthAndErrors) {
+  const synthetic_rig_t rig = makeSyntheticRig(
+      smallRig(StitchingMode::ChainOfTargets));
+  const std::vector<std::string> paths = {"a.png", "b.png", "c.png"};
+  const stitch_config_t truth = syntheticConfig(rig, paths);
+  ASSERT_EQ(3u, truth.H.size());
+  EXPECT_EQ(paths, truth.file_paths);
+  EXPECT_GT(truth.result_size.area(), 0);
+  // both sides are rounded up
+  EXPECT_LE(syntheticConfig(rig, paths, 0.5).result_size.area(), 502000);
+
+  // a canvas scaled and moved as a whole is as good as the ground truth
+  stitch_config_t estimated = truth;
+  const cv::Mat S = (cv::Mat_<double>(3, 3) << 0.5, 0, 10, 0, 0.5, -20,
+      0, 0, 1);
+  for (cv::Mat &H : estimated.H) {
+    H = S * H;
+  }
+  std::vector<double> errors = alignmentErrors(estimated, truth);
+  ASSERT_EQ(3u, errors.size());
+  for (double error : errors) {
+    EXPECT_LT(error, 1e-6);
+  }
+
+  // a camera off by 3 pixels of the estimated canvas
+  const cv::Mat shift = (cv::Mat_<double>(3, 3) << 1, 0, 3, 0, 1, 0,
+      0, 0, 1);
+  estimated.H[2] = shift * estimated.H[2];
+  errors = alignmentErrors(estimated, truth);
+  EXPECT_LT(errors[1], 1e-6);
+  EXPECT_NEAR(3, errors[2], 1e-6);
+
+  estimated.H.pop_back();
+  EXPECT_TRUE(alignmentErrors(estimated, truth).empty());
+}
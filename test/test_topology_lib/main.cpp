@@ -0,0 +1,186 @@
+#include "topology.hpp"
+
+#include "gtest/gtest.h"
+
+#include "opencv2/core/core.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+TEST(ParseCpuSet, ListsAndNodes) {
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}),
+      parseCpuSet("0-3,8,10-11"));
+  // sorted and unique
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), parseCpuSet("3,1,1-2"));
+  EXPECT_EQ("0-3,8,10-11", formatCpuSet(parseCpuSet("10-11,8,0-3")));
+
+  EXPECT_TRUE(parseCpuSet("").empty());
+  EXPECT_TRUE(parseCpuSet("x").empty());
+  EXPECT_TRUE(parseCpuSet("4-2").empty());
+  EXPECT_TRUE(parseCpuSet("1,,2").empty());
+
+  const std::vector<numa_node_t> nodes = numaNodes();
+  ASSERT_FALSE(nodes.empty());
+  const numa_node_t &node = nodes.back();
+  EXPECT_EQ(node.cpus, parseCpuSet("node" + std::to_string(node.id)));
+  EXPECT_TRUE(parseCpuSet("node" + std::to_string(node.id + 1)).empty());
+  EXPECT_EQ("any cpu", describeCpuSet(std::vector<int>()));
+  EXPECT_NE(std::string::npos, describeCpuSet(node.cpus).find(
+      "on node " + std::to_string(node.id)));
+}
+
+namespace {
+
+// CPUs every thread running an iteration may run on
+class AffinityBody : public cv::ParallelLoopBody {
+ public:
+  AffinityBody(std::mutex &lock, std::vector<std::vector<int>> &seen)
+      : lock(lock), seen(seen) {}
+
+  void operator()(const cv::Range &range) const override {
+    for (int i = range.start; i < range.end; ++i) {
+      std::vector<int> cpus = currentThreadCpus();
+      std::lock_guard<std::mutex> guard(lock);
+      seen.push_back(cpus);
+    }
+  }
+
+ private:
+  std::mutex &lock;
+  std::vector<std::vector<int>> &seen;
+};
+
+}
+
+TEST(PinParallelThreads, KeepsThreadsOnCpus) {
+  const std::vector<int> cpus = currentThreadCpus();
+  ASSERT_FALSE(cpus.empty());
+  const std::vector<int> first(1, cpus[0]);
+
+  // every thread of the pool runs the pinning, or the rest of the test
+  // would depend on which threads take the iterations
+  ASSERT_EQ(std::max(cv::getNumThreads(), 1), pinParallelThreads(first));
+  EXPECT_EQ(first, currentThreadCpus());
+  // threads of the pool run the iterations on the same CPUs
+  std::mutex lock;
+  std::vector<std::vector<int>> seen;
+  cv::parallel_for_(cv::Range(0, 64), AffinityBody(lock, seen));
+  ASSERT_EQ(64u, seen.size());
+  for (const std::vector<int> &thread : seen) {
+    EXPECT_EQ(first, thread);
+  }
+  // nothing changes for an empty set
+  EXPECT_FALSE(pinCurrentThread(std::vector<int>()));
+  EXPECT_EQ(first, currentThreadCpus());
+
+  // the buffer is zeroed and its pages are on nodes of the machine, if the
+  // kernel tells
+  cv::Mat canvas = allocateFirstTouch(cv::Size(1000, 700), CV_8UC3);
+  EXPECT_EQ(0, cv::countNonZero(canvas.reshape(1)));
+  const std::vector<numa_node_t> nodes = numaNodes();
+  for (const auto &pages : pageNodes(canvas.data,
+      canvas.total() * canvas.elemSize())) {
+    bool known = false;
+    for (const numa_node_t &node : nodes) {
+      known = known || node.id == pages.first;
+    }
+    EXPECT_TRUE(known);
+    EXPECT_GT(pages.second, 0u);
+  }
+
+  EXPECT_EQ(std::max(cv::getNumThreads(), 1), pinParallelThreads(cpus));
+  EXPECT_EQ(cpus, currentThreadCpus());
+}
+
+TEST(WorkerPool, RunsJobsOnCpus) {
+  const std::vector<int> cpus = currentThreadCpus();
+  ASSERT_FALSE(cpus.empty());
+  const std::vector<int> last(1, cpus.back());
+
+  WorkerPool pool(3, last);
+  EXPECT_EQ(3u, pool.size());
+  std::mutex lock;
+  std::vector<std::vector<int>> seen;
+  std::vector<std::atomic<int>> runs(100);
+  for (std::atomic<int> &count : runs) {
+    count = 0;
+  }
+  pool.parallelFor((int)runs.size(), [&](int i) {
+    ++runs[i];
+    std::vector<int> thread = currentThreadCpus();
+    std::lock_guard<std::mutex> guard(lock);
+    seen.push_back(thread);
+  });
+  for (const std::atomic<int> &count : runs) {
+    EXPECT_EQ(1, count.load());
+  }
+  for (const std::vector<int> &thread : seen) {
+    EXPECT_EQ(last, thread);
+  }
+  // the caller is not pinned
+  EXPECT_EQ(cpus, currentThreadCpus());
+
+  // a job throwing does not take the pool down
+  std::future<void> failed = pool.submit([]() {
+    throw std::runtime_error("job");
+  });
+  EXPECT_THROW(failed.get(), std::runtime_error);
+  EXPECT_THROW(pool.parallelFor(10, [](int i) {
+    if (5 == i) {
+      throw std::runtime_error("iteration");
+    }
+  }), std::runtime_error);
+  int done = 0;
+  pool.submit([&done]() { done = 1; }).get();
+  EXPECT_EQ(1, done);
+}
+
+TEST(InFlightSlots, OutputsEveryFrameOnceInOrder) {
+  // more frames than slots, finished as a frame loop does
+  const size_t frames = 10;
+  InFlightSlots slots(3, std::vector<int>());
+  ASSERT_EQ(3u, slots.size());
+  std::vector<int> composed(slots.size(), -1);
+  std::vector<std::thread::id> threads(slots.size());
+  std::vector<int> output;
+  auto finish = [&]() {
+    const size_t slot = slots.finishOldest();
+    output.push_back(composed[slot]);
+  };
+
+  for (size_t frame = 0; frame < frames; ++frame) {
+    if (slots.full()) {
+      finish();
+    }
+    EXPECT_LT(slots.pending(), slots.size());
+    const size_t slot = slots.next();
+    EXPECT_EQ(frame % slots.size(), slot);
+    slots.submit([&, frame, slot]() {
+      // a slot keeps its thread
+      if (frame >= slots.size()) {
+        EXPECT_EQ(threads[slot], std::this_thread::get_id());
+      }
+      threads[slot] = std::this_thread::get_id();
+      composed[slot] = (int)frame;
+    });
+  }
+  while (slots.pending() > 0) {
+    finish();
+  }
+
+  ASSERT_EQ(frames, output.size());
+  for (size_t frame = 0; frame < frames; ++frame) {
+    EXPECT_EQ((int)frame, output[frame]);
+  }
+  EXPECT_NE(threads[0], threads[1]);
+}
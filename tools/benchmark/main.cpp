@@ -0,0 +1,288 @@
+#include "Debug.hpp"
+#include "compose.hpp"
+#include "utils.hpp"
+#include "opts.hpp"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+extern command_line_opts opts;
+
+namespace {
+
+// Average time of a single call of f in milliseconds
+template <typename F>
+double measure(F f, int iterations) {
+  f(); // warm up caches and thread pool
+
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  auto end = chrono::steady_clock::now();
+  return chrono::duration<double, milli>(end - start).count() / iterations;
+}
+
+// Hardware cache misses of the calling thread between start() and stop(),
+// negative if performance counters are not available
+class CacheMisses {
+ public:
+  CacheMisses() {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~CacheMisses() {
+#ifdef __linux__
+    if (fd >= 0) {
+      close(fd);
+    }
+#endif
+  }
+
+  void start() {
+#ifdef __linux__
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  long long stop() {
+#ifdef __linux__
+    long long count = -1;
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+      }
+    }
+    return count;
+#else
+    return -1;
+#endif
+  }
+
+ private:
+  int fd = -1;
+};
+
+void report(const string &name, double ms, const Size &canvasSize) {
+  cout << left << setw(28) << name << right << fixed << setprecision(3)
+      << setw(10) << ms << " ms" << setw(10)
+      << canvasSize.area() / ms / 1000.0 << " Mpix/s" << endl;
+}
+
+string typeName(int type) {
+  const int depth = CV_MAT_DEPTH(type);
+  return string(CV_8U == depth ? "8U" : CV_16U == depth ? "16U" : "?") +
+      "C" + to_string(CV_MAT_CN(type));
+}
+
+// Homography similar to the ones produced by projectToTheFloor: the image
+// is foreshortened and rotated by angle degrees. canvasSize receives the
+// size of the bounding box of the result
+Mat tiltedHomography(const Size &imageSize, double angle, Size &canvasSize) {
+  const float w = (float)imageSize.width;
+  const float h = (float)imageSize.height;
+  Point2f from[] = { Point2f(0, 0), Point2f(w, 0), Point2f(w, h),
+      Point2f(0, h) };
+  Point2f to[] = { Point2f(0.3f * w, 0), Point2f(0.7f * w, 0), Point2f(w, h),
+      Point2f(0, h) };
+
+  const double r = angle * CV_PI / 180.0;
+  float minX = 0, minY = 0, maxX = 0, maxY = 0;
+  for (int i = 0; i < 4; ++i) {
+    Point2f P = to[i] - Point2f(w / 2, h / 2);
+    to[i] = Point2f((float)(P.x * cos(r) - P.y * sin(r)),
+        (float)(P.x * sin(r) + P.y * cos(r)));
+    minX = (0 == i) ? to[i].x : min(minX, to[i].x);
+    minY = (0 == i) ? to[i].y : min(minY, to[i].y);
+    maxX = (0 == i) ? to[i].x : max(maxX, to[i].x);
+    maxY = (0 == i) ? to[i].y : max(maxY, to[i].y);
+  }
+  for (int i = 0; i < 4; ++i) {
+    to[i] = to[i] - Point2f(minX, minY);
+  }
+
+  canvasSize = Size((int)ceil(maxX - minX), (int)ceil(maxY - minY));
+  return getPerspectiveTransform(from, to);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+  if (!parse_command_line_opts(argc, argv)) {
+    cout << "Usage: " << argv[0] << " [/path/to/img.jpg] [--num=iterations]";
+    return 1;
+  }
+
+  Mat image;
+  if (!opts.file_paths.empty()) {
+    image = imread(opts.file_paths.front());
+    if (image.empty()) {
+      cout << "Failed to open file " << opts.file_paths.front() << endl;
+      return 2;
+    }
+  } else {
+    image.create(1080, 1920, CV_8UC3);
+    randu(image, Scalar::all(0), Scalar::all(256));
+  }
+
+  const int iterations = max(opts.number_of_frames, 1);
+  Size canvasSize;
+  Mat H = tiltedHomography(image.size(), 15, canvasSize);
+  cout << "Image " << image.size() << ", canvas " << canvasSize << ", "
+      << iterations << " iterations" << endl;
+
+  warp_maps_t maps;
+  buildWarpMaps(H, Mat(), Mat(), image.size(), canvasSize, maps);
+  const Vec3f gain(1, 1, 1);
+
+  // The way tools/stitch used to compose images
+  Mat canvas = Mat::zeros(canvasSize, CV_8UC3);
+  report("warpPerspective", measure([&]() {
+    warpPerspective(image, canvas, H, canvasSize, INTER_LINEAR,
+        BORDER_TRANSPARENT);
+  }, iterations), canvasSize);
+
+  Mat roi = canvas(maps.roi);
+  report("cv::remap (precomputed map)", measure([&]() {
+    remap(image, roi, maps.map, Mat(), INTER_LINEAR, BORDER_TRANSPARENT);
+  }, iterations), canvasSize);
+
+  Mat reference = Mat::zeros(canvasSize, CV_8UC3);
+  remapTransparent(image, maps, gain, reference, RemapKernel::Scalar);
+
+  const RemapKernel kernels[] = { RemapKernel::Scalar, RemapKernel::SSE42,
+      RemapKernel::AVX2, RemapKernel::AVX512 };
+  for (RemapKernel kernel : kernels) {
+    if (!isRemapKernelSupported(kernel)) {
+      cout << left << setw(28) << remapKernelName(kernel)
+          << "not supported" << endl;
+      continue;
+    }
+
+    canvas = Mat::zeros(canvasSize, CV_8UC3);
+    report(remapKernelName(kernel), measure([&]() {
+      remapTransparent(image, maps, gain, canvas, kernel);
+    }, iterations), canvasSize);
+
+    WITH_DEBUG(
+      cout << "  max difference with scalar kernel: "
+          << norm(canvas, reference, NORM_INF) << endl;
+    )
+  }
+
+  // Sparse maps trade interpolation of coordinates for memory traffic
+  const int grids[] = { 8, 16, 32 };
+  const RemapKernel best = bestRemapKernel();
+  for (int grid : grids) {
+    warp_maps_t sparse;
+    buildWarpMaps(H, Mat(), Mat(), image.size(), canvasSize, sparse, grid);
+
+    canvas = Mat::zeros(canvasSize, CV_8UC3);
+    report(string(remapKernelName(best)) + ", grid " + to_string(grid),
+        measure([&]() {
+      remapTransparent(image, sparse, gain, canvas, best);
+    }, iterations), canvasSize);
+    cout << "  map " << sparse.map.total() * sparse.map.elemSize() / 1024
+        << " KB (dense " << maps.map.total() * maps.map.elemSize() / 1024
+        << " KB), max error " << sparse.maxError << " px" << endl;
+  }
+
+  // Every pixel type has its own instantiation of the kernel, 8UC1 and 8UC2
+  // are the luma and chroma planes of NV12. Sources of other types are
+  // random, so only the type of the image matters
+  cout << endl << "Pixel types" << endl;
+  const int types[] = { CV_8UC1, CV_8UC2, CV_8UC3, CV_8UC4, CV_16UC1 };
+  for (int type : types) {
+    Mat typed(image.size(), type);
+    if (CV_8UC3 == type) {
+      typed = image;
+    } else {
+      randu(typed, Scalar::all(0), Scalar::all(CV_8U == CV_MAT_DEPTH(type)
+          ? 256 : 65536));
+    }
+
+    const remap_kernel_t kernel = selectRemapKernel(type, best);
+    canvas = Mat::zeros(canvasSize, type);
+    report(typeName(type) + ", " + remapKernelName(kernel.kernel),
+        measure([&]() {
+      remapTransparent(typed, maps, gain, canvas, kernel);
+    }, iterations), canvasSize);
+  }
+
+  // When the rig is rotated, canvas rows run across source rows and
+  // row-by-row traversal touches a new source cache line for every pixel.
+  // Cache misses are counted with a single thread, so all work happens in
+  // the thread that owns the counter
+  cout << endl << "Traversal order, " << remapKernelName(best)
+      << " kernel" << endl;
+  const double angles[] = { 0, 30, 60, 90 };
+  CacheMisses misses;
+  for (double angle : angles) {
+    Size tiltedSize;
+    Mat tilted = tiltedHomography(image.size(), angle, tiltedSize);
+    warp_maps_t rows;
+    buildWarpMaps(tilted, Mat(), Mat(), image.size(), tiltedSize, rows);
+    warp_maps_t blocks = rows;
+    planTiles(blocks, image.size());
+
+    for (const warp_maps_t *traversal : { &rows, &blocks }) {
+      const string name = string(traversal->tiles.empty() ? "rows" : "blocks")
+          + ", " + to_string((int)angle) + " deg";
+      canvas = Mat::zeros(tiltedSize, CV_8UC3);
+      auto compose = [&]() {
+        remapTransparent(image, *traversal, gain, canvas, best);
+      };
+      report(name, measure(compose, iterations), tiltedSize);
+
+      const int threads = getNumThreads();
+      setNumThreads(1);
+      compose();
+      misses.start();
+      compose();
+      long long count = misses.stop();
+      setNumThreads(threads);
+
+      if (count >= 0) {
+        cout << "  single thread: " << count / 1000 << "K cache misses, "
+            << setprecision(3) << (double)count / tiltedSize.area()
+            << " per pixel" << endl;
+      } else {
+        cout << "  cache miss counter is not available" << endl;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -1,15 +1,22 @@
 #include "Debug.hpp"
+#include "capture.hpp"
+#include "compose.hpp"
+#include "replay.hpp"
+#include "rig.hpp"
+#include "scan.hpp"
 #include "utils.hpp"
 #include "opts.hpp"
 
 #include "opencv2/calib3d/calib3d.hpp"
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/video/video.hpp"
 
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <future>
 
 using namespace std;
 using namespace cv;
@@ -38,6 +45,10 @@ int main(int argc, char *argv[])
     cout << "Usage: " << argv[0] << " /path/to/img1.jpg /path/to/img2.jpg";
     return 2;
   }
+  if (opts.video) {
+    // a raw file holds frames of several cameras
+    opts.file_paths = expandFramePaths(opts.file_paths);
+  }
 
   vector<Mat> projected(opts.file_paths.size());
   vector<vector<Point2f>> chessboard_corners_orig_left(opts.file_paths.size());
@@ -50,13 +61,35 @@ int main(int argc, char *argv[])
   vector<Mat> distCoeffs(opts.file_paths.size());
 
   vector<Mat> images(opts.file_paths.size());
-  vector<VideoCapture> videos(opts.file_paths.size());
+  vector<FrameSource> videos(opts.file_paths.size());
   Size chessboardSize(opts.board_width, opts.board_height);
+  frame_filter_t prefilter;
+  frame_filter_t *filter = opts.prefilter ? &prefilter : nullptr;
+
+  // Stages are timed one after another, the operator's time included
+  StageTimings timings;
+  const auto run_start = chrono::steady_clock::now();
+  auto stage_start = run_start;
+  auto lap = [&](const string &stage) {
+    auto now = chrono::steady_clock::now();
+    timings.add(stage, chrono::duration<double, milli>(
+        now - stage_start).count());
+    stage_start = now;
+  };
 
   if (!opts.video) {
+    vector<future<Mat>> decoded(opts.file_paths.size());
+    for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+      decoded[i] = async(launch::async, readImage, opts.file_paths[i], 1);
+    }
     for (size_t i = 0; i < opts.file_paths.size(); ++i) {
-      images[i] = imread(opts.file_paths[i]);
+      images[i] = decoded[i].get();
+      if (images[i].empty()) {
+        cout << "Failed to open file " << opts.file_paths[i] << endl;
+        return 3;
+      }
     }
+    lap("decode");
   } else {
     for (size_t i = 0; i < opts.file_paths.size(); ++i) {
       videos[i].open(opts.file_paths[i]);
@@ -108,7 +141,7 @@ int main(int argc, char *argv[])
         continue; // Use values from config file
       }
 
-      VideoCapture &video = videos[i];
+      FrameSource &video = videos[i];
 
       UState state = UState::NOT_STARTED;
       vector<Point3f> obj;
@@ -154,7 +187,7 @@ int main(int argc, char *argv[])
             auto time = chrono::steady_clock::now();
             color = Scalar(0, 0, 255); // red
             if (findChessboardCorners(frame, chessboardSize,
-                chessboard_corners_orig_left[i])) {
+                chessboard_corners_orig_left[i], filter)) {
               color = Scalar(0, 255, 255); // yellow
               chrono::duration<double, milli> elapsed = time - last_time;
               if (elapsed.count() >= opts.delay) {
@@ -232,37 +265,104 @@ int main(int argc, char *argv[])
         }
       }
     } // End of step 1: disctorion was removed
-
-    Mat status(Size(80 * opts.file_paths.size(), 40), projected[0].type());
-    vector<Mat> frames(opts.file_paths.size());
+    lap("undistort");
 
     WITH_DEBUG(cout << "start searching for good frames" << endl;)
 
     // Step 2: Find good frames for alignment and stitching
-    bool found_good_frames = false;
-    while (!found_good_frames) {
+    if (opts.scan_step > 0) {
+      auto start = chrono::steady_clock::now();
+      vector<vector<float>> scores = scanCalibrationVideos(opts.file_paths,
+          cameraMatrix, distCoeffs, chessboardSize,
+          StitchingMode::ChainOfTargets == opts.mode, opts.scan_step, filter);
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      cout << "Scanned every " << opts.scan_step << "-th frame of "
+          << opts.file_paths.size() << " videos in " << elapsed.count()
+          << " s" << endl;
+
+      float angle = 0;
+      int best = chooseCalibrationFrame(scores, angle);
+      if (best < 0) {
+        cout << "No frames where every camera sees the chessboard" << endl;
+        return 6;
+      }
+      int index = best * opts.scan_step;
+      cout << "Using frame #" << index << ", angle: " << angle << endl;
+      if (angle >= (float)opts.angle) {
+        cout << "Warning: the angle is above " << opts.angle << endl;
+      }
+
       for (size_t i = 0; i < opts.file_paths.size(); ++i) {
         Mat t;
-        videos[i] >> t;
-        undistort(t, frames[i], cameraMatrix[i], distCoeffs[i]);
+        if (!readVideoFrame(opts.file_paths[i], index, t)) {
+          cout << "Failed to read frame #" << index << " of "
+              << opts.file_paths[i] << endl;
+          return 6;
+        }
+        undistort(t, images[i], cameraMatrix[i], distCoeffs[i]);
       }
+    }
+
+    Mat status(Size(80 * opts.file_paths.size(), 40), projected[0].type());
+    vector<Mat> frames(opts.file_paths.size());
+    bool found_good_frames = opts.scan_step > 0;
+    const bool bothHalves = StitchingMode::ChainOfTargets == opts.mode;
+    // Undistortion maps are the same for every frame of a camera
+    vector<Mat> map1(opts.file_paths.size()), map2(opts.file_paths.size());
+    vector<char> chessboardL(opts.file_paths.size());
+    vector<char> chessboardR(opts.file_paths.size());
+    while (!found_good_frames) {
+      // Cameras are read, undistorted and searched in parallel, the right
+      // half of a frame in a task of its own
+      vector<future<bool>> searched(opts.file_paths.size());
+      for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+        searched[i] = async(launch::async, [&, i]() {
+          Mat t;
+          videos[i] >> t;
+          if (t.empty()) {
+            return false;
+          }
+          if (map1[i].empty()) {
+            initUndistortRectifyMap(cameraMatrix[i], distCoeffs[i], Mat(),
+                cameraMatrix[i], t.size(), CV_16SC2, map1[i], map2[i]);
+          }
+          remap(t, frames[i], map1[i], map2[i], INTER_LINEAR);
+
+          cv::Rect leftHalfRect(0, 0, frames[i].cols / 2, frames[i].rows);
+          cv::Rect rightHalfRect(frames[i].cols / 2, 0, frames[i].cols / 2, frames[i].rows);
+          Mat leftHalf = bothHalves ? frames[i](leftHalfRect) : frames[i];
+          Mat rightHalf = frames[i](rightHalfRect);
+
+          future<bool> right;
+          if (bothHalves) {
+            right = async(launch::async, [&, i]() {
+              return findChessboardCorners(rightHalf, chessboardSize,
+                  chessboard_corners_orig_right[i], filter);
+            });
+          }
+          chessboardL[i] = findChessboardCorners(leftHalf, chessboardSize,
+              chessboard_corners_orig_left[i], filter);
+          chessboardR[i] = bothHalves ? right.get() : true;
+          return true;
+        });
+      }
+      bool ended = false;
+      for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+        if (!searched[i].get()) {
+          cout << "No more frames in " << opts.file_paths[i] << endl;
+          ended = true;
+        }
+      }
+      if (ended) {
+        return 6;
+      }
+
       for (size_t i = 0; i < opts.file_paths.size(); ++i) {
-        cv::Rect leftHalfRect(0, 0, frames[i].cols / 2, frames[i].rows);
-        cv::Rect rightHalfRect(frames[i].cols / 2, 0, frames[i].cols / 2, frames[i].rows);
-        Mat leftHalf = (StitchingMode::ChainOfTargets == opts.mode) ? frames[i](leftHalfRect) : frames[i];
-        Mat rightHalf = frames[i](rightHalfRect);
-
-        bool chessboardL = findChessboardCorners(leftHalf, chessboardSize,
-            chessboard_corners_orig_left[i]);
-        bool chessboardR = true;
-        if (StitchingMode::ChainOfTargets == opts.mode)
-          chessboardR = findChessboardCorners(rightHalf, chessboardSize,
-              chessboard_corners_orig_right[i]);
         // red or orange
-        Scalar colorL = chessboardL ? Scalar(0, 0, 255) : Scalar(0, 165, 255);
-        Scalar colorR = chessboardR ? Scalar(0, 0, 255) : Scalar(0, 165, 255);
+        Scalar colorL = chessboardL[i] ? Scalar(0, 0, 255) : Scalar(0, 165, 255);
+        Scalar colorR = chessboardR[i] ? Scalar(0, 0, 255) : Scalar(0, 165, 255);
 
-        if (chessboardL && chessboardR) {
+        if (chessboardL[i] && chessboardR[i]) {
           float angle = angleToHorizon(chessboard_corners_orig_left[i],
               chessboardSize);
           if (angle < (float)opts.angle) {
@@ -285,9 +385,10 @@ int main(int argc, char *argv[])
       }
       for (size_t i = 0; i < opts.file_paths.size(); ++i) {
         displayResult("Frame from camera " + std::to_string(i), frames[i]);
-        waitKey(30);
       }
       imshow("Status", status);
+      // one wait refreshes every window, so the loop does not slow down
+      // with the number of cameras
       char r = waitKey(30);
       if (r == 'y') {
         for (size_t i = 0; i < opts.file_paths.size(); ++i) {
@@ -296,6 +397,11 @@ int main(int argc, char *argv[])
         found_good_frames = true;
       }
     }
+
+    if (filter && opts.verbosity > 0) {
+      printFrameFilterStats(cout, *filter);
+    }
+    lap("frames");
   }
   WITH_DEBUG(cout << "start calculating coeffs for stitching" << endl;)
 
@@ -318,6 +424,7 @@ int main(int argc, char *argv[])
           << "-th image to the floor" << endl;
     )
   }
+  lap("project");
 
   if (StitchingMode::ChainOfTargets == opts.mode) {
     for (size_t i = 0; i < opts.file_paths.size() - 1; ++i) {
@@ -338,8 +445,9 @@ int main(int argc, char *argv[])
           cout << "\t: " << row << endl;
         }
       )
-      chessboard_corners_orig_right[i] = extractCorners(
-          orderChessboardCorners(chessboard_points, chessboardSize));
+      chessboard_view_t ordered = viewChessboardCorners(chessboard_points,
+          chessboardSize);
+      chessboard_corners_orig_right[i] = extractCorners(ordered);
       for (auto &P : chessboard_corners_orig_right[i]) {
         P.x += images[i].cols / 2;
       }
@@ -349,11 +457,10 @@ int main(int argc, char *argv[])
     bool K = isTransposed[i];
     Mat temp;
     images[i].copyTo(temp);
-    auto ordered = orderChessboardCorners(chessboard_points, chessboardSize);
     int r = 1;
-    for (size_t i = 0; i < ordered.size(); ++i) {
-      for (size_t j = 0; j < ordered[i].size(); ++j) {
-        cv::Point2f &P = ordered[i][j];
+    for (int i = 0; i < ordered.rows; ++i) {
+      for (int j = 0; j < ordered.cols; ++j) {
+        cv::Point2f P = ordered.at(i, j);
         P.x += temp.cols / 2;
         cv::circle(temp, P, (r * 5), cv::Scalar(200, 250, 250), 3);
         ++r;
@@ -382,7 +489,7 @@ int main(int argc, char *argv[])
       return 2;
     }
     chessboard_corners_target_right[0] = extractCorners(
-        orderChessboardCorners(chessboard_points, chessboardSize));
+        viewChessboardCorners(chessboard_points, chessboardSize));
     for (auto &P : chessboard_corners_target_right[0]) {
       P.x += projected[0].cols / 2;
     }
@@ -494,32 +601,132 @@ int main(int argc, char *argv[])
     displayResult("intermediate", intermediate, true);
   }
 
-  FileStorage fs(opts.stitch_config, FileStorage::WRITE);
+  lap("align");
 
-  fs << "video" << opts.video;
-  fs << "file_paths" << "[";
-  for (int i = 0; i < opts.file_paths.size(); ++i) {
-    fs << opts.file_paths[i];
-  }
-  fs << "]";
-  fs << "result_size" << result_size;
-  fs << "H" << "[";
-  for (int i = 0; i < opts.file_paths.size(); ++i) {
-    fs << H[i];
+  // Cameras may have different exposure: estimate gains which make
+  // brightness of overlapping areas equal
+  vector<Vec3f> gains(opts.file_paths.size(), Vec3f(1, 1, 1));
+  if (opts.gain_compensation && opts.file_paths.size() > 1) {
+    gains = estimateGains(images, H, result_size);
+    WITH_DEBUG(
+      for (size_t i = 0; i < gains.size(); ++i) {
+        cout << "Gain for camera #" << i << ": " << gains[i][0] << " "
+            << gains[i][1] << " " << gains[i][2] << endl;
+      }
+    )
   }
-  fs << "]";
-  fs << "cameraMatrix" << "[";
+
+  lap("gains");
+
+  // Outer cameras of wide rigs are stretched by the plane without bounds,
+  // a curved canvas grows with the field of view only
+  vector<Size> image_sizes(opts.file_paths.size());
   for (size_t i = 0; i < opts.file_paths.size(); ++i) {
-    fs << cameraMatrix[i];
+    image_sizes[i] = images[i].size();
   }
-  fs << "]";
-  fs << "distCoeffs" << "[";
-  for (size_t i = 0; i < opts.file_paths.size(); ++i) {
-    fs << distCoeffs[i];
+  projection_t projection;
+  if (opts.projection != Projection::Plane) {
+    if (!fitProjection(opts.projection, H, cameraMatrix[0], image_sizes,
+        projection, result_size)) {
+      cout << "Cameras do not fit on the "
+          << (Projection::Cylindrical == opts.projection
+              ? "cylinder" : "sphere")
+          << ", an optical axis may be too far from the one of camera #0"
+          << endl;
+      return 7;
+    }
+    cout << "result_size on the "
+        << (Projection::Cylindrical == opts.projection
+            ? "cylinder: " : "sphere: ") << result_size << endl;
+  }
+
+  // stitch allocates the whole canvas, one badly tilted board must not
+  // make it arbitrarily large
+  const double scale = budgetScale(result_size, opts.max_megapixels);
+  if (scale < 1) {
+    transformCanvas(Point2d(), scale, H, projection);
+    result_size = scaleCanvasSize(result_size, scale);
+    cout << "result_size within " << opts.max_megapixels << " Mpix: "
+        << result_size << endl;
   }
-  fs << "]";
 
-  fs.release();
+  // Borders which no camera sees would be allocated and never composed.
+  // Coverage is that of the distorted sources stitch composes
+  if (opts.crop) {
+    vector<warp_maps_t> maps(opts.file_paths.size());
+    for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+      buildWarpMaps(H[i], projection, cameraMatrix[i], distCoeffs[i],
+          image_sizes[i], result_size, maps[i]);
+    }
+    Rect covered = largestCoveredRect(
+        buildOwnerMap(maps, image_sizes, result_size));
+    if (covered.area() > 0) {
+      transformCanvas(covered.tl(), 1, H, projection);
+      result_size = covered.size();
+
+      // resolution given away to the budget is taken back as far as the
+      // cropped canvas fits into it
+      double regain = 1.0 / scale;
+      if (opts.max_megapixels > 0) {
+        regain = min(regain, sqrt(opts.max_megapixels * 1e6 /
+            result_size.area()));
+      }
+      if (regain > 1) {
+        transformCanvas(Point2d(), regain, H, projection);
+        result_size = scaleCanvasSize(result_size, regain);
+      }
+      cout << "result_size cropped to " << covered << ": " << result_size
+          << endl;
+    } else {
+      cout << "No part of the canvas is covered, not cropping" << endl;
+    }
+  }
+
+  lap("canvas");
+
+  // Each canvas pixel is assigned to a single camera once, so stitch does
+  // not sample overlapping cameras on top of each other. Owners are chosen
+  // on the same distorted sources stitch composes video frames from
+  Mat owners;
+  if (opts.owner_map && opts.file_paths.size() > 1) {
+    vector<warp_maps_t> maps(opts.file_paths.size());
+    for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+      buildWarpMaps(H[i], projection, cameraMatrix[i], distCoeffs[i],
+          image_sizes[i], result_size, maps[i]);
+    }
+    owners = buildOwnerMap(maps, image_sizes, result_size);
+    WITH_DEBUG(
+      displayResult("owners", owners * (255.0 / opts.file_paths.size()), true);
+    )
+  }
+
+  lap("owners");
+
+  stitch_config_t config;
+  config.video = opts.video;
+  config.file_paths = opts.file_paths;
+  config.result_size = result_size;
+  config.projection = projection;
+  config.H = H;
+  config.cameraMatrix = cameraMatrix;
+  config.distCoeffs = distCoeffs;
+  config.gains = gains;
+  config.owners = owners;
+  config.image_sizes = image_sizes;
+  // stitch looks for the boards again to follow drift of the cameras
+  config.board_corners = chessboard_corners_orig_left;
+  if (!writeStitchConfig(opts.stitch_config, config)) {
+    cout << "Failed to write " << opts.stitch_config << endl;
+    return 5;
+  }
+  lap("write");
+
+  timings.add("total", chrono::duration<double, milli>(
+      chrono::steady_clock::now() - run_start).count());
+  if (!opts.timings_path.empty() && !timings.write(opts.timings_path)) {
+    cout << "Failed to write " << opts.timings_path << endl;
+    return 5;
+  }
 
   return 0;
 }
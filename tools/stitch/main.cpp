@@ -1,4 +1,12 @@
 #include "Debug.hpp"
+#include "capture.hpp"
+#include "compose.hpp"
+#include "metrics.hpp"
+#include "replay.hpp"
+#include "rig.hpp"
+#include "shard.hpp"
+#include "stream.hpp"
+#include "topology.hpp"
 #include "utils.hpp"
 #include "opts.hpp"
 
@@ -7,114 +15,358 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/video/video.hpp"
 
+#include <signal.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <future>
+#include <memory>
 
 using namespace std;
 using namespace cv;
 
 extern command_line_opts opts;
 
-int main(int argc, char *argv[])
-{
-  if (!parse_command_line_opts(argc, argv)) {
-    cout << "Usage: " << argv[0] << " -c=/path/to/conf.xml";
-    return 1;
-  }
-
-  FileStorage fs(opts.stitch_config, FileStorage::READ);
+namespace {
 
-  if (!fs.isOpened()) {
-    cout << "Failed to open configuration file " << opts.stitch_config << endl;
-    return 2;
+// CPUs of a stage, false with a message if the set is invalid
+bool resolveCpus(const string &spec, const char *stage, vector<int> &cpus) {
+  cpus.clear();
+  if (spec.empty()) {
+    return true;
   }
-
-  fs["video"] >> opts.video;
-  FileNode fNames = fs["file_paths"];
-  if (fNames.type() != FileNode::SEQ) {
-    cout << "file_paths is not a sequence!" << endl;
-    return 4;
+  cpus = parseCpuSet(spec);
+  if (cpus.empty()) {
+    cout << "Invalid CPU set " << spec << " of " << stage << " stage" << endl;
+    return false;
+  }
+  const vector<numa_node_t> nodes = numaNodes();
+  for (int cpu : cpus) {
+    bool present = false;
+    for (const numa_node_t &node : nodes) {
+      present = present ||
+          find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end();
+    }
+    if (!present) {
+      cout << "CPU " << cpu << " of " << stage << " stage is not present"
+          << endl;
+      return false;
+    }
   }
+  return true;
+}
 
-  opts.file_paths.resize(fNames.size());
-  for (size_t index = 0; index < fNames.size(); ++index) {
-    fNames[index] >> opts.file_paths[index];
-    WITH_DEBUG(
-      cout << "Read file path " << endl << opts.file_paths[index] << endl;
-    )
+// Metrics of the frame loop, registered before it starts. Undistortion is
+// folded into the warp maps, so it is part of the warp time
+struct stitch_metrics_t {
+  stitch_metrics_t(MetricsRegistry &registry, size_t cameras)
+      : frames(registry.counter("stitch_frames_total", "Frames stitched")),
+      fps(registry.gauge("stitch_fps", "Frames stitched per second")),
+      read(registry.histogram("stitch_stage_seconds",
+          "Time a frame spends in a stage", metricLabel("stage", "read"))),
+      compose(registry.histogram("stitch_stage_seconds", "",
+          metricLabel("stage", "compose"))),
+      frame(registry.histogram("stitch_stage_seconds", "",
+          metricLabel("stage", "frame"))),
+      queued(registry.gauge("stitch_queue_depth",
+          "Frames read and not output yet", metricLabel("queue", "compose"))),
+      buffers(registry.gauge("stitch_buffer_pool_size",
+          "Canvas buffers of the frame loop")),
+      busy_buffers(registry.gauge("stitch_buffer_pool_busy",
+          "Canvas buffers holding frames not output yet")),
+      stream_dropped(registry.counter("stitch_dropped_frames_total",
+          "Frames dropped instead of being output",
+          metricLabel("stage", "stream"))),
+      shard_restarts(registry.counter("stitch_shard_restarts_total",
+          "Shard worker processes restarted after a failure")) {
+    for (size_t i = 0; i < cameras; ++i) {
+      const string camera = metricLabel("camera", to_string(i));
+      decode.push_back(&registry.histogram("stitch_decode_seconds",
+          "Time to read a frame of a camera", camera));
+      convert.push_back(&registry.histogram("stitch_convert_seconds",
+          "Time to convert a frame of a camera to the composed format",
+          camera));
+      warp.push_back(&registry.histogram("stitch_warp_seconds",
+          "Time to warp a frame of a camera onto the canvas", camera));
+    }
   }
 
-  if (opts.file_paths.empty()) {
-    cout << "Usage: " << argv[0] << " /path/to/img1.jpg /path/to/img2.jpg";
-    return 3;
+  Counter &frames;
+  Gauge &fps;
+  Histogram &read;
+  Histogram &compose;
+  Histogram &frame;
+  Gauge &queued;
+  Gauge &buffers;
+  Gauge &busy_buffers;
+  Counter &stream_dropped;
+  Counter &shard_restarts;
+  vector<Histogram*> decode;
+  vector<Histogram*> convert;
+  vector<Histogram*> warp;
+};
+
+double secondsSince(const chrono::steady_clock::time_point &start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Frame of the throughput schedule, composed by the thread of its slot into
+// a canvas of its own
+struct in_flight_t {
+  // frames as read and as composed, converted by the compose thread
+  vector<Mat> captured;
+  vector<Mat> frames;
+  vector<int64_t> timestamps;
+  Mat canvas;
+  // rig to compose the frame with and the one the canvas was composed with
+  shared_ptr<const rig_t> rig;
+  shared_ptr<const rig_t> canvas_rig;
+  double read_ms = 0;
+  double compose_ms = 0;
+};
+
+// Compose the frame in flight, milliseconds it took
+double composeInFlight(in_flight_t &slot, const vector<char> &convert,
+    const remap_kernel_t &kernel, const remap_kernel_t &luma_kernel,
+    const remap_kernel_t &chroma_kernel, stitch_metrics_t &metrics) {
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < slot.captured.size(); ++i) {
+    auto convert_start = chrono::steady_clock::now();
+    if (convert[i] && opts.planar) {
+      convertBGRToNV12(slot.captured[i], slot.frames[i]);
+    } else if (convert[i]) {
+      convertNV12ToBGR(slot.captured[i], slot.frames[i]);
+    } else {
+      slot.frames[i] = slot.captured[i];
+    }
+    if (convert[i]) {
+      metrics.convert[i]->observe(secondsSince(convert_start));
+    }
   }
 
-  Size result_size;
+  const rig_t &rig = *slot.rig;
+  if (slot.canvas_rig != slot.rig) {
+    if (opts.planar) {
+      slot.canvas = createNV12Canvas(rig.config.result_size);
+    } else {
+      slot.canvas.setTo(Scalar::all(0));
+    }
+    slot.canvas_rig = slot.rig;
+  }
+  for (size_t i = 0; i < slot.frames.size(); ++i) {
+    auto warp_start = chrono::steady_clock::now();
+    if (opts.planar) {
+      remapTransparentNV12(slot.frames[i], rig.maps[i], rig.chroma[i],
+          lumaGain(rig.gains[i]), slot.canvas, luma_kernel, chroma_kernel);
+    } else {
+      remapTransparent(slot.frames[i], rig.maps[i], rig.gains[i],
+          slot.canvas, kernel);
+    }
+    metrics.warp[i]->observe(secondsSince(warp_start));
+  }
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start).count();
+}
 
-  fs["result_size"] >> result_size;
-  WITH_DEBUG(
-    cout << "Result size: " << result_size << endl;
-  )
+// Worker process of sharded composition: compose a band of the canvas of
+// every frame the coordinator places in the segment until it stops
+int composeShard(const stitch_config_t &config) {
+  // a worker is useless without its coordinator
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
 
-  vector<Mat> H(opts.file_paths.size());
-  FileNode fH = fs["H"];
-  if (fH.type() != FileNode::SEQ)
-  {
-    cout << "H is not a sequence!" << endl;
-    return 4;
+  ShardSegment segment(opts.shard_segment);
+  if (!segment.isOpened() || opts.shard_index >= segment.workers() ||
+      segment.cameras() != config.file_paths.size()) {
+    cout << "Failed to attach to shard segment " << opts.shard_segment
+        << endl;
+    return 5;
   }
 
-  for (size_t index = 0; index < fH.size(); ++index) {
-    fH[index] >> H[index];
-    WITH_DEBUG(
-      cout << "Read matrix " << endl << H[index] << endl;
-    )
+  vector<Size> frame_sizes(segment.cameras());
+  for (size_t i = 0; i < frame_sizes.size(); ++i) {
+    frame_sizes[i] = segment.frame(i).size();
   }
+  const remap_kernel_t kernel = selectRemapKernel(segment.frame(0).type(),
+      opts.remap_kernel);
 
-  vector<Mat> cameraMatrix(opts.file_paths.size());
+  // Workers share the cores of the machine or the compose ones, each worker
+  // its own slice of them, so its band is first touched on its node
+  vector<int> compose_cpus;
+  if (!resolveCpus(opts.compose_cpus, "compose", compose_cpus)) {
+    return 1;
+  }
+  const size_t count = compose_cpus.size();
+  const size_t workers = (size_t)segment.workers();
+  const size_t index = (size_t)opts.shard_index;
+  vector<int> cpus(compose_cpus.begin() + count * index / workers,
+      compose_cpus.begin() + count * (index + 1) / workers);
+  if (cpus.empty()) {
+    cpus = compose_cpus;
+  }
+  setNumThreads(cpus.empty() ? max(1, getNumberOfCPUs() / (int)workers)
+      : (int)cpus.size());
+  const int pinned = pinParallelThreads(cpus);
+  if (!cpus.empty() && pinned < getNumThreads()) {
+    cout << "Warning: worker #" << opts.shard_index << " pinned " << pinned
+        << " of " << getNumThreads() << " threads to its CPUs" << endl;
+  }
 
-  FileNode fCameraMatrix = fs["cameraMatrix"];
-  if (fCameraMatrix.type() != FileNode::SEQ) {
-    cout << "cameraMatrix is not a sequence!" << endl;
-    return 4;
+  // Drift is searched for by nobody: bands would drift apart
+  const Range band = segment.band(opts.shard_index);
+  RigUpdater updater(buildRig(config, frame_sizes, band), opts.stitch_config,
+      0);
+  shared_ptr<const rig_t> rig = updater.current();
+  Mat canvas = segment.canvas();
+  while (segment.nextFrame(opts.shard_index)) {
+    shared_ptr<const rig_t> next = updater.current();
+    if (next != rig) {
+      rig = next;
+      canvas.rowRange(band).setTo(Scalar::all(0));
+    }
+    for (size_t i = 0; i < segment.cameras(); ++i) {
+      remapTransparent(segment.frame(i), rig->maps[i], rig->gains[i], canvas,
+          kernel);
+    }
+    segment.frameDone(opts.shard_index);
   }
+  return 0;
+}
 
-  for (size_t index = 0; index < fCameraMatrix.size(); ++index) {
-    fCameraMatrix[index] >> cameraMatrix[index];
-    WITH_DEBUG(
-      cout << "Read matrix " << endl << cameraMatrix[index] << endl;
-    )
+}
+
+int main(int argc, char *argv[])
+{
+  if (!parse_command_line_opts(argc, argv)) {
+    cout << "Usage: " << argv[0] << " -c=/path/to/conf.xml";
+    return 1;
   }
 
-  vector<Mat> distCoeffs(opts.file_paths.size());
-  FileNode fDistCoeffs = fs["distCoeffs"];
-  if (fDistCoeffs.type() != FileNode::SEQ) {
-    cout << "distCoeffs is not a sequence!" << endl;
-    return 4;
+  if (!isRemapKernelSupported(opts.remap_kernel)) {
+    cout << "Kernel " << remapKernelName(opts.remap_kernel)
+        << " is not supported on this machine" << endl;
+    return 6;
   }
+  WITH_DEBUG(
+    cout << "Best remap kernel: " << remapKernelName(bestRemapKernel()) << endl;
+  )
 
-  for (size_t index = 0; index < fDistCoeffs.size(); ++index) {
-    fDistCoeffs[index] >> distCoeffs[index];
-    WITH_DEBUG(
-      cout << "Read matrix " << endl << distCoeffs[index] << endl;
-    )
+  stitch_config_t config;
+  int status = readStitchConfig(opts.stitch_config, config);
+  if (3 == status) {
+    cout << "Usage: " << argv[0] << " /path/to/img1.jpg /path/to/img2.jpg";
+  }
+  if (status != 0) {
+    return status;
   }
 
-  fs.release();
+  opts.video = config.video;
+  opts.file_paths = config.file_paths;
+  if (!opts.shard_segment.empty()) {
+    return composeShard(config);
+  }
+  const Size result_size = config.result_size;
+  const vector<Mat> &H = config.H;
+  const vector<Size> &image_sizes = config.image_sizes;
+  vector<Vec3f> gains = config.gains;
+  if (!opts.gain_compensation) {
+    gains.assign(gains.size(), Vec3f(1, 1, 1));
+  }
+  // Owner map is optional too: without it the last camera wins in overlaps
+  Mat owners = opts.owner_map ? config.owners : Mat();
 
   if (!opts.video) {
-    Mat img0 = imread(opts.file_paths.front());
-    Mat result(result_size, img0.type());
+    StageTimings timings;
+    const auto run_start = chrono::steady_clock::now();
+    auto stage_start = run_start;
+    auto lap = [&](const string &stage) {
+      auto now = chrono::steady_clock::now();
+      timings.add(stage, chrono::duration<double, milli>(
+          now - stage_start).count());
+      stage_start = now;
+    };
+
+    // Configs written before owner maps can still have them if sizes of
+    // images are known
+    bool sizes_known = true;
+    for (const Size &size : image_sizes) {
+      sizes_known = sizes_known && size.area() > 0;
+    }
+    if (opts.owner_map && owners.empty() && sizes_known &&
+        opts.file_paths.size() > 1) {
+      vector<warp_maps_t> maps(opts.file_paths.size());
+      for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+        buildWarpMaps(H[i], config.projection, Mat(), Mat(), image_sizes[i],
+            result_size, maps[i], opts.map_grid);
+      }
+      owners = buildOwnerMap(maps, image_sizes, result_size);
+      lap("owners");
+    }
+
+    vector<int> reduction(opts.file_paths.size(),
+        max(opts.decode_reduction, 1));
+    if (0 == opts.decode_reduction) {
+      for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+        if (0 == image_sizes[i].area()) {
+          WITH_DEBUG(cout << "No size of image #" << i << " in config, "
+              << "decoding it at full resolution" << endl;)
+          continue;
+        }
+        reduction[i] = chooseDecodeReduction(H[i], image_sizes[i]);
+        WITH_DEBUG(
+          cout << "Decode reduction for image #" << i << ": "
+              << reduction[i] << endl;
+        )
+      }
+    }
+
+    // Start decoding of all images at once, so i-th image is warped while
+    // the following ones are still being decoded
+    vector<future<Mat>> decoded(opts.file_paths.size());
+    for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+      decoded[i] = async(launch::async, readImage, opts.file_paths[i],
+          reduction[i]);
+    }
+
+    Mat result;
 
     auto start = chrono::steady_clock::now();
     auto end = chrono::steady_clock::now();
 
     for (size_t i = 0; i < opts.file_paths.size(); ++i) {
-      Mat image = imread(opts.file_paths[i]);
+      // only the time decoding is ahead of warping is counted
+      stage_start = chrono::steady_clock::now();
+      Mat image = decoded[i].get();
+      if (image.empty()) {
+        cout << "Failed to read image " << opts.file_paths[i] << "!" << endl;
+        return 5;
+      }
+      if (result.empty()) {
+        result = Mat::zeros(result_size, image.type());
+      }
+      lap("decode");
+
       start = chrono::steady_clock::now();
-      warpPerspective(image, result, H[i], result_size, INTER_LINEAR,
-          BORDER_TRANSPARENT);
+      warp_maps_t maps;
+      buildWarpMaps(scaleHomography(H[i], reduction[i]), config.projection,
+          Mat(), Mat(), image.size(), result_size, maps, opts.map_grid);
+      if (maps.grid > 1) {
+        cout << "Max error of sparse map for image #" << i << ": "
+            << maps.maxError << " px" << endl;
+      }
+      if (!owners.empty()) {
+        applyOwnerMap(maps, owners, (int)i);
+      }
+      if (opts.blocked_traversal) {
+        planTiles(maps, image.size());
+      }
+      lap("maps");
+      remapTransparent(image, maps, gains[i], result, opts.remap_kernel);
+      lap("remap");
       end = chrono::steady_clock::now();
       cout << chrono::duration<double, milli>(end - start).count() << endl;
       displayResult("temp", result, true);
@@ -122,36 +374,608 @@ int main(int argc, char *argv[])
 
 
     displayResult("Final", result, true);
+    stage_start = chrono::steady_clock::now();
     imwrite("final.jpg", result);
+    lap("write");
+
+    timings.add("total", chrono::duration<double, milli>(
+        chrono::steady_clock::now() - run_start).count());
+    if (!opts.timings_path.empty() && !timings.write(opts.timings_path)) {
+      cout << "Failed to write " << opts.timings_path << "!" << endl;
+      return 5;
+    }
   } else {
-    vector<VideoCapture> videos(opts.file_paths.size());
+    bool replaying = !opts.replay_path.empty();
+    if (replaying) {
+      // recorded frames stand in for the cameras of the config
+      opts.file_paths = expandFramePaths({opts.replay_path});
+      if (opts.file_paths.size() != config.file_paths.size()) {
+        cout << opts.replay_path << " does not have frames of "
+            << config.file_paths.size() << " cameras" << endl;
+        return 5;
+      }
+    }
+
+    // Stages are pinned before they start their threads, which inherit the
+    // CPUs. The main thread moves between the read and compose stages
+    vector<int> read_cpus, compose_cpus, encode_cpus;
+    if (!resolveCpus(opts.read_cpus, "read", read_cpus) ||
+        !resolveCpus(opts.compose_cpus, "compose", compose_cpus) ||
+        !resolveCpus(opts.encode_cpus, "encode", encode_cpus)) {
+      return 1;
+    }
+    const bool pinned = !read_cpus.empty() || !compose_cpus.empty() ||
+        !encode_cpus.empty();
+    const vector<int> all_cpus = currentThreadCpus();
+    auto pin = [&](const vector<int> &cpus) {
+      if (pinned) {
+        pinCurrentThread(cpus.empty() ? all_cpus : cpus);
+      }
+    };
+    pin(read_cpus);
+
+    vector<FrameSource> videos(opts.file_paths.size());
     for (size_t i = 0; i < opts.file_paths.size(); ++i) {
       videos[i].open(opts.file_paths[i]);
       if (!videos[i].isOpened()) {
         cout << "Failed to open file " << opts.file_paths[i] << "!" << endl;
         return 5;
       }
+      // Packed frames would be converted to NV12 on every frame, which
+      // costs more than composing the planes saves
+      if (opts.planar && !videos[i].requestNV12()) {
+        cout << "Warning: " << opts.file_paths[i] << " delivers BGR frames, "
+            << "--planar pays off for NV12 sources only" << endl;
+      }
     }
 
-    Mat t;
-    videos.front() >> t;
-    int type = t.type();
-    for (size_t i = 1; i < opts.file_paths.size(); ++i) {
+    vector<Size> frame_sizes(videos.size());
+    vector<int> types(videos.size(), CV_8UC3);
+    // Frames are converted when their format differs from the composed one
+    vector<char> convert(videos.size());
+    int type = CV_8UC3;
+    for (size_t i = 0; i < opts.file_paths.size(); ++i) {
+      Mat t;
       videos[i] >> t; // skip first frame
+      const bool nv12 = FrameFormat::NV12 == videos[i].format();
+      convert[i] = nv12 != opts.planar;
+      type = types[i] = nv12 ? CV_8UC3 : t.type();
+      if (nv12 && (t.type() != CV_8UC1 || t.rows % 3 != 0)) {
+        cout << "Frames of " << opts.file_paths[i]
+            << " are not NV12 although the source says so" << endl;
+        return 5;
+      }
+      frame_sizes[i] = nv12 ? nv12ImageSize(t) : t.size();
+      if (opts.planar &&
+          (frame_sizes[i].width % 2 != 0 || frame_sizes[i].height % 2 != 0)) {
+        cout << "Frames of " << opts.file_paths[i]
+            << " have odd size, NV12 needs even one" << endl;
+        return 5;
+      }
+      if (opts.planar && !nv12 && t.type() != CV_8UC3) {
+        cout << "Frames of " << opts.file_paths[i]
+            << " are not BGR, they can not be converted to NV12" << endl;
+        return 5;
+      }
+      if (types[i] != types[0]) {
+        cout << "Frames of " << opts.file_paths[i]
+            << " have a type different from the first camera" << endl;
+        return 5;
+      }
+      if (replaying) {
+        // every recorded frame is replayed
+        videos[i].seek(0);
+      }
+    }
+    if (!isRemapTypeSupported(type)) {
+      cout << "Frames of type " << type << " can not be composed" << endl;
+      return 5;
+    }
+
+    // Kernels are instantiated per pixel type, the frame loop only calls
+    // the selected ones
+    const remap_kernel_t kernel = selectRemapKernel(type, opts.remap_kernel);
+    const remap_kernel_t luma_kernel = selectRemapKernel(CV_8UC1,
+        opts.remap_kernel);
+    const remap_kernel_t chroma_kernel = selectRemapKernel(CV_8UC2,
+        opts.remap_kernel);
+    WITH_DEBUG(
+      cout << "Remap kernel: " << remapKernelName(opts.planar
+          ? luma_kernel.kernel : kernel.kernel) << endl;
+    )
+
+    unique_ptr<RawFrameWriter> recorder;
+    if (!opts.record_path.empty()) {
+      // composed frames are recorded
+      vector<Size> record_sizes = frame_sizes;
+      vector<int> record_types = types;
+      vector<FrameFormat> formats(videos.size(), FrameFormat::Packed);
+      if (opts.planar) {
+        for (size_t i = 0; i < videos.size(); ++i) {
+          record_sizes[i].height = frame_sizes[i].height / 2 * 3;
+          record_types[i] = CV_8UC1;
+          formats[i] = FrameFormat::NV12;
+        }
+      }
+      recorder.reset(new RawFrameWriter(opts.record_path, record_sizes,
+          record_types, formats));
+      if (!recorder->isOpened()) {
+        cout << "Failed to open file " << opts.record_path << "!" << endl;
+        return 5;
+      }
+    }
+
+    // Cameras are recomposed independently, so they must not overlap
+    if (opts.incremental && !opts.owner_map && videos.size() > 1) {
+      cout << "Incremental composition needs owner map, "
+          << "composing whole frames" << endl;
+      opts.incremental = false;
+    }
+    if (opts.incremental && opts.planar) {
+      cout << "Incremental composition of planar frames is not supported, "
+          << "composing whole frames" << endl;
+      opts.incremental = false;
+    }
+    if (opts.shard_workers > 0 && (opts.planar ||
+        videos.size() > kMaxShardCameras ||
+        (size_t)opts.shard_workers > kMaxShardWorkers)) {
+      cout << "Sharding supports packed frames of up to " << kMaxShardCameras
+          << " cameras and up to " << kMaxShardWorkers << " workers, "
+          << "composing in a single process" << endl;
+      opts.shard_workers = 0;
+    }
+    if (opts.shard_workers > 0 && opts.incremental) {
+      cout << "Incremental composition is not sharded, "
+          << "composing whole frames" << endl;
+      opts.incremental = false;
+    }
+    bool throughput = Schedule::Throughput == opts.schedule;
+    if (throughput && opts.shard_workers > 0) {
+      cout << "Sharded composition has a single canvas, "
+          << "composing one frame at a time" << endl;
+      throughput = false;
+    }
+    if (throughput && opts.incremental) {
+      cout << "Incremental composition needs the previous frame, "
+          << "composing whole frames" << endl;
+      opts.incremental = false;
+    }
+    if (opts.shard_workers > 0 && opts.drift_interval > 0) {
+      cout << "Drift of sharded rigs is not tracked" << endl;
+      opts.drift_interval = 0;
+    }
+
+    // Workers compose bands of the canvas straight from the frames in the
+    // segment into the canvas in it
+    unique_ptr<ShardSegment> segment;
+    unique_ptr<ShardWorkers> workers;
+    if (opts.shard_workers > 0) {
+      const string name = "/stitch-" + to_string(getpid());
+      segment.reset(new ShardSegment(name, frame_sizes, types, result_size,
+          type, opts.shard_workers));
+      if (!segment->isOpened()) {
+        cout << "Failed to create shard segment " << name << "!" << endl;
+        return 5;
+      }
+      workers.reset(new ShardWorkers(*segment,
+          vector<string>(argv, argv + argc)));
+      if (!workers->isRunning()) {
+        cout << "Failed to start shard workers!" << endl;
+        return 5;
+      }
+      cout << "Composing " << opts.shard_workers
+          << " bands in worker processes" << endl;
+    }
+
+    unique_ptr<MjpegServer> server;
+    if (opts.http_port > 0) {
+      pin(encode_cpus);
+      server.reset(new MjpegServer(opts.http_port, opts.jpeg_quality,
+          encode_cpus));
+      if (!server->isOpened()) {
+        cout << "Failed to listen on port " << opts.http_port << "!" << endl;
+        return 5;
+      }
+      cout << "Streaming MJPEG on http://localhost:" << server->port() << "/"
+          << endl;
+    }
+
+    // Exporters only read the metrics, they run with the encoder
+    MetricsRegistry registry;
+    stitch_metrics_t metrics(registry, videos.size());
+    unique_ptr<MetricsServer> metrics_server;
+    unique_ptr<MetricsFileWriter> metrics_file;
+    if (opts.metrics_port > 0) {
+      pin(encode_cpus);
+      metrics_server.reset(new MetricsServer(registry, opts.metrics_port));
+      if (!metrics_server->isOpened()) {
+        cout << "Failed to listen on port " << opts.metrics_port << "!"
+            << endl;
+        return 5;
+      }
+      cout << "Serving metrics on http://localhost:" << metrics_server->port()
+          << "/metrics" << endl;
+    }
+    if (!opts.metrics_path.empty()) {
+      pin(encode_cpus);
+      metrics_file.reset(new MetricsFileWriter(registry, opts.metrics_path,
+          opts.metrics_interval));
+      if (!metrics_file->write()) {
+        cout << "Failed to write metrics to " << opts.metrics_path << "!"
+            << endl;
+        return 5;
+      }
+    }
+
+    // Maps, the canvas and converted frames are consumed by the compose
+    // stage, so they are allocated and first touched by it. Workers compose
+    // in their own processes
+    pin(compose_cpus);
+    if (!segment && !compose_cpus.empty()) {
+      setNumThreads((int)compose_cpus.size());
+    }
+    // threads of OpenCV's pool which missed pinning are reported with the
+    // placement
+    int pool_pinned = getNumThreads();
+    if (!segment && pinned) {
+      pool_pinned = pinParallelThreads(compose_cpus.empty() ? all_cpus
+          : compose_cpus);
+    }
+
+    // Maps are rebuilt in the background when the config changes or the
+    // cameras drift, the frame loop picks up the new ones at frame start
+    RigUpdater updater(buildRig(config, frame_sizes), opts.stitch_config,
+        opts.drift_interval);
+    shared_ptr<const rig_t> rig = updater.current();
+    for (size_t i = 0; i < rig->maps.size(); ++i) {
+      const warp_maps_t &maps = rig->maps[i];
+      cout << "Map for camera #" << i << ": "
+          << maps.map.total() * maps.map.elemSize() / 1024 << " KB";
+      if (maps.grid > 1) {
+        cout << ", max error " << maps.maxError << " px";
+      }
+      if (!maps.tiles.empty()) {
+        cout << ", " << maps.tiles.size() << " blocks";
+      }
+      cout << endl;
+    }
+
+    // In throughput schedule every frame in flight has its own canvas and
+    // frames, composing one of them is a job of a single thread
+    const int in_flight = !throughput ? 1 : opts.frames_in_flight > 0
+        ? opts.frames_in_flight
+        : compose_cpus.empty() ? getNumberOfCPUs() : (int)compose_cpus.size();
+    vector<in_flight_t> slots(throughput ? in_flight : 0);
+    for (in_flight_t &slot : slots) {
+      slot.captured.resize(videos.size());
+      slot.frames.resize(videos.size());
+      slot.timestamps.resize(videos.size());
+      slot.canvas = opts.planar ? createNV12Canvas(result_size)
+          : allocateFirstTouch(result_size, type);
+    }
+    // A frame in flight is composed by the thread of its slot alone, the
+    // stream encoder has threads of its own
+    if (throughput) {
+      setNumThreads(1);
     }
+    metrics.buffers.set(throughput ? (double)slots.size() : 1);
 
-    while (true) {
-      Mat result(result_size, type);
+    Mat result = segment ? segment->canvas()
+        : throughput ? slots[0].canvas
+        : opts.planar ? createNV12Canvas(result_size)
+        : allocateFirstTouch(result_size, type);
+    Mat shown;
+    vector<frame_changes_t> changes(videos.size());
+    vector<Mat> frames(videos.size());
+    vector<Mat> captured(videos.size());
+    vector<Mat> lumas(videos.size());
+    vector<int> dirty;
+    for (size_t i = 0; i < videos.size(); ++i) {
+      // Converted frames are written to the segment directly. Frames in
+      // flight have buffers of their own
+      if (segment) {
+        frames[i] = segment->frame(i);
+      } else if (convert[i] && !throughput && opts.planar) {
+        frames[i] = allocateFirstTouch(Size(frame_sizes[i].width,
+            frame_sizes[i].height / 2 * 3), CV_8UC1);
+      } else if (convert[i] && !throughput) {
+        frames[i] = allocateFirstTouch(frame_sizes[i], CV_8UC3);
+      }
+    }
+
+    for (const numa_node_t &node : numaNodes()) {
+      cout << "NUMA node " << node.id << ": cpus "
+          << formatCpuSet(node.cpus) << endl;
+    }
+    cout << "Read stage: " << describeCpuSet(read_cpus) << endl;
+    cout << "Compose stage: " << describeCpuSet(compose_cpus) << ", ";
+    if (segment) {
+      cout << opts.shard_workers << " worker processes" << endl;
+    } else if (throughput) {
+      cout << in_flight << " frames in flight, canvas on "
+          << describePageNodes(pageNodes(result.data,
+              result.total() * result.elemSize())) << endl;
+    } else {
+      cout << getNumThreads() << " threads, canvas on "
+          << describePageNodes(pageNodes(result.data,
+              result.total() * result.elemSize())) << endl;
+    }
+    if (!segment && pool_pinned < getNumThreads()) {
+      cout << "Warning: only " << pool_pinned << " of " << getNumThreads()
+          << " compose threads are pinned, the others may run on any CPU"
+          << endl;
+    }
+    if (server) {
+      cout << "Encode stage: " << describeCpuSet(encode_cpus) << endl;
+    }
+    double updated_total = 0;
+    int frame_count = 0;
+
+    // Per-stage latencies exclude the time spent waiting for frames to be due
+    ReplayPacer pacer(replaying && opts.original_pace);
+    LatencyStats read_stats, compose_stats, record_stats, frame_stats;
+    vector<int64_t> timestamps(videos.size());
+    uint64_t checksum = 0;
+    const auto loop_start = chrono::steady_clock::now();
+    // frames per second are averaged over about the last kFpsWindow frames
+    const double kFpsWindow = 30;
+    auto last_output = loop_start;
+    double frame_interval = 0;
+
+    // Everything after composition happens in frame order in both schedules
+    auto finish_frame = [&](const vector<Mat> &composed,
+        const vector<int64_t> &composed_timestamps, const Mat &canvas,
+        double read_ms, double compose_ms, double updated) {
+      auto finish_start = chrono::steady_clock::now();
+      if (opts.planar) {
+        // the board is searched for in luma planes
+        Mat chroma;
+        for (size_t i = 0; i < composed.size(); ++i) {
+          splitNV12(composed[i], lumas[i], chroma);
+        }
+        updater.offerFrames(lumas);
+      } else {
+        updater.offerFrames(composed);
+      }
+
+      auto record_end = chrono::steady_clock::now();
+      if (recorder) {
+        auto record_start = record_end;
+        if (!recorder->write(composed, composed_timestamps)) {
+          cout << "Failed to record frames to " << opts.record_path
+              << ", recording stopped" << endl;
+          recorder.reset();
+        }
+        record_end = chrono::steady_clock::now();
+        record_stats.add(chrono::duration<double, milli>(
+            record_end - record_start).count());
+      }
+      read_stats.add(read_ms);
+      compose_stats.add(compose_ms);
+      frame_stats.add(read_ms + compose_ms + chrono::duration<double, milli>(
+          record_end - finish_start).count());
+      metrics.read.observe(read_ms / 1000);
+      metrics.compose.observe(compose_ms / 1000);
+      metrics.frame.observe(read_ms / 1000 + compose_ms / 1000 +
+          chrono::duration<double>(record_end - finish_start).count());
+
+      if (replaying) {
+        uint64_t frame_checksum = imageChecksum(canvas);
+        checksum = combineChecksums(checksum, frame_checksum);
+        if (opts.verbosity > 0) {
+          cout << "Frame #" << frame_count << ": checksum " << hex
+              << setw(16) << setfill('0') << frame_checksum << dec << endl;
+        }
+      }
+
+      if (opts.incremental) {
+        updated /= result_size.area();
+        updated_total += updated;
+        if (opts.verbosity > 0) {
+          cout << "Frame #" << frame_count << ": updated " << updated * 100
+              << "% of canvas" << endl;
+        }
+      }
+      ++frame_count;
+      // the display (interactive only) and the stream are the only
+      // consumers of BGR, headless runs do not convert the canvas
+      if ((opts.interactive && !replaying) || server) {
+        if (opts.planar) {
+          convertNV12ToBGR(canvas, shown);
+        } else {
+          shown = canvas;
+        }
+      }
+      if (server) {
+        // never waits for the encoder or the viewers
+        server->publish(shown);
+      }
+      if (!replaying) {
+        displayResult("Final", shown);
+        waitKey(30);
+      }
+
+      auto output = chrono::steady_clock::now();
+      const double interval = chrono::duration<double>(
+          output - last_output).count();
+      last_output = output;
+      frame_interval = 1 == frame_count ? interval
+          : frame_interval + (interval - frame_interval) / kFpsWindow;
+      metrics.frames.add();
+      if (frame_interval > 0) {
+        metrics.fps.set(1 / frame_interval);
+      }
+      if (server) {
+        metrics.stream_dropped.add(server->dropped() -
+            metrics.stream_dropped.value());
+      }
+      if (workers) {
+        metrics.shard_restarts.add((uint64_t)workers->restarts() -
+            metrics.shard_restarts.value());
+      }
+    };
+
+    // threads composing frames in flight run on the compose CPUs, they
+    // outlive the slots' frames
+    unique_ptr<InFlightSlots> in_flight_slots;
+    if (throughput) {
+      in_flight_slots.reset(new InFlightSlots(slots.size(), !pinned
+          ? vector<int>() : compose_cpus.empty() ? all_cpus : compose_cpus));
+    }
+    auto finish_in_flight = [&]() {
+      in_flight_t &slot = slots[in_flight_slots->finishOldest()];
+      finish_frame(slot.frames, slot.timestamps, slot.canvas, slot.read_ms,
+          slot.compose_ms, 0);
+      metrics.queued.set((double)in_flight_slots->pending());
+      metrics.busy_buffers.set((double)in_flight_slots->pending());
+    };
+    bool finished = false;
+    while (!finished) {
+      shared_ptr<const rig_t> next = updater.current();
+      if (next != rig && !throughput) {
+        // Footprints may have moved: start from an empty canvas and
+        // recompose everything
+        if (opts.planar) {
+          result = createNV12Canvas(result_size);
+        } else {
+          result.setTo(Scalar::all(0));
+        }
+        changes.assign(videos.size(), frame_changes_t());
+      }
+      rig = next;
+
+      // the slot is reused once its previous frame is output
+      if (throughput && in_flight_slots->full()) {
+        finish_in_flight();
+      }
+      in_flight_t *slot = throughput ? &slots[in_flight_slots->next()]
+          : nullptr;
+
+      // conversions below run through parallel_for_, that is on the
+      // compose CPUs
+      pin(read_cpus);
+      auto read_start = chrono::steady_clock::now();
       for (size_t i = 0; i < videos.size(); ++i) {
-        Mat frame;
+        Mat &frame = convert[i] ? captured[i] : frames[i];
+        auto decode_start = chrono::steady_clock::now();
         videos[i] >> frame;
-        Mat undistorted;
-        undistort(frame, undistorted, cameraMatrix[i], distCoeffs[i]);
-        warpPerspective(undistorted, result, H[i], result_size, INTER_LINEAR,
-            BORDER_TRANSPARENT);
+        if (frame.empty()) {
+          finished = true;
+          break;
+        }
+        metrics.decode[i]->observe(secondsSince(decode_start));
+        auto convert_start = chrono::steady_clock::now();
+        if (slot) {
+          // sources reuse their buffers, frames in flight keep copies
+          frame.copyTo(slot->captured[i]);
+        } else if (convert[i] && opts.planar) {
+          convertBGRToNV12(frame, frames[i]);
+        } else if (convert[i]) {
+          convertNV12ToBGR(frame, frames[i]);
+        }
+        if (!slot && convert[i]) {
+          metrics.convert[i]->observe(secondsSince(convert_start));
+        }
+        Mat shared = segment ? segment->frame(i) : Mat();
+        if (segment && frames[i].data != shared.data) {
+          frames[i].copyTo(shared);
+        }
+        // recordings keep the moments the stitcher got the frames at
+        timestamps[i] = replaying ? videos[i].timestamp()
+            : chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - loop_start).count();
+      }
+      if (finished) {
+        break;
+      }
+      auto read_end = chrono::steady_clock::now();
+      const double read_ms = chrono::duration<double, milli>(
+          read_end - read_start).count();
+      pacer.wait(timestamps[0]);
+
+      if (slot) {
+        slot->timestamps = timestamps;
+        slot->read_ms = read_ms;
+        slot->rig = rig;
+        in_flight_slots->submit([&, slot]() {
+          slot->compose_ms = composeInFlight(*slot, convert, kernel,
+              luma_kernel, chroma_kernel, metrics);
+        });
+        metrics.queued.set((double)in_flight_slots->pending());
+        metrics.busy_buffers.set((double)in_flight_slots->pending());
+        continue;
+      }
+
+      pin(compose_cpus);
+      metrics.queued.set(1);
+      metrics.busy_buffers.set(1);
+      auto compose_start = chrono::steady_clock::now();
+      double updated = 0;
+      if (workers && !workers->compose()) {
+        cout << "Shard workers keep failing, stopped at frame #"
+            << frame_count << endl;
+        break;
+      }
+      for (size_t i = 0; !workers && i < videos.size(); ++i) {
+        const Mat &frame = frames[i];
+        const warp_maps_t &maps = rig->maps[i];
+        auto warp_start = chrono::steady_clock::now();
+        if (opts.planar) {
+          remapTransparentNV12(frame, maps, rig->chroma[i],
+              lumaGain(rig->gains[i]), result, luma_kernel, chroma_kernel);
+        } else if (opts.incremental) {
+          detectChanges(frame, changes[i], opts.change_threshold);
+          selectDirtyTiles(maps, changes[i], dirty);
+          remapTransparentTiles(frame, maps, dirty, rig->gains[i], result,
+              kernel);
+          for (int t : dirty) {
+            updated += maps.tilePixels[t];
+          }
+        } else {
+          remapTransparent(frame, maps, rig->gains[i], result, kernel);
+        }
+        metrics.warp[i]->observe(secondsSince(warp_start));
       }
-      displayResult("Final", result);
-      waitKey(30);
+      auto compose_end = chrono::steady_clock::now();
+      finish_frame(frames, timestamps, result, read_ms,
+          chrono::duration<double, milli>(compose_end - compose_start).count(),
+          updated);
+      metrics.queued.set(0);
+    }
+
+    // frames still in flight are output in order
+    while (in_flight_slots && in_flight_slots->pending() > 0) {
+      finish_in_flight();
+    }
+
+    if (replaying && frame_count > 0) {
+      chrono::duration<double> elapsed =
+          chrono::steady_clock::now() - loop_start;
+      cout << "Replayed " << frame_count << " frames in " << elapsed.count()
+          << " s, " << frame_count / elapsed.count() << " fps" << endl;
+      read_stats.print(cout, "Read");
+      compose_stats.print(cout, "Compose");
+      if (record_stats.count() > 0) {
+        record_stats.print(cout, "Record");
+      }
+      frame_stats.print(cout, "Frame");
+      cout << "Output checksum: " << hex << setw(16) << setfill('0')
+          << checksum << dec << endl;
+    }
+
+    if (server) {
+      cout << "Streamed " << server->encoded() << " frames, dropped "
+          << server->dropped() << endl;
+    }
+
+    if (workers && workers->restarts() > 0) {
+      cout << "Restarted shard workers " << workers->restarts() << " times"
+          << endl;
+    }
+
+    if (opts.incremental && frame_count > 0) {
+      cout << "Updated " << updated_total / frame_count * 100
+          << "% of canvas per frame on average" << endl;
     }
   }
 
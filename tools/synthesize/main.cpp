@@ -0,0 +1,113 @@
+#include "rig.hpp"
+#include "synthetic.hpp"
+#include "opts.hpp"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+extern command_line_opts opts;
+
+namespace {
+
+// Score the config calibrate wrote against the ground truth
+int compareWithTruth() {
+  stitch_config_t truth, estimated;
+  int status = readStitchConfig(opts.truth_config, truth);
+  if (status != 0) {
+    cout << "Failed to read " << opts.truth_config << endl;
+    return status;
+  }
+  status = readStitchConfig(opts.stitch_config, estimated);
+  if (status != 0) {
+    cout << "Failed to read " << opts.stitch_config << endl;
+    return status;
+  }
+
+  const vector<double> errors = alignmentErrors(estimated, truth);
+  if (errors.empty()) {
+    cout << opts.stitch_config << " and " << opts.truth_config
+        << " have different cameras" << endl;
+    return 4;
+  }
+  for (size_t i = 0; i < errors.size(); ++i) {
+    cout << "Camera #" << i << ": max error " << errors[i] << " px" << endl;
+  }
+  cout << "Max alignment error: "
+      << *max_element(errors.begin(), errors.end()) << " px" << endl;
+  return 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+  if (!parse_command_line_opts(argc, argv)) {
+    cout << "Usage: " << argv[0] << " /path/to/output/dir";
+    return 1;
+  }
+  if (!opts.truth_config.empty()) {
+    return compareWithTruth();
+  }
+  if (opts.file_paths.size() != 1) {
+    cout << "Usage: " << argv[0] << " /path/to/output/dir";
+    return 2;
+  }
+
+  const string dir = opts.file_paths[0];
+  mkdir(dir.c_str(), 0755);
+
+  synthetic_rig_params_t params;
+  params.cameras = opts.synthetic_cameras;
+  params.frameSize = Size(opts.frame_width, opts.frame_height);
+  params.fov = opts.fov;
+  params.distortion = opts.distortion;
+  params.height = opts.camera_height;
+  params.pitch = opts.pitch;
+  params.board = Size(opts.board_width, opts.board_height);
+  params.mode = opts.mode;
+  params.arc = opts.arc;
+  params.jitter = opts.pose_jitter;
+  params.seed = opts.seed;
+  const synthetic_rig_t rig = makeSyntheticRig(params);
+
+  vector<string> paths;
+  for (size_t i = 0; i < rig.cameras.size(); ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "/camera_%02d.png", (int)i);
+    paths.push_back(dir + name);
+
+    auto start = chrono::steady_clock::now();
+    Mat view = renderView(rig, i, opts.supersampling);
+    chrono::duration<double, milli> elapsed =
+        chrono::steady_clock::now() - start;
+    if (!imwrite(paths.back(), view)) {
+      cout << "Failed to write " << paths.back() << endl;
+      return 5;
+    }
+    cout << "Rendered camera #" << i << " in " << elapsed.count() << " ms"
+        << endl;
+  }
+
+  const stitch_config_t config = syntheticConfig(rig, paths,
+      opts.max_megapixels);
+  if (!writeStitchConfig(opts.stitch_config, config)) {
+    cout << "Failed to write " << opts.stitch_config << endl;
+    return 5;
+  }
+  cout << rig.boards.size() << " boards of " << opts.board_width << "x"
+      << opts.board_height << ", ground truth for a canvas of "
+      << config.result_size << " written to " << opts.stitch_config << endl;
+
+  return 0;
+}